@@ -0,0 +1,313 @@
+#include "automaton.h"
+#include "memory.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CASC_AUTOMATON_ROOT 0
+
+static uint32_t
+automaton_node (struct CASC_Automaton *automaton)
+{
+	if (automaton->count == automaton->capacity)
+	{
+		const uint32_t capacity = automaton->capacity * 2;
+		struct CASC_Automaton_Node *nodes = casc_memory_reallocate (
+			automaton->memory, automaton->nodes,
+			capacity * sizeof (*nodes));
+
+		if (!nodes)
+		{
+			return CASC_AUTOMATON_NONE;
+		}
+
+		automaton->nodes = nodes;
+		automaton->capacity = capacity;
+	}
+
+	struct CASC_Automaton_Node *node =
+		&automaton->nodes [automaton->count];
+
+	node->child = CASC_AUTOMATON_NONE;
+	node->sibling = CASC_AUTOMATON_NONE;
+	node->fail = CASC_AUTOMATON_ROOT;
+	node->suffix = CASC_AUTOMATON_NONE;
+	node->output = CASC_AUTOMATON_NONE;
+	node->byte = 0;
+
+	return automaton->count++;
+}
+
+/* Follows the edge labelled `byte` from `node`, if there is one. */
+static uint32_t
+automaton_edge (
+	const struct CASC_Automaton *automaton,
+	uint32_t node,
+	unsigned char byte)
+{
+	if (node == CASC_AUTOMATON_ROOT && automaton->compiled)
+	{
+		return automaton->root [byte];
+	}
+
+	uint32_t child = automaton->nodes [node].child;
+
+	while (child != CASC_AUTOMATON_NONE)
+	{
+		if (automaton->nodes [child].byte == byte)
+		{
+			break;
+		}
+
+		child = automaton->nodes [child].sibling;
+	}
+
+	return child;
+}
+
+/*
+ * Whether `node` has any outputs.  Those of the root (i.e. the empty
+ * string) are excluded, being reported once per text rather than at each
+ * position.
+ */
+static int
+automaton_accepts (
+	const struct CASC_Automaton *automaton,
+	uint32_t node)
+{
+	return node != CASC_AUTOMATON_ROOT
+		&& automaton->nodes [node].output != CASC_AUTOMATON_NONE;
+}
+
+extern int
+casc_automaton_initialize (
+	struct CASC_Automaton *automaton,
+	struct CASC_Memory *memory)
+{
+	automaton->memory = memory;
+	automaton->nodes =
+		casc_memory_allocate (memory, 64 * sizeof (*automaton->nodes));
+	automaton->count = 0;
+	automaton->capacity = automaton->nodes ? 64 : 0;
+
+	automaton->outputs = NULL;
+	automaton->output_count = 0;
+	automaton->output_capacity = 0;
+
+	automaton->compiled = 0;
+
+	return automaton->nodes
+		&& automaton_node (automaton) == CASC_AUTOMATON_ROOT;
+}
+
+extern void
+casc_automaton_release (
+	struct CASC_Automaton *automaton)
+{
+	casc_memory_free (automaton->nodes);
+	automaton->nodes = NULL;
+	automaton->count = 0;
+	automaton->capacity = 0;
+
+	casc_memory_free (automaton->outputs);
+	automaton->outputs = NULL;
+	automaton->output_count = 0;
+	automaton->output_capacity = 0;
+}
+
+/*
+ * Adds `string`, reporting `value` whenever it is matched.  Must precede
+ * compilation.  Returns `0` when out of memory.
+ */
+extern int
+casc_automaton_insert (
+	struct CASC_Automaton *automaton,
+	const char *string,
+	size_t length,
+	int value)
+{
+	uint32_t node = CASC_AUTOMATON_ROOT;
+
+	for (size_t position = 0; position < length; position++)
+	{
+		const unsigned char byte = (unsigned char) string [position];
+		uint32_t next = automaton_edge (automaton, node, byte);
+
+		if (next == CASC_AUTOMATON_NONE)
+		{
+			next = automaton_node (automaton);
+
+			if (next == CASC_AUTOMATON_NONE)
+			{
+				return 0;
+			}
+
+			automaton->nodes [next].byte = byte;
+			automaton->nodes [next].sibling = automaton->nodes [node].child;
+			automaton->nodes [node].child = next;
+		}
+
+		node = next;
+	}
+
+	if (automaton->output_count == automaton->output_capacity)
+	{
+		const uint32_t capacity = automaton->output_capacity
+			? automaton->output_capacity * 2 : 64;
+		struct CASC_Automaton_Output *outputs = casc_memory_reallocate (
+			automaton->memory, automaton->outputs,
+			capacity * sizeof (*outputs));
+
+		if (!outputs)
+		{
+			return 0;
+		}
+
+		automaton->outputs = outputs;
+		automaton->output_capacity = capacity;
+	}
+
+	struct CASC_Automaton_Output *output =
+		&automaton->outputs [automaton->output_count];
+
+	output->value = value;
+	output->length = length;
+	output->next = automaton->nodes [node].output;
+	automaton->nodes [node].output = automaton->output_count++;
+
+	return 1;
+}
+
+/*
+ * Computes the failure and suffix links, breadth first, such that the
+ * links of a node only refer to nodes that are shallower.  Returns `0` when
+ * out of memory.
+ */
+extern int
+casc_automaton_compile (
+	struct CASC_Automaton *automaton)
+{
+	struct CASC_Automaton_Node *nodes = automaton->nodes;
+	uint32_t *queue = casc_memory_allocate_zeroed (
+		automaton->memory, automaton->count, sizeof (*queue));
+
+	if (!queue)
+	{
+		return 0;
+	}
+
+	uint32_t head = 0;
+	uint32_t tail = 0;
+
+	for (uint32_t child = nodes [CASC_AUTOMATON_ROOT].child;
+		child != CASC_AUTOMATON_NONE;
+		child = nodes [child].sibling)
+	{
+		queue [tail++] = child;
+	}
+
+	while (head < tail)
+	{
+		const uint32_t node = queue [head++];
+
+		for (uint32_t child = nodes [node].child;
+			child != CASC_AUTOMATON_NONE;
+			child = nodes [child].sibling)
+		{
+			const unsigned char byte = nodes [child].byte;
+			uint32_t fail = nodes [node].fail;
+			uint32_t next;
+
+			while ((next = automaton_edge (automaton, fail, byte))
+				== CASC_AUTOMATON_NONE && fail != CASC_AUTOMATON_ROOT)
+			{
+				fail = nodes [fail].fail;
+			}
+
+			fail = next != CASC_AUTOMATON_NONE
+				? next : CASC_AUTOMATON_ROOT;
+
+			nodes [child].fail = fail;
+			nodes [child].suffix = automaton_accepts (automaton, fail)
+				? fail : nodes [fail].suffix;
+
+			queue [tail++] = child;
+		}
+	}
+
+	casc_memory_free (queue);
+
+	for (unsigned int byte = 0; byte < 256; byte++)
+	{
+		const uint32_t next = automaton_edge (
+			automaton, CASC_AUTOMATON_ROOT, (unsigned char) byte);
+
+		automaton->root [byte] = next != CASC_AUTOMATON_NONE
+			? next : CASC_AUTOMATON_ROOT;
+	}
+
+	automaton->compiled = 1;
+	return 1;
+}
+
+static void
+automaton_emit (
+	const struct CASC_Automaton *automaton,
+	uint32_t node,
+	size_t end,
+	CASC_Automaton_Emit emit,
+	void *context)
+{
+	for (uint32_t position = automaton->nodes [node].output;
+		position != CASC_AUTOMATON_NONE;
+		position = automaton->outputs [position].next)
+	{
+		const struct CASC_Automaton_Output *output =
+			&automaton->outputs [position];
+
+		emit (context, output->value, end - output->length, end);
+	}
+}
+
+/*
+ * Calls `emit` with the value of each string found within `text`, once
+ * per occurrence, along with the bounds of the occurrence.  The automaton
+ * must have been compiled.
+ */
+extern void
+casc_automaton_match (
+	const struct CASC_Automaton *automaton,
+	const char *text,
+	size_t length,
+	CASC_Automaton_Emit emit,
+	void *context)
+{
+	const struct CASC_Automaton_Node *nodes = automaton->nodes;
+	uint32_t node = CASC_AUTOMATON_ROOT;
+
+	/* The empty string matches every text. */
+	automaton_emit (automaton, CASC_AUTOMATON_ROOT, 0, emit, context);
+
+	for (size_t position = 0; position < length; position++)
+	{
+		const unsigned char byte = (unsigned char) text [position];
+		uint32_t next;
+
+		while ((next = automaton_edge (automaton, node, byte))
+			== CASC_AUTOMATON_NONE)
+		{
+			node = nodes [node].fail;
+		}
+
+		node = next;
+
+		for (uint32_t match = automaton_accepts (automaton, node)
+				? node : nodes [node].suffix;
+			match != CASC_AUTOMATON_NONE;
+			match = nodes [match].suffix)
+		{
+			automaton_emit (
+				automaton, match, position + 1, emit, context);
+		}
+	}
+}
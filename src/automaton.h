@@ -0,0 +1,90 @@
+#ifndef CASC_AUTOMATON_H
+#define CASC_AUTOMATON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct CASC_Memory;
+
+#define CASC_AUTOMATON_NONE ((uint32_t) -1)
+
+struct CASC_Automaton_Node
+{
+	uint32_t child;
+	uint32_t sibling;
+	uint32_t fail;
+
+	/* The nearest node along the failure links having any outputs. */
+	uint32_t suffix;
+
+	/* The first of the outputs, each linking to the next. */
+	uint32_t output;
+
+	unsigned char byte;
+};
+
+struct CASC_Automaton_Output
+{
+	int value;
+	size_t length;
+	uint32_t next;
+};
+
+/*
+ * An Aho-Corasick automaton, matching any number of plain strings in a
+ * single pass over the text.  Transitions from the root are held in a
+ * table, while all others are kept as lists of siblings, which are short
+ * for the sets of names and extensions this is used with.
+ */
+struct CASC_Automaton
+{
+	struct CASC_Automaton_Node *nodes;
+	uint32_t count;
+	uint32_t capacity;
+
+	struct CASC_Automaton_Output *outputs;
+	uint32_t output_count;
+	uint32_t output_capacity;
+
+	uint32_t root [256];
+	int compiled;
+
+	struct CASC_Memory *memory;
+};
+
+typedef void
+(*CASC_Automaton_Emit) (
+	void *context,
+	int value,
+	size_t start,
+	size_t end);
+
+extern int
+casc_automaton_initialize (
+	struct CASC_Automaton *automaton,
+	struct CASC_Memory *memory);
+
+extern void
+casc_automaton_release (
+	struct CASC_Automaton *automaton);
+
+extern int
+casc_automaton_insert (
+	struct CASC_Automaton *automaton,
+	const char *string,
+	size_t length,
+	int value);
+
+extern int
+casc_automaton_compile (
+	struct CASC_Automaton *automaton);
+
+extern void
+casc_automaton_match (
+	const struct CASC_Automaton *automaton,
+	const char *text,
+	size_t length,
+	CASC_Automaton_Emit emit,
+	void *context);
+
+#endif
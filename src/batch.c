@@ -0,0 +1,276 @@
+#include "batch.h"
+#include "common.h"
+#include "memory.h"
+#include "storage.h"
+#include "thread.h"
+#include "trace.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <compat-5.3.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CASC_BATCH_METATABLE "Casc Batch"
+
+struct CASC_Batch_Result
+{
+	BYTE *data;
+	size_t size;
+	DWORD error;
+};
+
+/*
+ * The state is held within a userdata so that everything is released by
+ * the garbage collector, even when an error is raised while the results
+ * are being converted.  Workers have all been joined by then.
+ */
+struct CASC_Batch
+{
+	HANDLE handle;
+	struct CASC_Memory *memory;
+
+	char **names;
+	struct CASC_Batch_Result *results;
+	size_t count;
+
+	/* Guarded by `mutex`. */
+	size_t next;
+
+	CASC_Mutex mutex;
+	int mutex_initialized;
+};
+
+/*
+ * Decodes the whole of `name` into newly allocated memory (from `memory`),
+ * storing it in `data`, and its length in `size`.  Returns the error code,
+ * with `data` needing to be freed either way.  Safe to call from any
+ * thread.
+ */
+extern DWORD
+casc_batch_fetch (
+	HANDLE storage,
+	struct CASC_Memory *memory,
+	const char *name,
+	BYTE **data,
+	size_t *size)
+{
+	HANDLE handle;
+	ULONGLONG length;
+	DWORD bytes_read;
+
+	*data = NULL;
+	*size = 0;
+
+	if (!CascOpenFile (storage, name, 0, 0, &handle))
+	{
+		return casc_failure ();
+	}
+
+	DWORD error = ERROR_SUCCESS;
+
+	if (!CascGetFileSize64 (handle, &length))
+	{
+		error = casc_failure ();
+	}
+	else if (length > (ULONGLONG) 0xFFFFFFFF)
+	{
+		error = ERROR_FILE_CORRUPT;
+	}
+	else if (!(*data =
+		casc_memory_allocate (memory, length ? (size_t) length : 1)))
+	{
+		error = ERROR_NOT_ENOUGH_MEMORY;
+	}
+	else
+	{
+		while (*size < length)
+		{
+			if (!CascReadFile (handle, *data + *size,
+				(DWORD) (length - *size), &bytes_read))
+			{
+				error = casc_failure ();
+				break;
+			}
+
+			if (bytes_read == 0)
+			{
+				break;
+			}
+
+			*size += bytes_read;
+		}
+	}
+
+	CascCloseFile (handle);
+	return error;
+}
+
+static CASC_THREAD_FUNCTION (batch_worker)
+{
+	struct CASC_Batch *batch = argument;
+
+	while (true)
+	{
+		casc_mutex_lock (&batch->mutex);
+
+		if (batch->next >= batch->count)
+		{
+			casc_mutex_unlock (&batch->mutex);
+			break;
+		}
+
+		const size_t index = batch->next++;
+		casc_mutex_unlock (&batch->mutex);
+
+		struct CASC_Batch_Result *result = &batch->results [index];
+		const uint64_t start = casc_trace_begin ();
+
+		result->error = casc_batch_fetch (batch->handle, batch->memory,
+			batch->names [index], &result->data, &result->size);
+
+		casc_trace_end (start, "read_many", batch->names [index],
+			(uint64_t) result->size);
+	}
+
+	CASC_THREAD_RETURN;
+}
+
+static void
+batch_release (struct CASC_Batch *batch)
+{
+	if (batch->results)
+	{
+		for (size_t index = 0; index < batch->count; index++)
+		{
+			casc_memory_free (batch->results [index].data);
+		}
+
+		casc_memory_free (batch->results);
+		batch->results = NULL;
+	}
+
+	casc_names_free (batch->names, batch->count);
+	batch->names = NULL;
+
+	if (batch->mutex_initialized)
+	{
+		casc_mutex_destroy (&batch->mutex);
+		batch->mutex_initialized = 0;
+	}
+}
+
+static int
+batch_close (lua_State *L)
+{
+	batch_release (luaL_checkudata (L, 1, CASC_BATCH_METATABLE));
+	return 0;
+}
+
+static void
+batch_metatable (lua_State *L)
+{
+	if (luaL_newmetatable (L, CASC_BATCH_METATABLE))
+	{
+		lua_pushcfunction (L, batch_close);
+		lua_setfield (L, -2, "__gc");
+	}
+
+	lua_setmetatable (L, -2);
+}
+
+/*
+ * Reads every file of the sequence of names at `names` on a pool of
+ * `threads` workers, each with its own CascLib file handles.  Only once
+ * they are all done are the Lua strings created, on the calling thread.
+ * See `casc:read_many ()`.
+ */
+extern int
+casc_batch_read (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	int names,
+	int threads)
+{
+	names = lua_absindex (L, names);
+
+	struct CASC_Batch *batch = lua_newuserdata (L, sizeof (*batch));
+	memset (batch, 0, sizeof (*batch));
+	batch_metatable (L);
+
+	batch->handle = storage->handle;
+	batch->memory = storage->memory;
+	batch->names =
+		casc_names_copy (L, names, &batch->count, batch->memory);
+	batch->results = casc_memory_allocate_zeroed (batch->memory,
+		batch->count ? batch->count : 1, sizeof (*batch->results));
+
+	if (!batch->names || !batch->results)
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		goto error;
+	}
+
+	casc_mutex_initialize (&batch->mutex);
+	batch->mutex_initialized = 1;
+
+	if ((size_t) threads > batch->count)
+	{
+		threads = batch->count ? (int) batch->count : 1;
+	}
+
+	CASC_Thread workers [CASC_THREADS_MAXIMUM];
+	int started = 0;
+
+	while (started < threads
+		&& casc_thread_create (&workers [started], batch_worker, batch))
+	{
+		started++;
+	}
+
+	/* Lacking any worker, do the work on the calling thread. */
+	if (started == 0)
+	{
+		batch_worker (batch);
+	}
+
+	for (int index = 0; index < started; index++)
+	{
+		casc_thread_join (workers [index]);
+	}
+
+	lua_createtable (L, 0, (int) batch->count);
+	lua_newtable (L);
+
+	const int contents = lua_gettop (L) - 1;
+	const int errors = contents + 1;
+
+	for (size_t index = 0; index < batch->count; index++)
+	{
+		struct CASC_Batch_Result *result = &batch->results [index];
+
+		if (result->error == ERROR_SUCCESS)
+		{
+			lua_pushlstring (L, (const char *) result->data, result->size);
+			lua_setfield (L, contents, batch->names [index]);
+		}
+		else
+		{
+			lua_pushstring (L, strerror (result->error));
+			lua_setfield (L, errors, batch->names [index]);
+		}
+
+		/* Release each file once it is a string, limiting the peak. */
+		casc_memory_free (result->data);
+		result->data = NULL;
+	}
+
+	batch_release (batch);
+	return 2;
+
+error:
+	batch_release (batch);
+	return casc_result (L, 0);
+}
@@ -0,0 +1,26 @@
+#ifndef CASC_BATCH_H
+#define CASC_BATCH_H
+
+#include <CascPort.h>
+#include <lua.h>
+#include <stddef.h>
+
+struct CASC_Memory;
+struct CASC_Storage;
+
+extern DWORD
+casc_batch_fetch (
+	HANDLE storage,
+	struct CASC_Memory *memory,
+	const char *name,
+	BYTE **data,
+	size_t *size);
+
+extern int
+casc_batch_read (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	int names,
+	int threads);
+
+#endif
@@ -0,0 +1,220 @@
+#include "cache.h"
+#include "memory.h"
+#include <CascPort.h>
+#include <stddef.h>
+
+#define CACHE_EMPTY ((ULONGLONG) -1)
+
+/*
+ * Returns `0` if the block descriptors cannot be allocated.  The cache is
+ * linked to the caches of `memory` (if any) either way, until released.
+ */
+extern int
+casc_cache_initialize (
+	struct CASC_Cache *cache,
+	size_t count,
+	size_t size,
+	struct CASC_Memory *memory)
+{
+	cache->blocks = casc_memory_allocate_zeroed (
+		memory, count, sizeof (*cache->blocks));
+	cache->count = cache->blocks ? count : 0;
+	cache->size = size;
+	cache->clock = 0;
+	cache->pins = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+
+	cache->memory = memory;
+	cache->previous = NULL;
+	cache->next = memory ? memory->caches : NULL;
+
+	if (memory)
+	{
+		if (memory->caches)
+		{
+			memory->caches->previous = cache;
+		}
+
+		memory->caches = cache;
+	}
+
+	for (size_t index = 0; index < cache->count; index++)
+	{
+		cache->blocks [index].index = CACHE_EMPTY;
+	}
+
+	return !!cache->blocks;
+}
+
+extern void
+casc_cache_release (
+	struct CASC_Cache *cache)
+{
+	for (size_t index = 0; index < cache->count; index++)
+	{
+		casc_memory_free (cache->blocks [index].data);
+	}
+
+	casc_memory_free (cache->blocks);
+	cache->blocks = NULL;
+	cache->count = 0;
+
+	if (cache->memory)
+	{
+		if (cache->previous)
+		{
+			cache->previous->next = cache->next;
+		}
+		else
+		{
+			cache->memory->caches = cache->next;
+		}
+
+		if (cache->next)
+		{
+			cache->next->previous = cache->previous;
+		}
+
+		cache->memory = NULL;
+		cache->previous = NULL;
+		cache->next = NULL;
+	}
+}
+
+/*
+ * Returns the next tick of the clock by which recency is measured, which is
+ * that of the account of `cache`, if any.
+ */
+static ULONGLONG
+cache_tick (struct CASC_Cache *cache)
+{
+	return cache->memory ? ++cache->memory->clock : ++cache->clock;
+}
+
+/* Returns the cached block at `index`, or `NULL` if it is absent. */
+extern struct CASC_Cache_Block *
+casc_cache_find (
+	struct CASC_Cache *cache,
+	ULONGLONG index)
+{
+	for (size_t position = 0; position < cache->count; position++)
+	{
+		struct CASC_Cache_Block *block = &cache->blocks [position];
+
+		if (block->index == index)
+		{
+			block->used = cache_tick (cache);
+			cache->hits++;
+			return block;
+		}
+	}
+
+	cache->misses++;
+	return NULL;
+}
+
+/*
+ * Returns the least recently used block, repurposed for `index`, which the
+ * caller is expected to fill.  Should the caller fail to do so, it must
+ * reset `index` of the block to `(ULONGLONG) -1`.  Returns `NULL` if the
+ * block data cannot be allocated.
+ */
+extern struct CASC_Cache_Block *
+casc_cache_claim (
+	struct CASC_Cache *cache,
+	ULONGLONG index)
+{
+	struct CASC_Cache_Block *block = NULL;
+
+	for (size_t position = 0; position < cache->count; position++)
+	{
+		struct CASC_Cache_Block *candidate = &cache->blocks [position];
+
+		if (!block || candidate->used < block->used)
+		{
+			block = candidate;
+		}
+	}
+
+	if (block && !block->data)
+	{
+		block->data = casc_memory_allocate (cache->memory, cache->size);
+	}
+
+	if (!block || !block->data)
+	{
+		return NULL;
+	}
+
+	block->index = index;
+	block->length = 0;
+	block->used = cache_tick (cache);
+
+	return block;
+}
+
+/*
+ * Keeps the blocks of `cache` from being evicted, until as many calls to
+ * `casc_cache_unpin ()` are made.
+ */
+extern void
+casc_cache_pin (
+	struct CASC_Cache *cache)
+{
+	cache->pins++;
+}
+
+extern void
+casc_cache_unpin (
+	struct CASC_Cache *cache)
+{
+	cache->pins--;
+}
+
+/*
+ * Frees the data of cached blocks, across `caches` and those linked after
+ * it, least recently used first, until at least `size` bytes are freed.
+ * Pinned caches are skipped.  Returns the number of bytes freed.
+ */
+extern size_t
+casc_cache_evict (
+	struct CASC_Cache *caches,
+	size_t size)
+{
+	size_t freed = 0;
+
+	while (freed < size)
+	{
+		struct CASC_Cache *owner = NULL;
+		struct CASC_Cache_Block *victim = NULL;
+
+		for (struct CASC_Cache *cache = caches; cache; cache = cache->next)
+		{
+			for (size_t index = 0; !cache->pins && index < cache->count;
+				index++)
+			{
+				struct CASC_Cache_Block *block = &cache->blocks [index];
+
+				if (block->data && (!victim || block->used < victim->used))
+				{
+					owner = cache;
+					victim = block;
+				}
+			}
+		}
+
+		if (!victim)
+		{
+			break;
+		}
+
+		casc_memory_free (victim->data);
+		victim->data = NULL;
+		victim->index = CACHE_EMPTY;
+		victim->length = 0;
+		freed += owner->size;
+	}
+
+	return freed;
+}
@@ -0,0 +1,77 @@
+#ifndef CASC_CACHE_H
+#define CASC_CACHE_H
+
+#include <CascPort.h>
+#include <stddef.h>
+
+struct CASC_Memory;
+
+#define CASC_CACHE_BLOCKS 4
+#define CASC_CACHE_BLOCK_SIZE 0x10000
+
+struct CASC_Cache_Block
+{
+	ULONGLONG index;
+	size_t length;
+	ULONGLONG used;
+	BYTE *data;
+};
+
+/*
+ * A small least recently used cache of decoded, block aligned, file data.
+ * Blocks are allocated on first use, from `memory`, whose caches are all
+ * linked through `previous` and `next` so that they can be evicted.  A
+ * cache is skipped by eviction while `pins` is set, as is the case while
+ * a pointer into one of its blocks is held across allocations.
+ */
+struct CASC_Cache
+{
+	struct CASC_Cache_Block *blocks;
+	size_t count;
+	size_t size;
+	ULONGLONG clock;
+	int pins;
+
+	ULONGLONG hits;
+	ULONGLONG misses;
+
+	struct CASC_Memory *memory;
+	struct CASC_Cache *previous;
+	struct CASC_Cache *next;
+};
+
+extern int
+casc_cache_initialize (
+	struct CASC_Cache *cache,
+	size_t count,
+	size_t size,
+	struct CASC_Memory *memory);
+
+extern void
+casc_cache_release (
+	struct CASC_Cache *cache);
+
+extern struct CASC_Cache_Block *
+casc_cache_find (
+	struct CASC_Cache *cache,
+	ULONGLONG index);
+
+extern struct CASC_Cache_Block *
+casc_cache_claim (
+	struct CASC_Cache *cache,
+	ULONGLONG index);
+
+extern void
+casc_cache_pin (
+	struct CASC_Cache *cache);
+
+extern void
+casc_cache_unpin (
+	struct CASC_Cache *cache);
+
+extern size_t
+casc_cache_evict (
+	struct CASC_Cache *caches,
+	size_t size);
+
+#endif
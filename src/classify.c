@@ -0,0 +1,364 @@
+#include "classify.h"
+#include "automaton.h"
+#include "common.h"
+#include "memory.h"
+#include "storage.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <compat-5.3.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stddef.h>
+#include <string.h>
+
+#define CASC_CLASSIFY_METATABLE "Casc Classify"
+
+#define CASC_CLASSIFY_ANCHOR_ANY 0
+#define CASC_CLASSIFY_ANCHOR_START 1
+#define CASC_CLASSIFY_ANCHOR_END 2
+
+struct CASC_Classify_Bucket
+{
+	/* Whether the bucket is matched by a Lua pattern. */
+	int pattern;
+
+	/* Whether an empty plain string places every name in the bucket. */
+	int all;
+
+	int anchor;
+	lua_Integer count;
+	unsigned long mark;
+};
+
+/*
+ * The state is held within a userdata so that everything is released by
+ * the garbage collector, even when an error is raised midway (e.g. by a
+ * malformed pattern).
+ */
+struct CASC_Classify
+{
+	struct CASC_Automaton automaton;
+	struct CASC_Classify_Bucket *buckets;
+	int bucket_count;
+
+	/* The buckets matched by the current name. */
+	int *hits;
+	int hit_count;
+	unsigned long serial;
+	size_t length;
+
+	HANDLE find;
+};
+
+static void
+classify_release (struct CASC_Classify *classify)
+{
+	if (classify->find)
+	{
+		CascFindClose (classify->find);
+		classify->find = NULL;
+	}
+
+	casc_automaton_release (&classify->automaton);
+
+	casc_memory_free (classify->buckets);
+	classify->buckets = NULL;
+
+	casc_memory_free (classify->hits);
+	classify->hits = NULL;
+}
+
+static int
+classify_close (lua_State *L)
+{
+	classify_release (luaL_checkudata (L, 1, CASC_CLASSIFY_METATABLE));
+	return 0;
+}
+
+static void
+classify_metatable (lua_State *L)
+{
+	if (luaL_newmetatable (L, CASC_CLASSIFY_METATABLE))
+	{
+		lua_pushcfunction (L, classify_close);
+		lua_setfield (L, -2, "__gc");
+	}
+
+	lua_setmetatable (L, -2);
+}
+
+static void
+classify_hit (
+	struct CASC_Classify *classify,
+	int bucket)
+{
+	struct CASC_Classify_Bucket *entry = &classify->buckets [bucket];
+
+	if (entry->mark != classify->serial)
+	{
+		entry->mark = classify->serial;
+		classify->hits [classify->hit_count++] = bucket;
+	}
+}
+
+static void
+classify_emit (
+	void *context,
+	int bucket,
+	size_t start,
+	size_t end)
+{
+	struct CASC_Classify *classify = context;
+	const int anchor = classify->buckets [bucket].anchor;
+
+	if ((anchor == CASC_CLASSIFY_ANCHOR_START && start != 0)
+		|| (anchor == CASC_CLASSIFY_ANCHOR_END && end != classify->length))
+	{
+		return;
+	}
+
+	classify_hit (classify, bucket);
+}
+
+/*
+ * Adds the plain strings of the sequence at `index` to the automaton, as
+ * matching `bucket`.  Raises on anything but strings, and when out of
+ * memory.
+ */
+static void
+classify_strings (
+	lua_State *L,
+	struct CASC_Classify *classify,
+	int bucket,
+	int index)
+{
+	static const char * const
+	anchors [] = {
+		"any",
+		"start",
+		"end",
+		NULL
+	};
+
+	struct CASC_Classify_Bucket *entry = &classify->buckets [bucket];
+	entry->anchor = casc_option_choice (L, index, "anchor", "any", anchors);
+
+	const lua_Integer count = (lua_Integer) lua_rawlen (L, index);
+
+	for (lua_Integer position = 1; position <= count; position++)
+	{
+		lua_rawgeti (L, index, position);
+
+		if (lua_type (L, -1) != LUA_TSTRING)
+		{
+			luaL_error (L, "plain strings of a bucket must be strings");
+		}
+
+		size_t length;
+		const char *string = lua_tolstring (L, -1, &length);
+
+		if (length == 0)
+		{
+			/* Every name starts, ends with, and contains it. */
+			entry->all = 1;
+		}
+		else if (!casc_automaton_insert (
+			&classify->automaton, string, length, bucket))
+		{
+			luaL_error (L, "%s", strerror (ERROR_NOT_ENOUGH_MEMORY));
+		}
+
+		lua_pop (L, 1);
+	}
+}
+
+/*
+ * Enumerates the storage once, placing each file name in every bucket of
+ * the table at `index` that matches it.  The plain strings of all buckets
+ * are matched together, by a single automaton, while patterns are matched
+ * one by one.  See `casc:classify ()`.
+ */
+extern int
+casc_classify_compute (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	int index)
+{
+	index = lua_absindex (L, index);
+	luaL_checktype (L, index, LUA_TTABLE);
+
+	int bucket_count = 0;
+
+	for (lua_pushnil (L); lua_next (L, index); lua_pop (L, 1))
+	{
+		bucket_count++;
+	}
+
+	struct CASC_Classify *classify =
+		lua_newuserdata (L, sizeof (*classify));
+	memset (classify, 0, sizeof (*classify));
+	classify_metatable (L);
+	const int state = lua_gettop (L);
+
+	classify->buckets = casc_memory_allocate_zeroed (storage->memory,
+		(size_t) bucket_count + 1, sizeof (*classify->buckets));
+	classify->hits = casc_memory_allocate_zeroed (storage->memory,
+		(size_t) bucket_count + 1, sizeof (*classify->hits));
+	classify->bucket_count = bucket_count;
+
+	if (!classify->buckets || !classify->hits
+		|| !casc_automaton_initialize (
+			&classify->automaton, storage->memory))
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		goto error;
+	}
+
+	/* The lists, and patterns, by bucket, followed by the result. */
+	lua_createtable (L, bucket_count, 0);
+	lua_createtable (L, bucket_count, 0);
+	lua_createtable (L, 0, bucket_count);
+
+	const int lists = state + 1;
+	const int patterns = state + 2;
+	const int result = state + 3;
+	int bucket = 0;
+
+	for (lua_pushnil (L); lua_next (L, index); lua_pop (L, 1))
+	{
+		const int value = lua_gettop (L);
+
+		lua_newtable (L);
+		lua_pushvalue (L, value - 1);
+		lua_pushvalue (L, -2);
+		lua_rawset (L, result);
+		lua_rawseti (L, lists, bucket + 1);
+
+		switch (lua_type (L, value))
+		{
+			case LUA_TSTRING:
+			{
+				classify->buckets [bucket].pattern = 1;
+				lua_pushvalue (L, value);
+				lua_rawseti (L, patterns, bucket + 1);
+				break;
+			}
+
+			case LUA_TTABLE:
+			{
+				classify_strings (L, classify, bucket, value);
+				break;
+			}
+
+			default:
+			{
+				return luaL_error (L,
+					"buckets must be strings or tables");
+			}
+		}
+
+		bucket++;
+	}
+
+	if (!casc_automaton_compile (&classify->automaton))
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		goto error;
+	}
+
+	lua_getglobal (L, "string");
+	lua_getfield (L, -1, "find");
+	lua_replace (L, -2);
+	const int find = lua_gettop (L);
+
+	CASC_FIND_DATA data;
+	int status;
+
+	SetCascError (ERROR_SUCCESS);
+	classify->find = CascFindFirstFile (storage->handle, "*", &data, NULL);
+
+	for (status = !!classify->find; status;
+		status = CascFindNextFile (classify->find, &data))
+	{
+		const char *name = data.szFileName;
+
+		classify->serial++;
+		classify->hit_count = 0;
+		classify->length = strlen (name);
+
+		casc_automaton_match (&classify->automaton, name,
+			classify->length, classify_emit, classify);
+
+		for (bucket = 0; bucket < bucket_count; bucket++)
+		{
+			const struct CASC_Classify_Bucket *entry =
+				&classify->buckets [bucket];
+
+			if (entry->mark == classify->serial)
+			{
+				continue;
+			}
+
+			if (entry->all)
+			{
+				classify_hit (classify, bucket);
+				continue;
+			}
+
+			if (!entry->pattern)
+			{
+				continue;
+			}
+
+			lua_pushvalue (L, find);
+			lua_pushlstring (L, name, classify->length);
+			lua_rawgeti (L, patterns, bucket + 1);
+			lua_call (L, 2, 1);
+
+			if (!lua_isnil (L, -1))
+			{
+				classify_hit (classify, bucket);
+			}
+
+			lua_pop (L, 1);
+		}
+
+		if (classify->hit_count == 0)
+		{
+			continue;
+		}
+
+		lua_pushlstring (L, name, classify->length);
+
+		for (int hit = 0; hit < classify->hit_count; hit++)
+		{
+			struct CASC_Classify_Bucket *entry =
+				&classify->buckets [classify->hits [hit]];
+
+			lua_rawgeti (L, lists, classify->hits [hit] + 1);
+			lua_pushvalue (L, -2);
+			lua_rawseti (L, -2, ++entry->count);
+			lua_pop (L, 1);
+		}
+
+		lua_pop (L, 1);
+	}
+
+	if (GetCascError () != ERROR_SUCCESS)
+	{
+		goto error;
+	}
+
+	classify_release (classify);
+	lua_pushvalue (L, result);
+	return 1;
+
+error:
+	{
+		const DWORD error = GetCascError ();
+		classify_release (classify);
+		SetCascError (error);
+	}
+
+	return casc_result (L, 0);
+}
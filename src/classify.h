@@ -0,0 +1,14 @@
+#ifndef CASC_CLASSIFY_H
+#define CASC_CLASSIFY_H
+
+#include <lua.h>
+
+struct CASC_Storage;
+
+extern int
+casc_classify_compute (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	int index);
+
+#endif
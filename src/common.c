@@ -1,6 +1,8 @@
 #include "common.h"
+#include "memory.h"
 #include <CascLib.h>
 #include <CascPort.h>
+#include <lauxlib.h>
 #include <lua.h>
 #include <string.h>
 
@@ -24,3 +26,348 @@ casc_result (
 
 	return 3;
 }
+
+/*
+ * Returns the CascLib error code of a call that just failed.  Outside of
+ * Windows, the error state is shared by all threads, such that another one
+ * may have cleared it meanwhile, in which case a generic code is returned
+ * instead, so that the failure is never taken for a success.
+ */
+extern unsigned long
+casc_failure (void)
+{
+	const DWORD error = GetCascError ();
+
+	return error != ERROR_SUCCESS ? error : ERROR_CAN_NOT_COMPLETE;
+}
+
+/* Pushes `key` (an MD5 sized CKey or EKey) as a hexadecimal `string`. */
+extern void
+casc_push_key (
+	lua_State *L,
+	const unsigned char *key)
+{
+	static const char digits [] = "0123456789abcdef";
+	char text [MD5_HASH_SIZE * 2];
+
+	for (int index = 0; index < MD5_HASH_SIZE; index++)
+	{
+		text [index * 2] = digits [key [index] >> 4];
+		text [index * 2 + 1] = digits [key [index] & 0x0F];
+	}
+
+	lua_pushlstring (L, text, sizeof (text));
+}
+
+/*
+ * Reads the locale `name` of the options at `index`, being either the name
+ * of a single locale (e.g. `"enUS"`), `"all"`, or a `number` holding any
+ * combination of the CascLib locale flags.  Raises on anything else.
+ */
+extern unsigned long
+casc_option_locale (
+	lua_State *L,
+	int index,
+	const char *name,
+	unsigned long fallback)
+{
+	static const struct
+	{
+		const char *name;
+		unsigned long flags;
+	}
+	locales [] = {
+		{ "all", CASC_LOCALE_ALL },
+		{ "enUS", CASC_LOCALE_ENUS },
+		{ "koKR", CASC_LOCALE_KOKR },
+		{ "frFR", CASC_LOCALE_FRFR },
+		{ "deDE", CASC_LOCALE_DEDE },
+		{ "zhCN", CASC_LOCALE_ZHCN },
+		{ "esES", CASC_LOCALE_ESES },
+		{ "zhTW", CASC_LOCALE_ZHTW },
+		{ "enGB", CASC_LOCALE_ENGB },
+		{ "enCN", CASC_LOCALE_ENCN },
+		{ "enTW", CASC_LOCALE_ENTW },
+		{ "esMX", CASC_LOCALE_ESMX },
+		{ "ruRU", CASC_LOCALE_RURU },
+		{ "ptBR", CASC_LOCALE_PTBR },
+		{ "itIT", CASC_LOCALE_ITIT },
+		{ "ptPT", CASC_LOCALE_PTPT },
+		{ NULL, 0 }
+	};
+
+	if (!lua_istable (L, index))
+	{
+		return fallback;
+	}
+
+	unsigned long flags = fallback;
+	lua_getfield (L, index, name);
+
+	if (lua_type (L, -1) == LUA_TNUMBER)
+	{
+		flags = (unsigned long) lua_tointeger (L, -1);
+	}
+	else if (!lua_isnil (L, -1))
+	{
+		const char *value = lua_tostring (L, -1);
+		int locale = 0;
+
+		while (locales [locale].name
+			&& (!value || strcmp (locales [locale].name, value) != 0))
+		{
+			locale++;
+		}
+
+		if (!locales [locale].name)
+		{
+			luaL_error (L, "invalid value '%s' for option '%s'",
+				value ? value : "?", name);
+		}
+
+		flags = locales [locale].flags;
+	}
+
+	lua_pop (L, 1);
+	return flags;
+}
+
+/*
+ * Parses the hexadecimal `text` of `length` characters into `key` (an MD5
+ * sized CKey or EKey).  Returns `0` if `text` is not such a key.
+ */
+extern int
+casc_parse_key (
+	const char *text,
+	size_t length,
+	unsigned char *key)
+{
+	if (length != MD5_HASH_SIZE * 2)
+	{
+		return 0;
+	}
+
+	for (size_t index = 0; index < length; index++)
+	{
+		const char digit = text [index];
+		unsigned char value;
+
+		if (digit >= '0' && digit <= '9')
+		{
+			value = (unsigned char) (digit - '0');
+		}
+		else if (digit >= 'a' && digit <= 'f')
+		{
+			value = (unsigned char) (digit - 'a' + 10);
+		}
+		else if (digit >= 'A' && digit <= 'F')
+		{
+			value = (unsigned char) (digit - 'A' + 10);
+		}
+		else
+		{
+			return 0;
+		}
+
+		if (index % 2 == 0)
+		{
+			key [index / 2] = (unsigned char) (value << 4);
+		}
+		else
+		{
+			key [index / 2] |= value;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Copies the sequence of names (`string`) at `index` into native memory,
+ * storing the number of names in `count`.  Raises an error if any element
+ * is not a `string`, and returns `NULL` if out of memory.  The result is
+ * allocated from `memory`, and to be released with `casc_names_free ()`.
+ */
+extern char **
+casc_names_copy (
+	lua_State *L,
+	int index,
+	size_t *count,
+	struct CASC_Memory *memory)
+{
+	luaL_checktype (L, index, LUA_TTABLE);
+	*count = lua_rawlen (L, index);
+
+	for (size_t position = 1; position <= *count; position++)
+	{
+		lua_rawgeti (L, index, (lua_Integer) position);
+
+		if (lua_type (L, -1) != LUA_TSTRING)
+		{
+			luaL_error (L, "name at position %d is not a string",
+				(int) position);
+		}
+
+		lua_pop (L, 1);
+	}
+
+	char **names = casc_memory_allocate_zeroed (
+		memory, *count ? *count : 1, sizeof (*names));
+
+	if (!names)
+	{
+		return NULL;
+	}
+
+	for (size_t position = 0; position < *count; position++)
+	{
+		size_t length;
+
+		lua_rawgeti (L, index, (lua_Integer) position + 1);
+		const char *name = lua_tolstring (L, -1, &length);
+
+		if ((names [position] = casc_memory_allocate (memory, length + 1)))
+		{
+			memcpy (names [position], name, length + 1);
+		}
+
+		lua_pop (L, 1);
+
+		if (!names [position])
+		{
+			casc_names_free (names, position);
+			return NULL;
+		}
+	}
+
+	return names;
+}
+
+extern void
+casc_names_free (
+	char **names,
+	size_t count)
+{
+	if (!names)
+	{
+		return;
+	}
+
+	for (size_t position = 0; position < count; position++)
+	{
+		casc_memory_free (names [position]);
+	}
+
+	casc_memory_free (names);
+}
+
+/*
+ * The option helpers below read a single field from an (optional) options
+ * `table` at `index`.  An absent `table` or field yields `fallback`.
+ */
+
+extern int
+casc_option_boolean (
+	lua_State *L,
+	int index,
+	const char *name,
+	int fallback)
+{
+	if (!lua_istable (L, index))
+	{
+		return fallback;
+	}
+
+	lua_getfield (L, index, name);
+
+	if (!lua_isnil (L, -1))
+	{
+		fallback = lua_toboolean (L, -1);
+	}
+
+	lua_pop (L, 1);
+	return fallback;
+}
+
+extern lua_Integer
+casc_option_integer (
+	lua_State *L,
+	int index,
+	const char *name,
+	lua_Integer fallback)
+{
+	if (!lua_istable (L, index))
+	{
+		return fallback;
+	}
+
+	lua_getfield (L, index, name);
+
+	if (!lua_isnil (L, -1))
+	{
+		int is_number;
+		fallback = lua_tointegerx (L, -1, &is_number);
+
+		if (!is_number)
+		{
+			luaL_error (L, "option '%s' must be an integer", name);
+		}
+	}
+
+	lua_pop (L, 1);
+	return fallback;
+}
+
+/*
+ * Note that the returned `string` is only guaranteed to be valid while the
+ * options `table` is alive and unmodified.
+ */
+extern const char *
+casc_option_string (
+	lua_State *L,
+	int index,
+	const char *name,
+	const char *fallback)
+{
+	if (!lua_istable (L, index))
+	{
+		return fallback;
+	}
+
+	lua_getfield (L, index, name);
+
+	if (!lua_isnil (L, -1))
+	{
+		if (lua_type (L, -1) != LUA_TSTRING)
+		{
+			luaL_error (L, "option '%s' must be a string", name);
+		}
+
+		fallback = lua_tostring (L, -1);
+	}
+
+	lua_pop (L, 1);
+	return fallback;
+}
+
+extern int
+casc_option_choice (
+	lua_State *L,
+	int index,
+	const char *name,
+	const char *fallback,
+	const char * const choices [])
+{
+	const char *value = casc_option_string (L, index, name, fallback);
+
+	for (int choice = 0; choices [choice]; choice++)
+	{
+		if (strcmp (choices [choice], value) == 0)
+		{
+			return choice;
+		}
+	}
+
+	return luaL_error (L, "invalid value '%s' for option '%s'",
+		value, name);
+}
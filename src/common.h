@@ -2,10 +2,75 @@
 #define CASC_COMMON_H
 
 #include <lua.h>
+#include <stddef.h>
+
+struct CASC_Memory;
 
 extern int
 casc_result (
 	lua_State* L,
 	int status);
 
+extern unsigned long
+casc_failure (void);
+
+extern void
+casc_push_key (
+	lua_State *L,
+	const unsigned char *key);
+
+extern int
+casc_parse_key (
+	const char *text,
+	size_t length,
+	unsigned char *key);
+
+extern char **
+casc_names_copy (
+	lua_State *L,
+	int index,
+	size_t *count,
+	struct CASC_Memory *memory);
+
+extern void
+casc_names_free (
+	char **names,
+	size_t count);
+
+extern int
+casc_option_boolean (
+	lua_State *L,
+	int index,
+	const char *name,
+	int fallback);
+
+extern lua_Integer
+casc_option_integer (
+	lua_State *L,
+	int index,
+	const char *name,
+	lua_Integer fallback);
+
+extern const char *
+casc_option_string (
+	lua_State *L,
+	int index,
+	const char *name,
+	const char *fallback);
+
+extern int
+casc_option_choice (
+	lua_State *L,
+	int index,
+	const char *name,
+	const char *fallback,
+	const char * const choices []);
+
+extern unsigned long
+casc_option_locale (
+	lua_State *L,
+	int index,
+	const char *name,
+	unsigned long fallback);
+
 #endif
@@ -0,0 +1,137 @@
+#include "diff.h"
+#include "common.h"
+#include "index.h"
+#include "storage.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <compat-5.3.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <string.h>
+
+#define CASC_DIFF_METATABLE "Casc Diff"
+
+/*
+ * The state is held within a userdata so that everything is released by
+ * the garbage collector, even when an error is raised midway.
+ */
+struct CASC_Diff
+{
+	struct CASC_Index before;
+	struct CASC_Index after;
+	HANDLE find;
+};
+
+static void
+diff_release (struct CASC_Diff *diff)
+{
+	if (diff->find)
+	{
+		CascFindClose (diff->find);
+		diff->find = NULL;
+	}
+
+	casc_index_release (&diff->before);
+	casc_index_release (&diff->after);
+}
+
+static int
+diff_close (lua_State *L)
+{
+	diff_release (luaL_checkudata (L, 1, CASC_DIFF_METATABLE));
+	return 0;
+}
+
+static void
+diff_metatable (lua_State *L)
+{
+	if (luaL_newmetatable (L, CASC_DIFF_METATABLE))
+	{
+		lua_pushcfunction (L, diff_close);
+		lua_setfield (L, -2, "__gc");
+	}
+
+	lua_setmetatable (L, -2);
+}
+
+static void
+diff_append (
+	lua_State *L,
+	int list,
+	const char *name)
+{
+	lua_pushstring (L, name);
+	lua_rawseti (L, list, (lua_Integer) lua_rawlen (L, list) + 1);
+}
+
+extern int
+casc_diff_compute (
+	lua_State *L,
+	const struct CASC_Storage *before,
+	const struct CASC_Storage *after,
+	const char *pattern,
+	const int plain)
+{
+	struct CASC_Diff *diff = lua_newuserdata (L, sizeof (*diff));
+	casc_index_initialize (&diff->before, before->memory);
+	casc_index_initialize (&diff->after, after->memory);
+	diff->find = NULL;
+
+	diff_metatable (L);
+	const int state = lua_gettop (L);
+
+	if (!casc_index_gather (
+			L, &diff->before, before, &diff->find, pattern, plain)
+		|| !casc_index_gather (
+			L, &diff->after, after, &diff->find, pattern, plain))
+	{
+		goto error;
+	}
+
+	lua_newtable (L);
+	lua_newtable (L);
+	lua_newtable (L);
+
+	const int added = state + 1;
+	const int removed = state + 2;
+	const int changed = state + 3;
+
+	for (size_t position = 0; position < diff->after.count; position++)
+	{
+		const struct CASC_Index_Entry *entry =
+			&diff->after.entries [position];
+		struct CASC_Index_Entry *match =
+			casc_index_find (&diff->before, entry->name);
+
+		if (!match)
+		{
+			diff_append (L, added, entry->name);
+			continue;
+		}
+
+		match->mark = 1;
+
+		if (memcmp (match->ckey, entry->ckey, sizeof (entry->ckey)) != 0)
+		{
+			diff_append (L, changed, entry->name);
+		}
+	}
+
+	for (size_t position = 0; position < diff->before.count; position++)
+	{
+		const struct CASC_Index_Entry *entry =
+			&diff->before.entries [position];
+
+		if (!entry->mark)
+		{
+			diff_append (L, removed, entry->name);
+		}
+	}
+
+	diff_release (diff);
+	return 3;
+
+error:
+	diff_release (diff);
+	return casc_result (L, 0);
+}
@@ -0,0 +1,16 @@
+#ifndef CASC_DIFF_H
+#define CASC_DIFF_H
+
+#include <lua.h>
+
+struct CASC_Storage;
+
+extern int
+casc_diff_compute (
+	lua_State *L,
+	const struct CASC_Storage *before,
+	const struct CASC_Storage *after,
+	const char *pattern,
+	const int plain);
+
+#endif
@@ -0,0 +1,185 @@
+#include "encoded.h"
+#include "common.h"
+#include "storage.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Each file within a local data file is preceded by a header, holding
+ * (among others) the size of the header and the BLTE data that follows.
+ */
+#define CASC_ENCODED_HEADER_SIZE 0x1E
+#define CASC_ENCODED_SIZE_OFFSET 0x10
+
+/* The directories, relative to the storage, that can hold data files. */
+static const char * const
+encoded_directories [] =
+{
+	"Data/data/",
+	"data/",
+	"",
+	NULL
+};
+
+static FILE *
+encoded_open (
+	const struct CASC_Storage *storage,
+	const char *name)
+{
+	char path [4096];
+
+	for (int index = 0; encoded_directories [index]; index++)
+	{
+		const int length = snprintf (path, sizeof (path), "%s/%s%s",
+			storage->path, encoded_directories [index], name);
+
+		if (length < 0 || (size_t) length >= sizeof (path))
+		{
+			break;
+		}
+
+		FILE *stream = fopen (path, "rb");
+
+		if (stream)
+		{
+			return stream;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Reads the encoded data of the file described by `info` into a new
+ * userdata, pushed onto the stack, storing its size in `size`.  Returns
+ * `0` in case of error, with nothing pushed.
+ */
+static int
+encoded_fetch (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	const CASC_FILE_FULL_INFO *info,
+	size_t *size)
+{
+	unsigned char header [CASC_ENCODED_HEADER_SIZE + 4];
+
+	/* Reserve before opening, as allocation can raise. */
+	const size_t reserved = info->EncodedSize > CASC_ENCODED_HEADER_SIZE
+		? (size_t) info->EncodedSize : CASC_ENCODED_HEADER_SIZE;
+	unsigned char *data = lua_newuserdata (L, reserved);
+
+	FILE *stream = encoded_open (storage, info->DataFileName);
+
+	if (!stream)
+	{
+		SetCascError (ERROR_FILE_NOT_FOUND);
+		goto error;
+	}
+
+	if (fseek (stream, (long) info->SegmentOffset, SEEK_SET) != 0
+		|| fread (header, sizeof (header), 1, stream) != 1
+		|| memcmp (header + CASC_ENCODED_HEADER_SIZE, "BLTE", 4) != 0)
+	{
+		SetCascError (ERROR_BAD_FORMAT);
+		goto close;
+	}
+
+	const size_t total =
+		(size_t) header [CASC_ENCODED_SIZE_OFFSET]
+		| (size_t) header [CASC_ENCODED_SIZE_OFFSET + 1] << 8
+		| (size_t) header [CASC_ENCODED_SIZE_OFFSET + 2] << 16
+		| (size_t) header [CASC_ENCODED_SIZE_OFFSET + 3] << 24;
+
+	if (total <= CASC_ENCODED_HEADER_SIZE
+		|| total - CASC_ENCODED_HEADER_SIZE > reserved)
+	{
+		SetCascError (ERROR_BAD_FORMAT);
+		goto close;
+	}
+
+	*size = total - CASC_ENCODED_HEADER_SIZE;
+
+	if (fseek (stream, (long) info->SegmentOffset
+			+ CASC_ENCODED_HEADER_SIZE, SEEK_SET) != 0
+		|| fread (data, 1, *size, stream) != *size)
+	{
+		SetCascError (ERROR_FILE_CORRUPT);
+		goto close;
+	}
+
+	fclose (stream);
+	return 1;
+
+close:
+	fclose (stream);
+
+error:
+	lua_pop (L, 1);
+	return 0;
+}
+
+/*
+ * Pushes the encoded (BLTE) data of the file `key`, which is either a name
+ * or, if `by_ekey` is set, an EKey, followed by its EKey and the size of
+ * the data.  In case of error, pushes `nil`, a message, and a code.
+ */
+extern int
+casc_encoded_read (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	const void *key,
+	const int by_ekey)
+{
+	const DWORD flags = by_ekey ? CASC_OPEN_BY_EKEY : CASC_OPEN_BY_NAME;
+	CASC_FILE_FULL_INFO info;
+	HANDLE handle;
+	size_t size;
+
+	if (storage->online)
+	{
+		SetCascError (ERROR_NOT_SUPPORTED);
+		goto error;
+	}
+
+	if (!CascOpenFile (storage->handle, key, 0, flags, &handle))
+	{
+		goto error;
+	}
+
+	const int status = CascGetFileInfo (
+		handle, CascFileFullInfo, &info, sizeof (info), NULL);
+	const DWORD error = GetCascError ();
+
+	CascCloseFile (handle);
+	SetCascError (error);
+
+	if (!status)
+	{
+		goto error;
+	}
+
+	/* Files stored in multiple spans lack a single encoded blob. */
+	if (info.SpanCount > 1)
+	{
+		SetCascError (ERROR_NOT_SUPPORTED);
+		goto error;
+	}
+
+	if (!encoded_fetch (L, storage, &info, &size))
+	{
+		goto error;
+	}
+
+	lua_pushlstring (L, lua_touserdata (L, -1), size);
+	lua_replace (L, -2);
+	casc_push_key (L, info.EKey);
+	lua_pushinteger (L, (lua_Integer) size);
+	return 3;
+
+error:
+	return casc_result (L, 0);
+}
@@ -0,0 +1,15 @@
+#ifndef CASC_ENCODED_H
+#define CASC_ENCODED_H
+
+#include <lua.h>
+
+struct CASC_Storage;
+
+extern int
+casc_encoded_read (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	const void *key,
+	const int by_ekey);
+
+#endif
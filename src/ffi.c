@@ -0,0 +1,163 @@
+#include "ffi.h"
+#include "file.h"
+#include "memory.h"
+#include "storage.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <compat-5.3.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+CASC_FFI_API struct CASC_File *
+casc_ffi_open (
+	void *storage,
+	const char *name)
+{
+	struct CASC_File *file =
+		casc_memory_allocate (NULL, sizeof (*file));
+
+	if (!file)
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		return NULL;
+	}
+
+	if (!casc_file_open (file, storage, name, 0, NULL))
+	{
+		casc_memory_free (file);
+		return NULL;
+	}
+
+	return file;
+}
+
+CASC_FFI_API int64_t
+casc_ffi_read (
+	struct CASC_File *file,
+	uint8_t *buffer,
+	int64_t count)
+{
+	size_t total;
+
+	if (count < 0)
+	{
+		SetCascError (ERROR_INVALID_PARAMETER);
+		return -1;
+	}
+
+	if (!casc_file_fetch (file, buffer, (size_t) count, &total))
+	{
+		return -1;
+	}
+
+	return (int64_t) total;
+}
+
+/* The `whence` is `0`, `1`, or `2`, for `"set"`, `"cur"`, and `"end"`. */
+CASC_FFI_API int64_t
+casc_ffi_seek (
+	struct CASC_File *file,
+	int64_t offset,
+	int whence)
+{
+	static const DWORD
+	modes [] = {
+		FILE_BEGIN,
+		FILE_CURRENT,
+		FILE_END
+	};
+
+	ULONGLONG position;
+
+	if (whence < 0 || whence > 2)
+	{
+		SetCascError (ERROR_INVALID_PARAMETER);
+		return -1;
+	}
+
+	if (!casc_file_seek (file, offset, modes [whence], &position))
+	{
+		return -1;
+	}
+
+	return (int64_t) position;
+}
+
+CASC_FFI_API int64_t
+casc_ffi_size (
+	struct CASC_File *file)
+{
+	return (int64_t) file->size;
+}
+
+CASC_FFI_API void
+casc_ffi_close (
+	struct CASC_File *file)
+{
+	if (file)
+	{
+		CascCloseFile (file->handle);
+		casc_cache_release (&file->cache);
+		casc_memory_free (file);
+	}
+}
+
+CASC_FFI_API int
+casc_ffi_error (void)
+{
+	return (int) GetCascError ();
+}
+
+/*
+ * Returns the CascLib handle of a `Casc Storage` as a light userdata, for
+ * use with `casc_ffi_open ()`.  Raises an error if the storage is closed.
+ */
+static int
+ffi_storage (lua_State *L)
+{
+	const struct CASC_Storage *storage = casc_storage_access (L, 1);
+	luaL_argcheck (L, storage->handle, 1, "storage is closed");
+
+	lua_pushlightuserdata (L, storage->handle);
+	return 1;
+}
+
+/*
+ * Sets the address of a function as an integer, as ISO C does not allow
+ * converting it to an object pointer (such as a light userdata).
+ */
+static void
+ffi_symbol (
+	lua_State *L,
+	const char *name,
+	uintptr_t symbol)
+{
+	lua_pushinteger (L, (lua_Integer) symbol);
+	lua_setfield (L, -2, name);
+}
+
+/*
+ * Sets `casclib._ffi`, which holds the addresses of the C interface above,
+ * so that `casclib.ffi` can cast them, rather than having to locate and
+ * load this library again through `ffi.load ()`.
+ */
+extern void
+casc_ffi_register (
+	lua_State *L)
+{
+	lua_newtable (L);
+
+	lua_pushcfunction (L, ffi_storage);
+	lua_setfield (L, -2, "storage");
+
+	ffi_symbol (L, "open", (uintptr_t) casc_ffi_open);
+	ffi_symbol (L, "read", (uintptr_t) casc_ffi_read);
+	ffi_symbol (L, "seek", (uintptr_t) casc_ffi_seek);
+	ffi_symbol (L, "size", (uintptr_t) casc_ffi_size);
+	ffi_symbol (L, "close", (uintptr_t) casc_ffi_close);
+	ffi_symbol (L, "error", (uintptr_t) casc_ffi_error);
+
+	lua_setfield (L, -2, "_ffi");
+}
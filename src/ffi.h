@@ -0,0 +1,54 @@
+#ifndef CASC_FFI_H
+#define CASC_FFI_H
+
+#include <lua.h>
+#include <stdint.h>
+
+#if defined (_WIN32)
+#define CASC_FFI_API __declspec (dllexport)
+#else
+#define CASC_FFI_API __attribute__ ((visibility ("default")))
+#endif
+
+struct CASC_File;
+
+/*
+ * A plain C interface to files, intended for use through the LuaJIT FFI
+ * (see `casclib.ffi`).  These functions never touch a `lua_State`.  On
+ * failure, they return `NULL` or `-1`, with `casc_ffi_error ()` providing
+ * the error code.
+ */
+
+CASC_FFI_API struct CASC_File *
+casc_ffi_open (
+	void *storage,
+	const char *name);
+
+CASC_FFI_API int64_t
+casc_ffi_read (
+	struct CASC_File *file,
+	uint8_t *buffer,
+	int64_t count);
+
+CASC_FFI_API int64_t
+casc_ffi_seek (
+	struct CASC_File *file,
+	int64_t offset,
+	int whence);
+
+CASC_FFI_API int64_t
+casc_ffi_size (
+	struct CASC_File *file);
+
+CASC_FFI_API void
+casc_ffi_close (
+	struct CASC_File *file);
+
+CASC_FFI_API int
+casc_ffi_error (void);
+
+extern void
+casc_ffi_register (
+	lua_State *L);
+
+#endif
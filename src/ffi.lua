@@ -0,0 +1,133 @@
+-- A LuaJIT FFI interface to the files of a `Casc Storage`.
+--
+-- This bypasses the Lua C API entirely, calling into the C interface found
+-- in `ffi.c` directly, with data read into caller owned buffers (e.g.
+-- `uint8_t []`).  This allows loops that read files to remain compiled by
+-- the JIT.
+--
+-- Files opened through this module are independent of the `Casc File`
+-- objects of the storage, and are not closed when the storage is closed.
+-- They are closed when garbage collected, or via `file:close ()`.
+
+local casclib = require ('casclib')
+local ffi = require ('ffi')
+
+ffi.cdef [[
+	typedef struct casc_ffi_file casc_ffi_file;
+
+	typedef struct
+	{
+		casc_ffi_file *handle;
+	}
+	casc_ffi;
+
+	char *strerror (int);
+]]
+
+local symbols = casclib._ffi
+
+local C = {
+	open = ffi.cast (
+		'casc_ffi_file * (*) (void *, const char *)', symbols.open),
+	read = ffi.cast (
+		'int64_t (*) (casc_ffi_file *, uint8_t *, int64_t)', symbols.read),
+	seek = ffi.cast (
+		'int64_t (*) (casc_ffi_file *, int64_t, int)', symbols.seek),
+	size = ffi.cast ('int64_t (*) (casc_ffi_file *)', symbols.size),
+	close = ffi.cast ('void (*) (casc_ffi_file *)', symbols.close),
+	error = ffi.cast ('int (*) (void)', symbols.error)
+}
+
+local whences = {
+	set = 0,
+	cur = 1,
+	['end'] = 2
+}
+
+local function result ()
+	local code = C.error ()
+	return nil, ffi.string (ffi.C.strerror (code)), code
+end
+
+local function check (self)
+	if self.handle == nil then
+		error ('attempt to use a closed file', 3)
+	end
+end
+
+local File = {}
+File.__index = File
+
+-- `file:read (buffer, count)`
+--
+-- Reads up to `count` (`number`) bytes into `buffer` (`cdata`), returning
+-- the number of bytes read (`0` at end of file).
+function File:read (buffer, count)
+	check (self)
+	local total = C.read (self.handle, buffer, count)
+
+	if total < 0 then
+		return result ()
+	end
+
+	return tonumber (total)
+end
+
+-- `file:seek ([whence [, offset]])`
+--
+-- As per `file:seek ()` of a `Casc File`.
+function File:seek (whence, offset)
+	check (self)
+	local position = C.seek (
+		self.handle, offset or 0, whences [whence or 'cur'] or -1)
+
+	if position < 0 then
+		return result ()
+	end
+
+	return tonumber (position)
+end
+
+-- `file:size ()`
+--
+-- Returns the size of the file (`number`).
+function File:size ()
+	check (self)
+	return tonumber (C.size (self.handle))
+end
+
+-- `file:close ()`
+--
+-- Closes the file.  Returns `true`.
+function File:close ()
+	if self.handle ~= nil then
+		C.close (self.handle)
+		self.handle = nil
+	end
+
+	return true
+end
+
+File.__gc = File.close
+
+local new = ffi.metatype ('casc_ffi', File)
+
+local M = {}
+
+-- `casclib.ffi.open (casc, name)`
+--
+-- Opens the file specified by `name` (`string`) within the `casc` storage.
+--
+-- In case of error, returns `nil`, a `string` describing the error, and
+-- a `number` indicating the error code.
+function M.open (casc, name)
+	local handle = C.open (symbols.storage (casc), name)
+
+	if handle == nil then
+		return result ()
+	end
+
+	return new (handle)
+end
+
+return M
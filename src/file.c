@@ -1,7 +1,11 @@
 #include "file.h"
 #include "common.h"
+#include "lines.h"
+#include "memory.h"
 #include "registry.h"
 #include "storage.h"
+#include "trace.h"
+#include "unpack.h"
 #include <CascLib.h>
 #include <CascPort.h>
 #include <compat-5.3.h>
@@ -9,10 +13,39 @@
 #include <luaconf.h>
 #include <lua.h>
 #include <lualib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define CASC_FILE_METATABLE "Casc File"
 
+/* A file is closed when it is neither open, nor pending a lazy open. */
+static int
+file_closed (const struct CASC_File *file)
+{
+	return !file->handle && !file->data && !file->name;
+}
+
+/*
+ * Records the name of `file` in the access profile of its storage, along
+ * with `offset`, the first time it is accessed.
+ */
+static void
+file_record (
+	struct CASC_File *file,
+	ULONGLONG offset)
+{
+	if (file->profile)
+	{
+		fprintf (file->storage->profile, "%llu\t%s\n",
+			(unsigned long long) offset, file->profile);
+
+		casc_memory_free (file->profile);
+		file->profile = NULL;
+	}
+}
+
 /**
  * `file:seek ([whence [, offset]])`
  *
@@ -54,20 +87,19 @@ file_seek (lua_State *L)
 		NULL
 	};
 
-	const struct CASC_File *file = casc_file_access (L, 1);
+	struct CASC_File *file = casc_file_access (L, 1);
 	const int option = luaL_checkoption (L, 2, "cur", mode_options);
 	const int mode = modes [option];
 	const lua_Integer offset = luaL_optinteger (L, 3, 0);
 
-	if (!file->handle)
+	if (!casc_file_ready (file))
 	{
-		SetCascError (ERROR_INVALID_HANDLE);
 		goto error;
 	}
 
 	ULONGLONG position;
 
-	if (!CascSetFilePointer64 (file->handle, offset, &position, mode))
+	if (!casc_file_seek (file, offset, mode, &position))
 	{
 		goto error;
 	}
@@ -82,86 +114,83 @@ error:
 static int
 read_line (
 	lua_State *L,
-	const struct CASC_File *file,
+	struct CASC_File *file,
 	int chop)
 {
 	luaL_Buffer line;
 	luaL_buffinit (L, &line);
 
-	DWORD bytes_read;
-	char character = '\0';
+	const BYTE *data;
+	size_t available;
 	int status = 1;
-	int error;
+	int found = 0;
+
+	/* The buffer may allocate, which must not evict the window. */
+	casc_cache_pin (&file->cache);
 
-	while (status && character != '\n')
+	while (!found)
 	{
-		char *buffer = luaL_prepbuffer (&line);
-		int index = 0;
+		if (!casc_file_window (file, &data, &available))
+		{
+			status = 0;
+			break;
+		}
 
-		while (index < LUAL_BUFFERSIZE)
+		if (available == 0)
 		{
-			status = CascReadFile (
-				file->handle, &character, 1, &bytes_read);
-			error = GetCascError ();
+			break;
+		}
 
-			if (!status || bytes_read == 0 || character == '\n')
-			{
-				status = 0;
-				break;
-			}
+		const BYTE *end = memchr (data, '\n', available);
+		const size_t length = end ? (size_t) (end - data) : available;
 
-			buffer [index++] = character;
-		}
+		luaL_addlstring (&line, (const char *) data, length);
+		file->position += length;
 
-		luaL_addsize (&line, index);
+		if (end)
+		{
+			file->position++;
+			found = 1;
+		}
 	}
 
-	if (!chop && character == '\n')
+	casc_cache_unpin (&file->cache);
+
+	if (!chop && found)
 	{
-		luaL_addchar (&line, character);
+		luaL_addchar (&line, '\n');
 	}
 
 	luaL_pushresult (&line);
-	SetCascError (error);
-	return status;
+	return status && (found || lua_rawlen (L, -1) > 0);
 }
 
 static int
 read_characters (
 	lua_State *L,
-	const struct CASC_File *file,
+	struct CASC_File *file,
 	lua_Unsigned count)
 {
 	luaL_Buffer characters;
 	luaL_buffinit (L, &characters);
 
-	DWORD bytes_to_read;
-	DWORD bytes_read;
-	int status = 1;
-	int error = ERROR_SUCCESS;
+	const ULONGLONG remaining =
+		file->size > file->position ? file->size - file->position : 0;
 
-	while (count > 0 && status)
+	if (count > remaining)
 	{
-		bytes_to_read = count > LUAL_BUFFERSIZE ? LUAL_BUFFERSIZE : count;
-		count -= bytes_to_read;
-		char *buffer = luaL_prepbuffsize (&characters, bytes_to_read);
-
-		status = CascReadFile (
-			file->handle, buffer, bytes_to_read, &bytes_read);
-		error = GetCascError ();
-
-		if (!status || bytes_read == 0)
-		{
-			status = 0;
-			break;
-		}
-
-		luaL_addsize (&characters, bytes_read);
+		count = remaining;
 	}
 
+	char *buffer = luaL_prepbuffsize (&characters, (size_t) count);
+	size_t total;
+	int status = casc_file_fetch (file, buffer, (size_t) count, &total);
+
+	luaL_addsize (&characters, total);
 	luaL_pushresult (&characters);
-	SetCascError (error);
-	return status;
+
+	/* As with Lua, reading zero bytes tests for end of file. */
+	return status && (total > 0 || (count == 0 && remaining > 0));
 }
 
 /**
@@ -193,16 +222,9 @@ read_characters (
 static int
 file_read (lua_State *L)
 {
-	const struct CASC_File *file = casc_file_access (L, 1);
-	ULONGLONG size;
-
-	if (!file->handle)
-	{
-		SetCascError (ERROR_INVALID_HANDLE);
-		goto error;
-	}
+	struct CASC_File *file = casc_file_access (L, 1);
 
-	if (!CascGetFileSize64 (file->handle, &size))
+	if (!casc_file_ready (file))
 	{
 		goto error;
 	}
@@ -256,7 +278,9 @@ file_read (lua_State *L)
 
 			case 'a':
 			{
-				read_characters (L, file, (lua_Unsigned) size);
+				/* Only an error stops a read to the end of the file. */
+				status = read_characters (L, file, (lua_Unsigned) -1)
+					|| GetCascError () == ERROR_SUCCESS;
 				break;
 			}
 
@@ -293,6 +317,331 @@ error:
 	return casc_result (L, 0);
 }
 
+/**
+ * `file:unpack (format)`
+ *
+ * Reads the values described by `format` (`string`) from the current
+ * position of the `file`, and advances the position past them.  The format
+ * follows that of `string.unpack` in Lua 5.3 (with the exception of the
+ * `X` option, and integers being limited to at most eight bytes), and is
+ * supported regardless of the Lua version.  Values are decoded straight
+ * from the decoded file data, without creating intermediate strings.
+ *
+ * Returns the values read.  If the end of the file is reached before all
+ * values are read, returns `nil`, leaving the position unaltered.  An
+ * invalid `format` raises an error before anything is read.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+file_unpack (lua_State *L)
+{
+	struct CASC_File *file = casc_file_access (L, 1);
+	const char *format = luaL_checkstring (L, 2);
+
+	if (!casc_file_ready (file))
+	{
+		return casc_result (L, 0);
+	}
+
+	return casc_unpack (L, file, format);
+}
+
+/**
+ * `file:pread (offset, count)`
+ *
+ * Reads up to `count` (`number`) bytes of the file, starting at `offset`
+ * (`number`) bytes from its beginning, without using or altering the file
+ * position.
+ *
+ * Returns a `string` with the bytes read, which is truncated at the end of
+ * the file, and as such empty if `offset` is at or beyond it, as per
+ * `file:readv ()`.  In case of error, returns `nil`, a `string` describing
+ * the error, and a `number` indicating the error code.
+ */
+static int
+file_pread (lua_State *L)
+{
+	struct CASC_File *file = casc_file_access (L, 1);
+	const lua_Integer offset = luaL_checkinteger (L, 2);
+	const lua_Integer count = luaL_checkinteger (L, 3);
+
+	luaL_argcheck (L, offset >= 0, 2, "must not be negative");
+	luaL_argcheck (L, count >= 0, 3, "must not be negative");
+
+	if (!casc_file_ready (file))
+	{
+		goto error;
+	}
+
+	const ULONGLONG position = file->position;
+	file->position = (ULONGLONG) offset;
+
+	SetCascError (ERROR_SUCCESS);
+	const int status = read_characters (L, file, (lua_Unsigned) count);
+
+	file->position = position;
+
+	if (!status)
+	{
+		if (GetCascError () != ERROR_SUCCESS)
+		{
+			goto error;
+		}
+
+		lua_pop (L, 1);
+		lua_pushliteral (L, "");
+	}
+
+	return 1;
+
+error:
+	return casc_result (L, 0);
+}
+
+struct CASC_File_Range
+{
+	ULONGLONG offset;
+	ULONGLONG length;
+	int index;
+};
+
+static int
+file_compare_range (
+	const void *a,
+	const void *b)
+{
+	const struct CASC_File_Range *first = a;
+	const struct CASC_File_Range *second = b;
+
+	if (first->offset != second->offset)
+	{
+		return first->offset < second->offset ? -1 : 1;
+	}
+
+	return first->index - second->index;
+}
+
+/*
+ * Reads the bytes of `file` from `start` until `end` (or the end of the
+ * file), pushing them as a userdata, and storing their number in `total`.
+ */
+static int
+file_read_run (
+	lua_State *L,
+	struct CASC_File *file,
+	ULONGLONG start,
+	ULONGLONG end,
+	size_t *total)
+{
+	if (end > file->size)
+	{
+		end = file->size;
+	}
+
+	const size_t length = start < end ? (size_t) (end - start) : 0;
+	void *buffer = lua_newuserdata (L, length ? length : 1);
+
+	file->position = start;
+	return casc_file_fetch (file, buffer, length, total);
+}
+
+/**
+ * `file:readv (ranges)`
+ *
+ * Reads several ranges of the file in a single call, without using or
+ * altering the file position.  The `ranges` (`table`) is a sequence of
+ * ranges, each being a sequence of an offset (`number`) and a length
+ * (`number`).
+ *
+ * The ranges are read in order of their offset, with those that overlap or
+ * are adjacent being read together, such that no data is decoded twice.
+ *
+ * Returns a `table` (sequence) with a `string` for each range, in the order
+ * given.  Ranges extending beyond the end of the file are truncated, such
+ * that those starting at or beyond it are empty, as per `file:pread ()`.
+ * In case of error, returns `nil`, a `string` describing the error, and a
+ * `number` indicating the error code.
+ */
+static int
+file_readv (lua_State *L)
+{
+	struct CASC_File *file = casc_file_access (L, 1);
+	luaL_checktype (L, 2, LUA_TTABLE);
+	lua_settop (L, 2);
+
+	const int count = (int) lua_rawlen (L, 2);
+	struct CASC_File_Range *ranges = lua_newuserdata (
+		L, (count ? (size_t) count : 1) * sizeof (*ranges));
+
+	for (int index = 0; index < count; index++)
+	{
+		lua_rawgeti (L, 2, index + 1);
+		luaL_argcheck (L, lua_istable (L, -1), 2, "ranges must be tables");
+
+		lua_rawgeti (L, -1, 1);
+		lua_rawgeti (L, -2, 2);
+
+		const lua_Integer offset = luaL_checkinteger (L, -2);
+		const lua_Integer length = luaL_checkinteger (L, -1);
+
+		luaL_argcheck (L, offset >= 0 && length >= 0, 2,
+			"ranges must not be negative");
+
+		ranges [index].offset = (ULONGLONG) offset;
+		ranges [index].length = (ULONGLONG) length;
+		ranges [index].index = index + 1;
+		lua_pop (L, 3);
+	}
+
+	if (!casc_file_ready (file))
+	{
+		goto error;
+	}
+
+	qsort (ranges, (size_t) count, sizeof (*ranges), file_compare_range);
+	lua_createtable (L, count, 0);
+
+	const int result = lua_gettop (L);
+	const ULONGLONG position = file->position;
+	int first = 0;
+
+	while (first < count)
+	{
+		const ULONGLONG start = ranges [first].offset;
+		ULONGLONG end = start + ranges [first].length;
+		int last = first + 1;
+
+		/* Coalesce every range that overlaps or touches the run. */
+		while (last < count && ranges [last].offset <= end)
+		{
+			const ULONGLONG next =
+				ranges [last].offset + ranges [last].length;
+
+			end = next > end ? next : end;
+			last++;
+		}
+
+		size_t total;
+
+		if (!file_read_run (L, file, start, end, &total))
+		{
+			file->position = position;
+			goto error;
+		}
+
+		const char *data = lua_touserdata (L, -1);
+
+		for (; first < last; first++)
+		{
+			const struct CASC_File_Range *range = &ranges [first];
+			const size_t skip = (size_t) (range->offset - start);
+			size_t length = 0;
+
+			if (skip < total)
+			{
+				length = total - skip;
+
+				if (range->length < length)
+				{
+					length = (size_t) range->length;
+				}
+			}
+
+			lua_pushlstring (L, data + (length ? skip : 0), length);
+			lua_rawseti (L, result, range->index);
+		}
+
+		lua_pop (L, 1);
+	}
+
+	file->position = position;
+	return 1;
+
+error:
+	return casc_result (L, 0);
+}
+
+/**
+ * `file:each_chunk (callback [, size])`
+ *
+ * Reads the file from its current position until the end, in chunks of up
+ * to `size` (`number`) bytes (by default `65536`), calling `callback`
+ * (`function`) with each chunk (`string`) in turn.  Reading stops early
+ * should `callback` return `false`.
+ *
+ * Every chunk is decoded into the same native buffer, and then copied into
+ * the `string` passed to `callback`, so at most a single chunk is held in
+ * memory at a time, aside from those kept by `callback`.
+ *
+ * Returns the total number of bytes (`number`) passed to `callback`.  In
+ * case of error, returns `nil`, a `string` describing the error, and a
+ * `number` indicating the error code.  Errors raised by `callback` are
+ * propagated.
+ */
+static int
+file_each_chunk (lua_State *L)
+{
+	struct CASC_File *file = casc_file_access (L, 1);
+	luaL_checktype (L, 2, LUA_TFUNCTION);
+	const lua_Integer size = luaL_optinteger (L, 3, CASC_CACHE_BLOCK_SIZE);
+
+	luaL_argcheck (L, size > 0 && size <= 0x40000000, 3, "out of range");
+
+	if (!casc_file_ready (file))
+	{
+		goto error;
+	}
+
+	lua_settop (L, 2);
+	void *buffer = lua_newuserdata (L, (size_t) size);
+	lua_Integer bytes = 0;
+
+	while (1)
+	{
+		size_t total;
+
+		if (!casc_file_fetch (file, buffer, (size_t) size, &total))
+		{
+			goto error;
+		}
+
+		if (total == 0)
+		{
+			break;
+		}
+
+		bytes += (lua_Integer) total;
+
+		lua_pushvalue (L, 2);
+		lua_pushlstring (L, buffer, total);
+		lua_call (L, 1, 1);
+
+		const int stop = lua_type (L, -1) == LUA_TBOOLEAN
+			&& !lua_toboolean (L, -1);
+		lua_pop (L, 1);
+
+		if (stop)
+		{
+			break;
+		}
+
+		/* The callback is free to close the file. */
+		if (file_closed (file))
+		{
+			SetCascError (ERROR_INVALID_HANDLE);
+			goto error;
+		}
+	}
+
+	lua_pushinteger (L, bytes);
+	return 1;
+
+error:
+	return casc_result (L, 0);
+}
+
 static int
 lines_iterator (lua_State *L)
 {
@@ -300,7 +649,7 @@ lines_iterator (lua_State *L)
 		casc_file_access (L, lua_upvalueindex (1));
 	int results = 0;
 
-	if (!file->handle)
+	if (file_closed (file))
 	{
 		SetCascError (ERROR_INVALID_HANDLE);
 		goto error;
@@ -364,7 +713,7 @@ file_lines (lua_State *L)
 {
 	const struct CASC_File *file = casc_file_access (L, 1);
 
-	if (!file->handle)
+	if (file_closed (file))
 	{
 		SetCascError (ERROR_INVALID_HANDLE);
 		goto error;
@@ -385,6 +734,88 @@ error:
 	return casc_result (L, 0);
 }
 
+/**
+ * `file:index_lines ()`
+ *
+ * Indexes the lines of the `file`, by recording the offset at which each
+ * of them starts, in a single pass over its data.  The index is held
+ * natively by the `file` (using `4` bytes per line for files under 4 GiB),
+ * and is used by `file:line ()` and `file:lines_range ()`, which build it
+ * upon first use otherwise.  As with `file:lines ()`, a final line break
+ * does not begin another line.
+ *
+ * Returns a `Casc LineIndex` object, whose length (`#index`) is the number
+ * of lines, and which supports `index [line]`, as per `file:line ()`.
+ * Neither involves creating any other `string`.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+file_index_lines (lua_State *L)
+{
+	struct CASC_File *file = casc_file_access (L, 1);
+
+	if (!casc_file_ready (file))
+	{
+		return casc_result (L, 0);
+	}
+
+	return casc_lines_index (L, file, 1);
+}
+
+/**
+ * `file:line (line)`
+ *
+ * Returns the (one-based) `line` (`number`) of the `file`, as a `string`
+ * without its line break, or `nil` should it be out of range.  Only the
+ * data of that line is read, as located by the index of the lines (see
+ * `file:index_lines ()`).  The file position is left unaltered.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+file_line (lua_State *L)
+{
+	struct CASC_File *file = casc_file_access (L, 1);
+	const lua_Integer line = luaL_checkinteger (L, 2);
+
+	if (!casc_file_ready (file))
+	{
+		return casc_result (L, 0);
+	}
+
+	return casc_lines_line (L, file, line);
+}
+
+/**
+ * `file:lines_range (first [, last])`
+ *
+ * Returns a `table` (sequence) of the lines of the `file` from `first` to
+ * `last` (`number`), inclusive, as per `file:line ()`.  The range is
+ * clipped to the lines of the file, with `last` defaulting to the final
+ * one.  The file position is left unaltered.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+file_lines_range (lua_State *L)
+{
+	struct CASC_File *file = casc_file_access (L, 1);
+	const lua_Integer first = luaL_checkinteger (L, 2);
+	const lua_Integer last = luaL_optinteger (
+		L, 3, (lua_Integer) ((lua_Unsigned) -1 >> 1));
+
+	if (!casc_file_ready (file))
+	{
+		return casc_result (L, 0);
+	}
+
+	return casc_lines_range (L, file, first, last);
+}
+
 /**
  * `file:write (...)`
  *
@@ -419,7 +850,7 @@ file_setvbuf (lua_State *L)
 	struct CASC_File *file = casc_file_access (L, 1);
 	int status = 1;
 
-	if (!file->handle)
+	if (file_closed (file))
 	{
 		SetCascError (ERROR_INVALID_HANDLE);
 		status = 0;
@@ -444,7 +875,7 @@ file_flush (lua_State *L)
 	struct CASC_File *file = casc_file_access (L, 1);
 	int status = 1;
 
-	if (!file->handle)
+	if (file_closed (file))
 	{
 		SetCascError (ERROR_INVALID_HANDLE);
 		status = 0;
@@ -469,22 +900,87 @@ file_close (lua_State *L)
 	struct CASC_File *file = casc_file_access (L, 1);
 	int status = 0;
 
-	if (!file->handle)
+	if (file_closed (file))
 	{
 		SetCascError (ERROR_INVALID_HANDLE);
 	}
 	else
 	{
+		const uint64_t start = casc_trace_begin ();
+
+		file_record (file, file->position);
 		casc_registry_remove_file (L, file);
-		status = CascCloseFile (file->handle);
+		status = file->handle ? CascCloseFile (file->handle) : 1;
+		casc_trace_end (start, "close file", NULL, 0);
 		file->storage = NULL;
+		casc_cache_release (&file->cache);
+		casc_lines_release (file);
+		casc_memory_free (file->name);
 	}
 
 	file->handle = NULL;
+	file->data = NULL;
+	file->pack = NULL;
+	file->name = NULL;
 
 	return casc_result (L, status);
 }
 
+/**
+ * `file:cache ([blocks [, size]])`
+ *
+ * Returns the number of hits and misses (`number`) of the cache of decoded
+ * data held by the `file`, which serves reads and seeks that fall within
+ * recently decoded blocks without having CascLib decode them again.
+ *
+ * If `blocks` (`number`) is provided, the cache is first replaced by one
+ * holding that many blocks of `size` (`number`) bytes each (by default
+ * `65536`), which also resets the counters.  Each block is only allocated
+ * once it is used.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+file_cache (lua_State *L)
+{
+	struct CASC_File *file = casc_file_access (L, 1);
+
+	if (file_closed (file))
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		goto error;
+	}
+
+	if (!lua_isnoneornil (L, 2))
+	{
+		const lua_Integer blocks = luaL_checkinteger (L, 2);
+		const lua_Integer size =
+			luaL_optinteger (L, 3, CASC_CACHE_BLOCK_SIZE);
+
+		luaL_argcheck (L, blocks > 0, 2, "must be positive");
+		luaL_argcheck (L, size > 0 && size <= 0x40000000, 3,
+			"out of range");
+
+		struct CASC_Memory *memory = file->cache.memory;
+		casc_cache_release (&file->cache);
+
+		if (!casc_cache_initialize (
+			&file->cache, (size_t) blocks, (size_t) size, memory))
+		{
+			SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+			goto error;
+		}
+	}
+
+	lua_pushinteger (L, (lua_Integer) file->cache.hits);
+	lua_pushinteger (L, (lua_Integer) file->cache.misses);
+	return 2;
+
+error:
+	return casc_result (L, 0);
+}
+
 /**
  * `file:__tostring ()`
  *
@@ -495,7 +991,7 @@ static int
 file_to_string (lua_State *L)
 {
 	const struct CASC_File *file = casc_file_access (L, 1);
-	const char *text = !file->handle ? "%s (%p) (Closed)" : "%s (%p)";
+	const char *text = file_closed (file) ? "%s (%p) (Closed)" : "%s (%p)";
 
 	lua_pushfstring (L, text, CASC_FILE_METATABLE, file);
 	return 1;
@@ -506,11 +1002,19 @@ file_methods [] =
 {
 	{ "seek", file_seek },
 	{ "read", file_read },
+	{ "pread", file_pread },
+	{ "readv", file_readv },
+	{ "unpack", file_unpack },
 	{ "lines", file_lines },
+	{ "index_lines", file_index_lines },
+	{ "line", file_line },
+	{ "lines_range", file_lines_range },
+	{ "each_chunk", file_each_chunk },
 	{ "write", file_write },
 	{ "setvbuf", file_setvbuf },
 	{ "flush", file_flush },
 	{ "close", file_close },
+	{ "cache", file_cache },
 	{ "__tostring", file_to_string },
 	{ "__gc", file_close },
 	{ NULL, NULL }
@@ -533,19 +1037,34 @@ extern int
 casc_file_initialize (
 	lua_State *L,
 	const struct CASC_Storage *storage,
-	const char *name)
+	const char *name,
+	const int lazy,
+	DWORD locale)
 {
-	HANDLE handle;
+	struct CASC_File *file = lua_newuserdata (L, sizeof (*file));
 
-	if (!CascOpenFile (storage->handle, name, 0, 0, &handle))
+	if (!(lazy
+		? casc_file_defer (file, name, locale, storage->memory)
+		: casc_file_open (
+			file, storage->handle, name, locale, storage->memory)))
 	{
 		goto error;
 	}
 
-	struct CASC_File *file = lua_newuserdata (L, sizeof (*file));
-	file->handle = handle;
 	file->storage = storage;
 
+	/* Failing to record the profile is not worth failing the open. */
+	if (storage->profile)
+	{
+		const size_t length = strlen (name) + 1;
+
+		if ((file->profile =
+			casc_memory_allocate (storage->memory, length)))
+		{
+			memcpy (file->profile, name, length);
+		}
+	}
+
 	file_metatable (L);
 	casc_registry_insert_file (L, -1);
 
@@ -555,6 +1074,236 @@ error:
 	return casc_result (L, 0);
 }
 
+static int
+file_resolve (
+	struct CASC_File *file,
+	HANDLE storage,
+	const char *name)
+{
+	const uint64_t start = casc_trace_begin ();
+	const int status = CascOpenFile (
+		storage, name, file->locale, 0, &file->handle);
+
+	casc_trace_end (start, "open file", name, 0);
+
+	if (!status)
+	{
+		file->handle = NULL;
+		return 0;
+	}
+
+	if (!CascGetFileSize64 (file->handle, &file->size))
+	{
+		const DWORD error = GetCascError ();
+		CascCloseFile (file->handle);
+		file->handle = NULL;
+		SetCascError (error);
+		return 0;
+	}
+
+	return 1;
+}
+
+static int
+file_prepare (
+	struct CASC_File *file,
+	struct CASC_Memory *memory)
+{
+	file->handle = NULL;
+	file->storage = NULL;
+	file->data = NULL;
+	file->pack = NULL;
+	file->name = NULL;
+	file->profile = NULL;
+	file->locale = 0;
+	file->position = 0;
+	file->size = 0;
+	file->lines = NULL;
+
+	if (!casc_cache_initialize (&file->cache,
+		CASC_CACHE_BLOCKS, CASC_CACHE_BLOCK_SIZE, memory))
+	{
+		/* Unlinks it from `memory`, as the file is discarded. */
+		casc_cache_release (&file->cache);
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Opens `name` within the storage `handle`, filling in `file`, aside from
+ * its `storage`.  This does not involve Lua, and is shared with the FFI
+ * interface.  On failure, `0` is returned, and the CascLib error state is
+ * set.
+ */
+extern int
+casc_file_open (
+	struct CASC_File *file,
+	HANDLE storage,
+	const char *name,
+	DWORD locale,
+	struct CASC_Memory *memory)
+{
+	if (!file_prepare (file, memory))
+	{
+		return 0;
+	}
+
+	file->locale = locale;
+
+	if (!file_resolve (file, storage, name))
+	{
+		casc_cache_release (&file->cache);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Fills in `file`, aside from its `storage`, without opening `name`, which
+ * is deferred until `casc_file_ready ()`.
+ */
+extern int
+casc_file_defer (
+	struct CASC_File *file,
+	const char *name,
+	DWORD locale,
+	struct CASC_Memory *memory)
+{
+	if (!file_prepare (file, memory))
+	{
+		return 0;
+	}
+
+	file->locale = locale;
+
+	const size_t length = strlen (name) + 1;
+
+	if (!(file->name = casc_memory_allocate (memory, length)))
+	{
+		casc_cache_release (&file->cache);
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		return 0;
+	}
+
+	memcpy (file->name, name, length);
+	return 1;
+}
+
+/*
+ * Pushes a new file serving the `size` bytes at `data`, which belong to the
+ * pack at `pack`.  The pack is kept alive by the file (as its user value),
+ * and closes the file along with itself.
+ */
+extern int
+casc_file_map (
+	lua_State *L,
+	int pack,
+	const BYTE *data,
+	ULONGLONG size)
+{
+	pack = lua_absindex (L, pack);
+	struct CASC_File *file = lua_newuserdata (L, sizeof (*file));
+
+	if (!file_prepare (file, NULL))
+	{
+		return casc_result (L, 0);
+	}
+
+	file->data = data;
+	file->pack = lua_touserdata (L, pack);
+	file->size = size;
+
+	lua_pushvalue (L, pack);
+	lua_setuservalue (L, -2);
+	file_metatable (L);
+	casc_registry_insert_file (L, -1);
+
+	return 1;
+}
+
+/*
+ * Ensures that `file` is open, completing a deferred open if needed.  On
+ * failure (including a closed `file`), `0` is returned, and the CascLib
+ * error state is set.  A failed deferred open is attempted again on the
+ * next call.
+ */
+extern int
+casc_file_ready (
+	struct CASC_File *file)
+{
+	if (file->handle || file->data)
+	{
+		return 1;
+	}
+
+	if (!file->name)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		return 0;
+	}
+
+	if (!file_resolve (file, file->storage->handle, file->name))
+	{
+		return 0;
+	}
+
+	casc_memory_free (file->name);
+	file->name = NULL;
+
+	return 1;
+}
+
+/*
+ * Moves the position of `file`, as per `file:seek ()`, storing the result
+ * in `position`.  CascLib validates the new position, starting from our
+ * own.
+ */
+extern int
+casc_file_seek (
+	struct CASC_File *file,
+	LONGLONG offset,
+	DWORD mode,
+	ULONGLONG *position)
+{
+	const uint64_t start = casc_trace_begin ();
+	int status;
+
+	if (file->data)
+	{
+		const ULONGLONG base = mode == FILE_BEGIN ? 0
+			: mode == FILE_CURRENT ? file->position : file->size;
+
+		*position = base + (ULONGLONG) offset;
+		status = offset < 0
+			? (ULONGLONG) -offset <= base
+			: (ULONGLONG) offset <= file->size - base;
+
+		if (!status)
+		{
+			SetCascError (ERROR_INVALID_PARAMETER);
+		}
+	}
+	else
+	{
+		status = CascSetFilePointer64 (file->handle,
+				(LONGLONG) file->position, NULL, FILE_BEGIN)
+			&& CascSetFilePointer64 (
+				file->handle, offset, position, mode);
+	}
+
+	if (status)
+	{
+		file->position = *position;
+	}
+
+	casc_trace_end (start, "seek", NULL, file->position);
+	return status;
+}
+
 extern struct CASC_File *
 casc_file_access (
 	lua_State *L,
@@ -563,3 +1312,163 @@ casc_file_access (
 	return luaL_checkudata (L, index, CASC_FILE_METATABLE);
 }
 
+
+/*
+ * Has CascLib decode `count` bytes of `file` at `offset` into `buffer`,
+ * or copies them out of its pack.
+ */
+static int
+file_read_at (
+	struct CASC_File *file,
+	ULONGLONG offset,
+	void *buffer,
+	DWORD count,
+	DWORD *bytes_read)
+{
+	const uint64_t start = casc_trace_begin ();
+
+	file_record (file, offset);
+	*bytes_read = 0;
+
+	if (file->data)
+	{
+		if (offset < file->size)
+		{
+			*bytes_read = file->size - offset < count
+				? (DWORD) (file->size - offset) : count;
+			memcpy (buffer, file->data + offset, *bytes_read);
+		}
+
+		casc_trace_end (start, "read", NULL, *bytes_read);
+		return 1;
+	}
+
+	const int status = CascSetFilePointer64 (
+			file->handle, (LONGLONG) offset, NULL, FILE_BEGIN)
+		&& CascReadFile (file->handle, buffer, count, bytes_read);
+
+	casc_trace_end (start, "read", NULL, *bytes_read);
+	return status;
+}
+
+/*
+ * Provides the decoded data of `file` at its position, through the cache.
+ * On success, `data` points to that position, and `available` holds the
+ * number of bytes that can be consumed from it (`0` at the end of the
+ * file).  The position itself is left unaltered.  As any allocation may
+ * evict cached blocks, the cache of `file` must be pinned while `data` is
+ * held across one.
+ */
+extern int
+casc_file_window (
+	struct CASC_File *file,
+	const BYTE **data,
+	size_t *available)
+{
+	struct CASC_Cache *cache = &file->cache;
+	const ULONGLONG index = file->position / cache->size;
+	const size_t offset = (size_t) (file->position % cache->size);
+
+	if (file->position >= file->size)
+	{
+		*data = NULL;
+		*available = 0;
+		return 1;
+	}
+
+	/* The data of a file within a pack is that of the pack itself. */
+	if (file->data)
+	{
+		const ULONGLONG remaining = file->size - file->position;
+
+		*data = file->data + file->position;
+		*available = remaining > SIZE_MAX ? SIZE_MAX : (size_t) remaining;
+		return 1;
+	}
+
+	struct CASC_Cache_Block *block = casc_cache_find (cache, index);
+
+	if (!block)
+	{
+		DWORD bytes_read;
+
+		if (!(block = casc_cache_claim (cache, index)))
+		{
+			SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+			return 0;
+		}
+
+		if (!file_read_at (file, index * cache->size,
+			block->data, (DWORD) cache->size, &bytes_read))
+		{
+			block->index = (ULONGLONG) -1;
+			return 0;
+		}
+
+		block->length = bytes_read;
+	}
+
+	*data = block->data + offset;
+	*available = block->length > offset ? block->length - offset : 0;
+	return 1;
+}
+
+/*
+ * Reads up to `count` bytes of `file` into `buffer`, advancing its
+ * position, with the number of bytes read stored in `total`.  Reads of at
+ * least a block bypass the cache.  On error, `0` is returned, and the
+ * CascLib error state is set.
+ */
+extern int
+casc_file_fetch (
+	struct CASC_File *file,
+	void *buffer,
+	size_t count,
+	size_t *total)
+{
+	BYTE *output = buffer;
+	*total = 0;
+
+	while (count > 0)
+	{
+		size_t length;
+
+		if (count >= file->cache.size)
+		{
+			DWORD bytes_read;
+			length = count > 0x40000000 ? 0x40000000 : count;
+
+			if (!file_read_at (file, file->position,
+				output, (DWORD) length, &bytes_read))
+			{
+				return 0;
+			}
+
+			length = bytes_read;
+		}
+		else
+		{
+			const BYTE *data;
+
+			if (!casc_file_window (file, &data, &length))
+			{
+				return 0;
+			}
+
+			length = length < count ? length : count;
+			memcpy (output, data, length);
+		}
+
+		if (length == 0)
+		{
+			break;
+		}
+
+		file->position += length;
+		output += length;
+		*total += length;
+		count -= length;
+	}
+
+	return 1;
+}
@@ -1,26 +1,105 @@
 #ifndef CASC_FILE_H
 #define CASC_FILE_H
 
+#include "cache.h"
 #include <CascPort.h>
 #include <lua.h>
+#include <stddef.h>
 
+struct CASC_Lines;
+struct CASC_Pack;
 struct CASC_Storage;
 
 struct CASC_File
 {
 	HANDLE handle;
 	const struct CASC_Storage *storage;
+
+	/*
+	 * The contents of a file opened within `pack`, which are served as is,
+	 * or `NULL`.
+	 */
+	const BYTE *data;
+	const struct CASC_Pack *pack;
+
+	/* The name of a file whose opening is deferred, or `NULL`. */
+	char *name;
+
+	/* The name to record in the access profile upon first access. */
+	char *profile;
+
+	/* The locale flags passed to CascLib when opening the file. */
+	DWORD locale;
+
+	/*
+	 * All reads are served at `position`, through `cache`.  The position of
+	 * the CascLib handle itself is only meaningful during a read.
+	 */
+	ULONGLONG position;
+	ULONGLONG size;
+	struct CASC_Cache cache;
+
+	/* The offsets of the lines, once indexed, or `NULL`. */
+	struct CASC_Lines *lines;
 };
 
 extern int
 casc_file_initialize (
 	lua_State *L,
 	const struct CASC_Storage *storage,
-	const char *name);
+	const char *name,
+	const int lazy,
+	DWORD locale);
+
+extern int
+casc_file_map (
+	lua_State *L,
+	int pack,
+	const BYTE *data,
+	ULONGLONG size);
 
 extern struct CASC_File *
 casc_file_access (
 	lua_State *L,
 	int index);
 
+extern int
+casc_file_open (
+	struct CASC_File *file,
+	HANDLE storage,
+	const char *name,
+	DWORD locale,
+	struct CASC_Memory *memory);
+
+extern int
+casc_file_defer (
+	struct CASC_File *file,
+	const char *name,
+	DWORD locale,
+	struct CASC_Memory *memory);
+
+extern int
+casc_file_ready (
+	struct CASC_File *file);
+
+extern int
+casc_file_seek (
+	struct CASC_File *file,
+	LONGLONG offset,
+	DWORD mode,
+	ULONGLONG *position);
+
+extern int
+casc_file_window (
+	struct CASC_File *file,
+	const BYTE **data,
+	size_t *available);
+
+extern int
+casc_file_fetch (
+	struct CASC_File *file,
+	void *buffer,
+	size_t count,
+	size_t *total);
+
 #endif
@@ -1,16 +1,245 @@
 #include "finder.h"
 #include "common.h"
+#include "memory.h"
 #include "registry.h"
 #include "storage.h"
+#include "thread.h"
+#include "trace.h"
 #include <CascLib.h>
 #include <CascPort.h>
 #include <compat-5.3.h>
 #include <lauxlib.h>
 #include <lua.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define CASC_FINDER_METATABLE "CASC Finder"
 
+/* Applies the filters which do not involve Lua. */
+static int
+finder_admits (
+	const struct CASC_Finder *finder,
+	const CASC_FIND_DATA *data)
+{
+	return casc_finder_accepts (
+			data, finder->locale, finder->available_only)
+		&& (!finder->filter || strstr (data->szFileName, finder->filter));
+}
+
+static int
+finder_has_room (const struct CASC_Finder *finder)
+{
+	return finder->cancelled
+		|| finder->head - finder->tail < CASC_FINDER_QUEUE_SIZE;
+}
+
+static int
+finder_has_entry (const struct CASC_Finder *finder)
+{
+	return finder->finished || finder->head != finder->tail;
+}
+
+/*
+ * Waits until `ready`, having set `waiting` for the other side to see.
+ * Either this side sees what the other side published, or the other side
+ * sees `waiting`, and wakes this one.
+ */
+static void
+finder_wait (
+	struct CASC_Finder *finder,
+	volatile int *waiting,
+	int (*ready) (const struct CASC_Finder *))
+{
+	casc_mutex_lock (&finder->mutex);
+	*waiting = 1;
+	casc_memory_barrier ();
+
+	while (!ready (finder))
+	{
+		casc_condition_wait (&finder->condition, &finder->mutex);
+	}
+
+	*waiting = 0;
+	casc_mutex_unlock (&finder->mutex);
+}
+
+/* Wakes the other side, should it be waiting for what was published. */
+static void
+finder_wake (
+	struct CASC_Finder *finder,
+	volatile int *waiting)
+{
+	casc_memory_barrier ();
+
+	if (*waiting)
+	{
+		casc_mutex_lock (&finder->mutex);
+		casc_condition_broadcast (&finder->condition);
+		casc_mutex_unlock (&finder->mutex);
+	}
+}
+
+static CASC_THREAD_FUNCTION (finder_produce)
+{
+	struct CASC_Finder *finder = argument;
+
+	while (1)
+	{
+		if (!finder_has_room (finder))
+		{
+			finder_wait (finder, &finder->producer_waiting,
+				finder_has_room);
+		}
+
+		if (finder->cancelled)
+		{
+			break;
+		}
+
+		CASC_FIND_DATA *data =
+			&finder->queue [finder->head % CASC_FINDER_QUEUE_SIZE];
+		const uint64_t start = casc_trace_begin ();
+		const int status = CascFindNextFile (finder->handle, data);
+
+		casc_trace_end (start, "find", status ? data->szFileName : NULL, 0);
+
+		/*
+		 * The CascLib error state is shared with the other threads (which
+		 * may well be opening the names found), and cannot be relied upon,
+		 * so this is taken as the end of the enumeration.
+		 */
+		if (!status)
+		{
+			break;
+		}
+
+		if (finder_admits (finder, data))
+		{
+			casc_memory_barrier ();
+			finder->head++;
+			finder_wake (finder, &finder->consumer_waiting);
+		}
+	}
+
+	casc_memory_barrier ();
+	finder->finished = 1;
+	finder_wake (finder, &finder->consumer_waiting);
+
+	CASC_THREAD_RETURN;
+}
+
+/*
+ * Starts the background enumeration, which continues on from `first`, as
+ * found by `CascFindFirstFile ()`.  Should that not be possible, the
+ * enumeration simply remains on the calling thread.
+ */
+static void
+finder_start (
+	struct CASC_Finder *finder,
+	const CASC_FIND_DATA *first)
+{
+	finder->queue = casc_memory_allocate (finder->storage->memory,
+		CASC_FINDER_QUEUE_SIZE * sizeof (*finder->queue));
+
+	if (!finder->queue)
+	{
+		finder->background = 0;
+		return;
+	}
+
+	finder->head = 0;
+	finder->tail = 0;
+	finder->producer_waiting = 0;
+	finder->consumer_waiting = 0;
+	finder->finished = 0;
+	finder->cancelled = 0;
+
+	if (finder_admits (finder, first))
+	{
+		memcpy (&finder->queue [0], first, sizeof (*first));
+		finder->head = 1;
+	}
+
+	casc_mutex_initialize (&finder->mutex);
+	casc_condition_initialize (&finder->condition);
+
+	if (!casc_thread_create (&finder->thread, finder_produce, finder))
+	{
+		casc_condition_destroy (&finder->condition);
+		casc_mutex_destroy (&finder->mutex);
+		casc_memory_free (finder->queue);
+		finder->queue = NULL;
+		finder->background = 0;
+		return;
+	}
+
+	finder->running = 1;
+}
+
+/*
+ * Takes the next entry produced by the background enumeration into `data`,
+ * waiting for it as needed.  At the end of the enumeration, `0` is
+ * returned, with the CascLib error state cleared.
+ */
+static int
+finder_take (
+	struct CASC_Finder *finder,
+	CASC_FIND_DATA *data)
+{
+	while (finder->head == finder->tail)
+	{
+		if (finder->finished)
+		{
+			casc_memory_barrier ();
+
+			if (finder->head == finder->tail)
+			{
+				SetCascError (ERROR_SUCCESS);
+				return 0;
+			}
+
+			break;
+		}
+
+		finder_wait (finder, &finder->consumer_waiting, finder_has_entry);
+	}
+
+	casc_memory_barrier ();
+	memcpy (data, &finder->queue [finder->tail % CASC_FINDER_QUEUE_SIZE],
+		sizeof (*data));
+	casc_memory_barrier ();
+	finder->tail++;
+	finder_wake (finder, &finder->producer_waiting);
+
+	return 1;
+}
+
+/* Cancels and joins the background enumeration, should there be one. */
+static void
+finder_stop (struct CASC_Finder *finder)
+{
+	if (finder->running)
+	{
+		casc_mutex_lock (&finder->mutex);
+		finder->cancelled = 1;
+		casc_condition_broadcast (&finder->condition);
+		casc_mutex_unlock (&finder->mutex);
+
+		casc_thread_join (finder->thread);
+		casc_condition_destroy (&finder->condition);
+		casc_mutex_destroy (&finder->mutex);
+		finder->running = 0;
+	}
+
+	casc_memory_free (finder->queue);
+	finder->queue = NULL;
+
+	casc_memory_free (finder->filter);
+	finder->filter = NULL;
+}
+
 /**
  * `finder:__gc ()`
  *
@@ -26,6 +255,21 @@ finder_close (lua_State *L)
 	struct CASC_Finder *finder = casc_finder_access (L, 1);
 	int status = 0;
 
+	for (size_t index = 0; index < finder->count; index++)
+	{
+		casc_memory_free (finder->entries [index].name);
+	}
+
+	casc_memory_free (finder->entries);
+	finder->entries = NULL;
+	finder->count = 0;
+	finder->capacity = 0;
+	finder->position = 0;
+	finder->collected = 0;
+
+	/* The background enumeration must be done with the handle. */
+	finder_stop (finder);
+
 	if (!finder->handle)
 	{
 		SetCascError (ERROR_INVALID_HANDLE);
@@ -57,62 +301,306 @@ finder_to_string (lua_State *L)
 }
 
 static int
-finder_iterator (lua_State *L)
+finder_next (
+	lua_State *L,
+	struct CASC_Finder *finder,
+	CASC_FIND_DATA *data)
 {
-	struct CASC_Finder *finder =
-		casc_finder_access (L, lua_upvalueindex (1));
-	const char *pattern = luaL_optstring (L, lua_upvalueindex (2), NULL);
-	const int plain = lua_toboolean (L, lua_upvalueindex (3));
-
-	CASC_FIND_DATA data;
+	const uint64_t start = casc_trace_begin ();
 	int status;
-	int error;
-	int results = 0;
 
-	while (true)
+	if (!finder->handle)
 	{
-		if (!finder->handle)
+		finder->handle = CascFindFirstFile (
+			finder->storage->handle, "*", data, NULL);
+		status = !!finder->handle;
+
+		if (status)
+		{
+			casc_registry_insert_finder (L, lua_upvalueindex (1));
+		}
+
+		if (status && finder->background)
+		{
+			finder_start (finder, data);
+		}
+
+		if (status && finder->background)
 		{
-			finder->handle = CascFindFirstFile (
-				finder->storage->handle, "*", &data, NULL);
-			status = !!finder;
+			status = finder_take (finder, data);
+		}
+	}
+	else if (finder->background)
+	{
+		status = finder_take (finder, data);
+	}
+	else
+	{
+		status = CascFindNextFile (finder->handle, data);
+	}
+
+	/* In the background, each name was traced as found by the producer. */
+	casc_trace_end (start, finder->background ? "take" : "find",
+		status ? data->szFileName : NULL, 0);
+	return status;
+}
+
+/*
+ * Returns whether `name` matches `pattern`, as per `string.find`.  An
+ * absent `pattern` matches every name.
+ */
+extern int
+casc_finder_match (
+	lua_State *L,
+	const char *name,
+	const char *pattern,
+	const int plain)
+{
+	if (!pattern)
+	{
+		return 1;
+	}
 
-			if (status)
+	lua_getglobal (L, "string");
+	lua_getfield (L, -1, "find");
+	lua_remove (L, -2);
+
+	lua_pushstring (L, name);
+	lua_pushstring (L, pattern);
+	lua_pushnil (L);
+	lua_pushboolean (L, plain);
+	lua_call (L, 4, 1);
+
+	const int status = !lua_isnil (L, -1);
+	lua_pop (L, 1);
+
+	return status;
+}
+
+/*
+ * Returns whether the entry `data` is of any of the `locale` flags (entries
+ * without any locale being of every locale), and whether its data is
+ * present, should `available_only` be set.
+ */
+extern int
+casc_finder_accepts (
+	const CASC_FIND_DATA *data,
+	DWORD locale,
+	const int available_only)
+{
+	if (available_only && !data->bFileAvailable)
+	{
+		return 0;
+	}
+
+	return locale == CASC_LOCALE_ALL
+		|| data->dwLocaleFlags == CASC_LOCALE_NONE
+		|| (data->dwLocaleFlags & locale) != 0;
+}
+
+/*
+ * Returns whether `data` is to be returned by the iterator.  Within the
+ * background mode, the thread has already applied all but Lua patterns.
+ */
+static int
+finder_select (
+	lua_State *L,
+	const struct CASC_Finder *finder,
+	const CASC_FIND_DATA *data,
+	const char *pattern,
+	const int plain)
+{
+	if (finder->background)
+	{
+		return finder->filter
+			|| casc_finder_match (L, data->szFileName, pattern, plain);
+	}
+
+	return casc_finder_accepts (
+			data, finder->locale, finder->available_only)
+		&& casc_finder_match (L, data->szFileName, pattern, plain);
+}
+
+static void
+finder_fill (
+	struct CASC_Finder_Entry *entry,
+	const CASC_FIND_DATA *data)
+{
+	memcpy (entry->ckey, data->CKey, sizeof (entry->ckey));
+	memcpy (entry->ekey, data->EKey, sizeof (entry->ekey));
+	entry->size = data->FileSize;
+	entry->locale = data->dwLocaleFlags;
+	entry->id = data->dwFileDataId;
+	entry->available = data->bFileAvailable;
+}
+
+/* Pushes the name of `entry`, followed by each of the requested fields. */
+static int
+finder_push (
+	lua_State *L,
+	const struct CASC_Finder *finder,
+	const struct CASC_Finder_Entry *entry)
+{
+	luaL_checkstack (L, 1 + finder->field_count, "too many fields");
+	lua_pushstring (L, entry->name);
+
+	for (int index = 0; index < finder->field_count; index++)
+	{
+		switch (finder->fields [index])
+		{
+			case CASC_FINDER_FIELD_SIZE:
+			{
+				lua_pushinteger (L, (lua_Integer) entry->size);
+				break;
+			}
+
+			case CASC_FINDER_FIELD_CKEY:
 			{
-				casc_registry_insert_finder (L, lua_upvalueindex (1));
+				casc_push_key (L, entry->ckey);
+				break;
+			}
+
+			case CASC_FINDER_FIELD_EKEY:
+			{
+				casc_push_key (L, entry->ekey);
+				break;
+			}
+
+			case CASC_FINDER_FIELD_LOCALE:
+			{
+				lua_pushinteger (L, (lua_Integer) entry->locale);
+				break;
+			}
+
+			case CASC_FINDER_FIELD_AVAILABLE:
+			{
+				lua_pushboolean (L, entry->available);
+				break;
+			}
+
+			case CASC_FINDER_FIELD_ID:
+			{
+				lua_pushinteger (L, (lua_Integer) entry->id);
+				break;
 			}
 		}
-		else
+	}
+
+	return 1 + finder->field_count;
+}
+
+/*
+ * Collects every matching entry, along with the location of its data
+ * within the `data.NNN` archives, and sorts them by that location.  The
+ * entries are attached to the finder as they are gathered, so that they are
+ * released by `finder:__gc ()` should an error be raised midway.
+ */
+static int
+finder_collect (
+	lua_State *L,
+	struct CASC_Finder *finder,
+	const char *pattern,
+	const int plain)
+{
+	CASC_FIND_DATA data;
+	SetCascError (ERROR_SUCCESS);
+
+	while (finder_next (L, finder, &data))
+	{
+		if (!finder_select (L, finder, &data, pattern, plain))
 		{
-			status = CascFindNextFile (finder->handle, &data);
+			continue;
 		}
 
-		if (!status)
+		if (finder->count == finder->capacity)
 		{
-			break;
+			const size_t capacity =
+				finder->capacity ? finder->capacity * 2 : 1024;
+			struct CASC_Finder_Entry *entries = casc_memory_reallocate (
+				finder->storage->memory, finder->entries,
+				capacity * sizeof (*entries));
+
+			if (!entries)
+			{
+				SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+				return 0;
+			}
+
+			finder->entries = entries;
+			finder->capacity = capacity;
 		}
 
-		if (pattern)
+		struct CASC_Finder_Entry *entry = &finder->entries [finder->count];
+		const size_t length = strlen (data.szFileName) + 1;
+
+		if (!(entry->name =
+			casc_memory_allocate (finder->storage->memory, length)))
 		{
-			lua_getglobal (L, "string");
-			lua_getfield (L, -1, "find");
-			lua_remove (L, -2);
+			SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+			return 0;
+		}
 
-			lua_pushstring (L, data.szFileName);
-			lua_pushstring (L, pattern);
-			lua_pushnil (L);
-			lua_pushboolean (L, plain);
-			lua_call (L, 4, 1);
+		memcpy (entry->name, data.szFileName, length);
+		finder_fill (entry, &data);
+		casc_finder_locate (finder->storage, data.EKey,
+			&entry->archive, &entry->offset);
+		finder->count++;
+	}
 
-			status = !lua_isnil (L, -1);
-			lua_pop (L, 1);
-		}
+	if (GetCascError () != ERROR_SUCCESS)
+	{
+		return 0;
+	}
 
-		if (status)
+	qsort (finder->entries, finder->count, sizeof (*finder->entries),
+		casc_finder_compare_location);
+
+	finder->collected = 1;
+	return 1;
+}
+
+static int
+finder_iterator (lua_State *L)
+{
+	struct CASC_Finder *finder =
+		casc_finder_access (L, lua_upvalueindex (1));
+	const char *pattern = luaL_optstring (L, lua_upvalueindex (2), NULL);
+	const int plain = lua_toboolean (L, lua_upvalueindex (3));
+
+	CASC_FIND_DATA data;
+	int status;
+	int error;
+	int results = 0;
+
+	if (finder->order == CASC_FINDER_ORDER_PHYSICAL)
+	{
+		status = finder->collected
+			|| finder_collect (L, finder, pattern, plain);
+
+		if (status && finder->position < finder->count)
 		{
-			lua_pushstring (L, data.szFileName);
-			results = 1;
-			break;
+			results = finder_push (
+				L, finder, &finder->entries [finder->position++]);
+		}
+		else if (status)
+		{
+			SetCascError (ERROR_SUCCESS);
+			status = 0;
+		}
+	}
+	else
+	{
+		while ((status = finder_next (L, finder, &data)))
+		{
+			if (finder_select (L, finder, &data, pattern, plain))
+			{
+				struct CASC_Finder_Entry entry;
+				entry.name = data.szFileName;
+				finder_fill (&entry, &data);
+
+				results = finder_push (L, finder, &entry);
+				break;
+			}
 		}
 	}
 
@@ -132,7 +620,6 @@ finder_iterator (lua_State *L)
 	SetCascError (error);
 	results = casc_result (L, 0);
 
-error:
 	return luaL_error (L, "%s", lua_tostring (L, -results + 1));
 }
 
@@ -157,21 +644,141 @@ finder_metatable (lua_State *L)
 	lua_setmetatable (L, -2);
 }
 
+/*
+ * Reads the arguments of `casc:files ()`, starting at `index`, which take
+ * either the form `[pattern [, plain]]` or `[pattern ,] options`.  Note
+ * that the arguments must remain on the stack while `options` is in use, as
+ * they may own its `pattern`.
+ */
+extern void
+casc_finder_options (
+	lua_State *L,
+	int index,
+	struct CASC_Finder_Options *options)
+{
+	static const char * const
+	orders [] = {
+		"storage",
+		"physical",
+		NULL
+	};
+
+	static const char * const
+	fields [] = {
+		"size",
+		"ckey",
+		"ekey",
+		"locale",
+		"available",
+		"id",
+		NULL
+	};
+
+	const int table = lua_istable (L, index) ? index : index + 1;
+
+	options->pattern = table == index
+		? casc_option_string (L, table, "pattern", NULL)
+		: luaL_optstring (L, index, NULL);
+	options->plain = lua_istable (L, table)
+		? casc_option_boolean (L, table, "plain", 0)
+		: lua_toboolean (L, index + 1);
+	options->order = casc_option_choice (
+		L, table, "order", "storage", orders);
+	options->locale = (DWORD) casc_option_locale (
+		L, table, "locale", CASC_LOCALE_ALL);
+	options->available_only =
+		casc_option_boolean (L, table, "available_only", 0);
+	options->background =
+		casc_option_boolean (L, table, "background", 0);
+	options->field_count = 0;
+
+	if (!lua_istable (L, table))
+	{
+		return;
+	}
+
+	lua_getfield (L, table, "fields");
+
+	if (!lua_isnil (L, -1))
+	{
+		luaL_checktype (L, -1, LUA_TTABLE);
+		const size_t count = lua_rawlen (L, -1);
+
+		if (count > CASC_FINDER_FIELDS_MAXIMUM)
+		{
+			luaL_error (L, "too many fields");
+		}
+
+		for (size_t field = 1; field <= count; field++)
+		{
+			lua_rawgeti (L, -1, (lua_Integer) field);
+			const char *name = lua_tostring (L, -1);
+			int choice = 0;
+
+			while (fields [choice]
+				&& (!name || strcmp (fields [choice], name) != 0))
+			{
+				choice++;
+			}
+
+			if (!fields [choice])
+			{
+				luaL_error (L, "invalid field '%s'", name ? name : "?");
+			}
+
+			options->fields [options->field_count++] = choice;
+			lua_pop (L, 1);
+		}
+	}
+
+	lua_pop (L, 1);
+}
+
 extern int
 casc_finder_initialize (
 	lua_State *L,
 	const struct CASC_Storage *storage,
-	const char *pattern,
-	const int plain)
+	const struct CASC_Finder_Options *options)
 {
 	struct CASC_Finder *finder = lua_newuserdata (L, sizeof (*finder));
 	finder->handle = NULL;
 	finder->storage = storage;
+	finder->order = options->order;
+	finder->collected = 0;
+	finder->entries = NULL;
+	finder->count = 0;
+	finder->capacity = 0;
+	finder->position = 0;
+
+	finder->locale = options->locale;
+	finder->available_only = options->available_only;
+	finder->field_count = options->field_count;
+	memcpy (finder->fields, options->fields, sizeof (finder->fields));
+
+	finder->background = options->background;
+	finder->running = 0;
+	finder->filter = NULL;
+	finder->queue = NULL;
 
 	finder_metatable (L);
 
-	lua_pushstring (L, pattern);
-	lua_pushboolean (L, plain);
+	/*
+	 * The thread cannot use Lua, so it keeps its own copy of a plain
+	 * pattern (which may be collected before the finder).
+	 */
+	if (finder->background && options->plain && options->pattern)
+	{
+		const size_t length = strlen (options->pattern) + 1;
+
+		if ((finder->filter =
+			casc_memory_allocate (storage->memory, length)))
+		{
+			memcpy (finder->filter, options->pattern, length);
+		}
+	}
+
+	lua_pushstring (L, options->pattern);
+	lua_pushboolean (L, options->plain);
 	lua_pushcclosure (L, finder_iterator, 3);
 	return 1;
 }
@@ -183,3 +790,59 @@ casc_finder_access (
 {
 	return luaL_checkudata (L, index, CASC_FINDER_METATABLE);
 }
+
+/*
+ * Determines the location of the data referenced by `ekey` (i.e. the index
+ * of its `data.NNN` archive and its offset therein).  Entries whose data
+ * cannot be located are given the largest possible location, placing them
+ * last.  The CascLib error state is left unaltered.
+ */
+extern void
+casc_finder_locate (
+	const struct CASC_Storage *storage,
+	const BYTE *ekey,
+	DWORD *archive,
+	ULONGLONG *offset)
+{
+	const DWORD error = GetCascError ();
+	CASC_FILE_FULL_INFO info;
+	HANDLE handle;
+
+	*archive = (DWORD) -1;
+	*offset = (ULONGLONG) -1;
+
+	if (CascOpenFile (storage->handle, ekey, 0, CASC_OPEN_BY_EKEY, &handle))
+	{
+		if (CascGetFileInfo (handle, CascFileFullInfo,
+			&info, sizeof (info), NULL))
+		{
+			*archive = info.SegmentIndex;
+			*offset = info.SegmentOffset;
+		}
+
+		CascCloseFile (handle);
+	}
+
+	SetCascError (error);
+}
+
+extern int
+casc_finder_compare_location (
+	const void *a,
+	const void *b)
+{
+	const struct CASC_Finder_Entry *left = a;
+	const struct CASC_Finder_Entry *right = b;
+
+	if (left->archive != right->archive)
+	{
+		return left->archive < right->archive ? -1 : 1;
+	}
+
+	if (left->offset != right->offset)
+	{
+		return left->offset < right->offset ? -1 : 1;
+	}
+
+	return 0;
+}
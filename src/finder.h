@@ -1,27 +1,135 @@
 #ifndef CASC_FINDER_H
 #define CASC_FINDER_H
 
+#include "thread.h"
+#include <CascLib.h>
 #include <CascPort.h>
 #include <lua.h>
+#include <stddef.h>
+
+#define CASC_FINDER_ORDER_STORAGE 0
+#define CASC_FINDER_ORDER_PHYSICAL 1
+
+#define CASC_FINDER_FIELD_SIZE 0
+#define CASC_FINDER_FIELD_CKEY 1
+#define CASC_FINDER_FIELD_EKEY 2
+#define CASC_FINDER_FIELD_LOCALE 3
+#define CASC_FINDER_FIELD_AVAILABLE 4
+#define CASC_FINDER_FIELD_ID 5
+
+#define CASC_FINDER_FIELDS_MAXIMUM 8
+
+/* The number of entries the background enumeration may be ahead by. */
+#define CASC_FINDER_QUEUE_SIZE 256
 
 struct CASC_Storage;
 
+struct CASC_Finder_Options
+{
+	const char *pattern;
+	int plain;
+	int order;
+	int fields [CASC_FINDER_FIELDS_MAXIMUM];
+	int field_count;
+	DWORD locale;
+	int available_only;
+	int background;
+};
+
+struct CASC_Finder_Entry
+{
+	char *name;
+	DWORD archive;
+	ULONGLONG offset;
+
+	BYTE ckey [MD5_HASH_SIZE];
+	BYTE ekey [MD5_HASH_SIZE];
+	ULONGLONG size;
+	DWORD locale;
+	DWORD id;
+	int available;
+};
+
 struct CASC_Finder
 {
 	HANDLE handle;
 	const struct CASC_Storage *storage;
+	int order;
+	int fields [CASC_FINDER_FIELDS_MAXIMUM];
+	int field_count;
+	DWORD locale;
+	int available_only;
+
+	/* Used by the physical order, which collects all entries up front. */
+	int collected;
+	struct CASC_Finder_Entry *entries;
+	size_t count;
+	size_t capacity;
+	size_t position;
+
+	/*
+	 * Used by the background mode, in which a thread runs the enumeration
+	 * (and the filters not involving Lua, with `filter` being a copy of a
+	 * plain pattern) ahead of the iterator, through the ring of entries in
+	 * `queue`.  The thread only ever advances `head`, and the iterator
+	 * `tail`, such that neither takes `mutex` unless it has to wait for the
+	 * other, as flagged by `producer_waiting` and `consumer_waiting`.
+	 */
+	int background;
+	int running;
+	char *filter;
+	CASC_FIND_DATA *queue;
+	volatile size_t head;
+	volatile size_t tail;
+	volatile int producer_waiting;
+	volatile int consumer_waiting;
+	volatile int finished;
+	volatile int cancelled;
+	CASC_Mutex mutex;
+	CASC_Condition condition;
+	CASC_Thread thread;
 };
 
+extern void
+casc_finder_options (
+	lua_State *L,
+	int index,
+	struct CASC_Finder_Options *options);
+
 extern int
 casc_finder_initialize (
 	lua_State *L,
 	const struct CASC_Storage *storage,
-	const char *pattern,
-	const int plain);
+	const struct CASC_Finder_Options *options);
 
 extern struct CASC_Finder *
 casc_finder_access (
 	lua_State *L,
 	int index);
 
+extern int
+casc_finder_match (
+	lua_State *L,
+	const char *name,
+	const char *pattern,
+	const int plain);
+
+extern int
+casc_finder_accepts (
+	const CASC_FIND_DATA *data,
+	DWORD locale,
+	const int available_only);
+
+extern void
+casc_finder_locate (
+	const struct CASC_Storage *storage,
+	const BYTE *ekey,
+	DWORD *archive,
+	ULONGLONG *offset);
+
+extern int
+casc_finder_compare_location (
+	const void *a,
+	const void *b);
+
 #endif
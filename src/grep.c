@@ -0,0 +1,605 @@
+#include "grep.h"
+#include "batch.h"
+#include "common.h"
+#include "finder.h"
+#include "memory.h"
+#include "storage.h"
+#include "thread.h"
+#include "trace.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <compat-5.3.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CASC_GREP_METATABLE "Casc Grep"
+
+/* The number of decoded files each worker may be ahead of the consumer. */
+#define GREP_WINDOW 4
+
+struct CASC_Grep_Item
+{
+	struct CASC_Finder_Entry location;
+
+	/* Decoded data, kept only until searched. */
+	BYTE *data;
+	size_t size;
+	DWORD error;
+
+	/* The (one-based) offsets or line numbers of the matches. */
+	lua_Integer *positions;
+	size_t count;
+	size_t capacity;
+
+	/* Guarded by `mutex`. */
+	int ready;
+};
+
+/*
+ * The state is held within a userdata so that everything is released by
+ * the garbage collector, even when an error is raised midway (such as by a
+ * pattern).  Workers are cancelled and joined before anything is freed.
+ */
+struct CASC_Grep
+{
+	HANDLE handle;
+	struct CASC_Memory *memory;
+	HANDLE find;
+
+	struct CASC_Grep_Item *items;
+	size_t count;
+	size_t capacity;
+
+	/* A copy of the needle, for the plain searches done by workers. */
+	BYTE *needle;
+	size_t length;
+	int plain;
+	int lines;
+	lua_Integer maximum;
+
+	/* Guarded by `mutex`. */
+	size_t next;
+	size_t consumed;
+	size_t window;
+	int cancelled;
+
+	CASC_Mutex mutex;
+	CASC_Condition condition;
+	int synchronized;
+
+	CASC_Thread workers [CASC_THREADS_MAXIMUM];
+	int started;
+};
+
+/* Returns the first occurrence of `needle` within `text`, or `NULL`. */
+static const BYTE *
+grep_find (
+	const BYTE *text,
+	size_t size,
+	const BYTE *needle,
+	size_t length)
+{
+	if (length > size)
+	{
+		return NULL;
+	}
+
+	const BYTE *last = text + (size - length);
+
+	/* Candidates are found by `memchr`, which is vectorized by the C
+	 * library, leaving only them to be compared in full. */
+	for (const BYTE *cursor = text; cursor <= last; cursor++)
+	{
+		cursor = memchr (cursor, needle [0], (size_t) (last - cursor) + 1);
+
+		if (!cursor)
+		{
+			return NULL;
+		}
+
+		if (memcmp (cursor + 1, needle + 1, length - 1) == 0)
+		{
+			return cursor;
+		}
+	}
+
+	return NULL;
+}
+
+/* Returns the number of line feeds within `[from, to)`. */
+static lua_Integer
+grep_count_lines (
+	const BYTE *from,
+	const BYTE *to)
+{
+	lua_Integer count = 0;
+
+	while (from < to && (from = memchr (from, '\n', (size_t) (to - from))))
+	{
+		count++;
+		from++;
+	}
+
+	return count;
+}
+
+static int
+grep_add (
+	struct CASC_Grep *grep,
+	struct CASC_Grep_Item *item,
+	lua_Integer position)
+{
+	if (item->count == item->capacity)
+	{
+		const size_t capacity = item->capacity ? item->capacity * 2 : 8;
+		lua_Integer *positions = casc_memory_reallocate (grep->memory,
+			item->positions, capacity * sizeof (*positions));
+
+		if (!positions)
+		{
+			return 0;
+		}
+
+		item->positions = positions;
+		item->capacity = capacity;
+	}
+
+	item->positions [item->count++] = position;
+	return 1;
+}
+
+/*
+ * Records the match at `match` within the data of `item`, returning where
+ * the search is to resume, or `NULL` should it stop.  In terms of lines,
+ * each line is recorded once, with `counted` and `line` tracking how far
+ * lines were counted.
+ */
+static const BYTE *
+grep_match (
+	struct CASC_Grep *grep,
+	struct CASC_Grep_Item *item,
+	const BYTE *match,
+	size_t length,
+	const BYTE **counted,
+	lua_Integer *line)
+{
+	const BYTE *end = item->data + item->size;
+	const BYTE *next = match + (length ? length : 1);
+
+	if (grep->lines)
+	{
+		*line += grep_count_lines (*counted, match);
+		*counted = match;
+
+		if (!grep_add (grep, item, *line))
+		{
+			item->error = ERROR_NOT_ENOUGH_MEMORY;
+			return NULL;
+		}
+
+		next = memchr (match, '\n', (size_t) (end - match));
+		next = next ? next + 1 : end;
+	}
+	else if (!grep_add (grep, item, (lua_Integer) (match - item->data) + 1))
+	{
+		item->error = ERROR_NOT_ENOUGH_MEMORY;
+		return NULL;
+	}
+
+	if ((grep->maximum && (lua_Integer) item->count >= grep->maximum)
+		|| next > end)
+	{
+		return NULL;
+	}
+
+	return next;
+}
+
+static void
+grep_plain (
+	struct CASC_Grep *grep,
+	struct CASC_Grep_Item *item)
+{
+	const BYTE *end = item->data + item->size;
+	const BYTE *cursor = item->data;
+	const BYTE *counted = item->data;
+	lua_Integer line = 1;
+
+	while (cursor && (cursor = grep_find (
+		cursor, (size_t) (end - cursor), grep->needle, grep->length)))
+	{
+		cursor = grep_match (
+			grep, item, cursor, grep->length, &counted, &line);
+	}
+}
+
+static CASC_THREAD_FUNCTION (grep_worker)
+{
+	struct CASC_Grep *grep = argument;
+
+	while (true)
+	{
+		casc_mutex_lock (&grep->mutex);
+
+		while (!grep->cancelled && grep->next < grep->count
+			&& grep->next >= grep->consumed + grep->window)
+		{
+			casc_condition_wait (&grep->condition, &grep->mutex);
+		}
+
+		if (grep->cancelled || grep->next >= grep->count)
+		{
+			casc_mutex_unlock (&grep->mutex);
+			break;
+		}
+
+		const size_t index = grep->next++;
+		casc_mutex_unlock (&grep->mutex);
+
+		struct CASC_Grep_Item *item = &grep->items [index];
+		const uint64_t start = casc_trace_begin ();
+
+		item->error = casc_batch_fetch (grep->handle, grep->memory,
+			item->location.name, &item->data, &item->size);
+
+		if (item->error == ERROR_SUCCESS && grep->plain)
+		{
+			grep_plain (grep, item);
+		}
+
+		/* Plain searches are done, so the data is no longer needed. */
+		if (item->error != ERROR_SUCCESS || grep->plain)
+		{
+			casc_memory_free (item->data);
+			item->data = NULL;
+		}
+
+		casc_trace_end (start, "grep", item->location.name,
+			(uint64_t) item->size);
+
+		casc_mutex_lock (&grep->mutex);
+		item->ready = 1;
+		casc_condition_broadcast (&grep->condition);
+		casc_mutex_unlock (&grep->mutex);
+	}
+
+	CASC_THREAD_RETURN;
+}
+
+static void
+grep_release (struct CASC_Grep *grep)
+{
+	if (grep->synchronized)
+	{
+		casc_mutex_lock (&grep->mutex);
+		grep->cancelled = 1;
+		casc_condition_broadcast (&grep->condition);
+		casc_mutex_unlock (&grep->mutex);
+
+		for (int index = 0; index < grep->started; index++)
+		{
+			casc_thread_join (grep->workers [index]);
+		}
+
+		grep->started = 0;
+		casc_condition_destroy (&grep->condition);
+		casc_mutex_destroy (&grep->mutex);
+		grep->synchronized = 0;
+	}
+
+	if (grep->find)
+	{
+		CascFindClose (grep->find);
+		grep->find = NULL;
+	}
+
+	for (size_t index = 0; index < grep->count; index++)
+	{
+		casc_memory_free (grep->items [index].location.name);
+		casc_memory_free (grep->items [index].data);
+		casc_memory_free (grep->items [index].positions);
+	}
+
+	casc_memory_free (grep->items);
+	grep->items = NULL;
+	grep->count = 0;
+
+	casc_memory_free (grep->needle);
+	grep->needle = NULL;
+}
+
+static int
+grep_close (lua_State *L)
+{
+	grep_release (luaL_checkudata (L, 1, CASC_GREP_METATABLE));
+	return 0;
+}
+
+static void
+grep_metatable (lua_State *L)
+{
+	if (luaL_newmetatable (L, CASC_GREP_METATABLE))
+	{
+		lua_pushcfunction (L, grep_close);
+		lua_setfield (L, -2, "__gc");
+	}
+
+	lua_setmetatable (L, -2);
+}
+
+/*
+ * Collects the files whose names match `pattern`, in the order of their
+ * data.  On failure, the CascLib error state is set, and `0` is returned.
+ */
+static int
+grep_gather (
+	lua_State *L,
+	struct CASC_Grep *grep,
+	const struct CASC_Storage *storage,
+	const char *pattern)
+{
+	CASC_FIND_DATA data;
+	int status;
+
+	SetCascError (ERROR_SUCCESS);
+	grep->find = CascFindFirstFile (storage->handle, "*", &data, NULL);
+
+	for (status = !!grep->find; status;
+		status = CascFindNextFile (grep->find, &data))
+	{
+		if (!casc_finder_match (L, data.szFileName, pattern, 0))
+		{
+			continue;
+		}
+
+		if (grep->count == grep->capacity)
+		{
+			const size_t capacity =
+				grep->capacity ? grep->capacity * 2 : 1024;
+			struct CASC_Grep_Item *items = casc_memory_reallocate (
+				grep->memory, grep->items, capacity * sizeof (*items));
+
+			if (!items)
+			{
+				SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+				break;
+			}
+
+			grep->items = items;
+			grep->capacity = capacity;
+		}
+
+		struct CASC_Grep_Item *item = &grep->items [grep->count];
+		const size_t length = strlen (data.szFileName) + 1;
+
+		memset (item, 0, sizeof (*item));
+
+		if (!(item->location.name =
+			casc_memory_allocate (grep->memory, length)))
+		{
+			SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+			break;
+		}
+
+		memcpy (item->location.name, data.szFileName, length);
+		casc_finder_locate (storage, data.EKey,
+			&item->location.archive, &item->location.offset);
+		grep->count++;
+	}
+
+	const DWORD error = GetCascError ();
+
+	if (grep->find)
+	{
+		CascFindClose (grep->find);
+		grep->find = NULL;
+	}
+
+	SetCascError (error);
+
+	if (error != ERROR_SUCCESS)
+	{
+		return 0;
+	}
+
+	/* The location comes first within each item. */
+	qsort (grep->items, grep->count, sizeof (*grep->items),
+		casc_finder_compare_location);
+
+	return 1;
+}
+
+/*
+ * Searches the data of `item` for the Lua pattern at `pattern`, by way of
+ * `string.find` (at `find`), on the calling thread.
+ */
+static void
+grep_pattern (
+	lua_State *L,
+	struct CASC_Grep *grep,
+	struct CASC_Grep_Item *item,
+	int find,
+	int pattern)
+{
+	const BYTE *counted = item->data;
+	const BYTE *cursor = item->data;
+	lua_Integer line = 1;
+
+	lua_pushlstring (L, (const char *) item->data, item->size);
+
+	while (cursor)
+	{
+		lua_pushvalue (L, find);
+		lua_pushvalue (L, -2);
+		lua_pushvalue (L, pattern);
+		lua_pushinteger (L, (lua_Integer) (cursor - item->data) + 1);
+		lua_call (L, 3, 2);
+
+		if (lua_isnil (L, -2))
+		{
+			lua_pop (L, 2);
+			break;
+		}
+
+		const lua_Integer first = lua_tointeger (L, -2);
+		const lua_Integer last = lua_tointeger (L, -1);
+		lua_pop (L, 2);
+
+		cursor = grep_match (grep, item, item->data + first - 1,
+			last >= first ? (size_t) (last - first + 1) : 0,
+			&counted, &line);
+	}
+
+	lua_pop (L, 1);
+}
+
+/*
+ * Searches the files matching `options->names` for the needle at `needle`
+ * on a pool of workers, which decode the files in the order of their data.
+ * Plain searches are done by the workers themselves, while patterns are
+ * matched on the calling thread, as the files are decoded.  See
+ * `casc:grep ()`.
+ */
+extern int
+casc_grep_run (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	int needle,
+	const struct CASC_Grep_Options *options)
+{
+	needle = lua_absindex (L, needle);
+
+	size_t length;
+	const char *text = lua_tolstring (L, needle, &length);
+
+	/* Raise any error in the pattern before anything is started. */
+	lua_getglobal (L, "string");
+	lua_getfield (L, -1, "find");
+	lua_remove (L, -2);
+	const int find = lua_gettop (L);
+
+	if (!options->plain)
+	{
+		lua_pushvalue (L, find);
+		lua_pushliteral (L, "");
+		lua_pushvalue (L, needle);
+		lua_call (L, 2, 0);
+	}
+
+	struct CASC_Grep *grep = lua_newuserdata (L, sizeof (*grep));
+	memset (grep, 0, sizeof (*grep));
+	grep_metatable (L);
+	const int state = lua_gettop (L);
+
+	grep->handle = storage->handle;
+	grep->memory = storage->memory;
+	grep->plain = options->plain;
+	grep->lines = options->lines;
+	grep->maximum = options->maximum;
+	grep->length = length;
+
+	if (!(grep->needle = casc_memory_allocate (grep->memory, length + 1)))
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		goto error;
+	}
+
+	memcpy (grep->needle, text, length + 1);
+
+	if (!grep_gather (L, grep, storage, options->names))
+	{
+		goto error;
+	}
+
+	int threads = options->threads;
+
+	if ((size_t) threads > grep->count)
+	{
+		threads = grep->count ? (int) grep->count : 1;
+	}
+
+	casc_mutex_initialize (&grep->mutex);
+	casc_condition_initialize (&grep->condition);
+	grep->synchronized = 1;
+	grep->window = (size_t) threads * GREP_WINDOW;
+
+	while (grep->started < threads && casc_thread_create (
+		&grep->workers [grep->started], grep_worker, grep))
+	{
+		grep->started++;
+	}
+
+	/* Lacking any worker, do the work on the calling thread. */
+	if (grep->started == 0)
+	{
+		grep->window = grep->count;
+		grep_worker (grep);
+	}
+
+	lua_newtable (L);
+	lua_newtable (L);
+
+	const int matches = state + 1;
+	const int errors = state + 2;
+
+	for (size_t index = 0; index < grep->count; index++)
+	{
+		struct CASC_Grep_Item *item = &grep->items [index];
+
+		casc_mutex_lock (&grep->mutex);
+
+		while (!item->ready)
+		{
+			casc_condition_wait (&grep->condition, &grep->mutex);
+		}
+
+		casc_mutex_unlock (&grep->mutex);
+
+		if (item->error == ERROR_SUCCESS && !grep->plain)
+		{
+			grep_pattern (L, grep, item, find, needle);
+		}
+
+		casc_memory_free (item->data);
+		item->data = NULL;
+
+		if (item->error != ERROR_SUCCESS)
+		{
+			lua_pushstring (L, strerror (item->error));
+			lua_setfield (L, errors, item->location.name);
+		}
+		else if (item->count)
+		{
+			lua_createtable (L, (int) item->count, 0);
+
+			for (size_t position = 0; position < item->count; position++)
+			{
+				lua_pushinteger (L, item->positions [position]);
+				lua_rawseti (L, -2, (int) position + 1);
+			}
+
+			lua_setfield (L, matches, item->location.name);
+		}
+
+		casc_mutex_lock (&grep->mutex);
+		grep->consumed = index + 1;
+		casc_condition_broadcast (&grep->condition);
+		casc_mutex_unlock (&grep->mutex);
+	}
+
+	grep_release (grep);
+	return 2;
+
+error:
+	{
+		const DWORD error = GetCascError ();
+		grep_release (grep);
+		SetCascError (error);
+	}
+
+	return casc_result (L, 0);
+}
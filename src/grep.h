@@ -0,0 +1,24 @@
+#ifndef CASC_GREP_H
+#define CASC_GREP_H
+
+#include <lua.h>
+
+struct CASC_Storage;
+
+struct CASC_Grep_Options
+{
+	const char *names;
+	int plain;
+	int lines;
+	lua_Integer maximum;
+	int threads;
+};
+
+extern int
+casc_grep_run (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	int needle,
+	const struct CASC_Grep_Options *options);
+
+#endif
@@ -0,0 +1,223 @@
+#include "index.h"
+#include "finder.h"
+#include "memory.h"
+#include "storage.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <lua.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* FNV-1a. */
+static size_t
+index_hash (const char *name)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+
+	for (; *name; name++)
+	{
+		hash ^= (unsigned char) *name;
+		hash *= 0x100000001b3;
+	}
+
+	return (size_t) hash;
+}
+
+static size_t *
+index_slot (
+	const struct CASC_Index *index,
+	const char *name)
+{
+	size_t slot = index_hash (name) & index->mask;
+
+	while (index->slots [slot])
+	{
+		const struct CASC_Index_Entry *entry =
+			&index->entries [index->slots [slot] - 1];
+
+		if (strcmp (entry->name, name) == 0)
+		{
+			break;
+		}
+
+		slot = (slot + 1) & index->mask;
+	}
+
+	return &index->slots [slot];
+}
+
+/* Keeps the load factor of the slots at or below one half. */
+static int
+index_rehash (struct CASC_Index *index)
+{
+	const size_t length = index->slots ? (index->mask + 1) * 2 : 1024;
+	size_t *slots = casc_memory_allocate_zeroed (
+		index->memory, length, sizeof (*slots));
+
+	if (!slots)
+	{
+		return 0;
+	}
+
+	casc_memory_free (index->slots);
+	index->slots = slots;
+	index->mask = length - 1;
+
+	for (size_t position = 0; position < index->count; position++)
+	{
+		*index_slot (index, index->entries [position].name) = position + 1;
+	}
+
+	return 1;
+}
+
+extern void
+casc_index_initialize (
+	struct CASC_Index *index,
+	struct CASC_Memory *memory)
+{
+	index->entries = NULL;
+	index->count = 0;
+	index->capacity = 0;
+	index->slots = NULL;
+	index->mask = 0;
+	index->memory = memory;
+}
+
+extern void
+casc_index_release (
+	struct CASC_Index *index)
+{
+	for (size_t position = 0; position < index->count; position++)
+	{
+		casc_memory_free (index->entries [position].name);
+	}
+
+	casc_memory_free (index->entries);
+	casc_memory_free (index->slots);
+	casc_index_initialize (index, index->memory);
+}
+
+/*
+ * Returns the entry for `name`, creating it (zeroed, aside from the name)
+ * if it does not already exist.  Returns `NULL` when out of memory.
+ */
+extern struct CASC_Index_Entry *
+casc_index_insert (
+	struct CASC_Index *index,
+	const char *name)
+{
+	if (!index->slots || index->count >= (index->mask + 1) / 2)
+	{
+		if (!index_rehash (index))
+		{
+			return NULL;
+		}
+	}
+
+	size_t *slot = index_slot (index, name);
+
+	if (*slot)
+	{
+		return &index->entries [*slot - 1];
+	}
+
+	if (index->count == index->capacity)
+	{
+		const size_t capacity =
+			index->capacity ? index->capacity * 2 : 1024;
+		struct CASC_Index_Entry *entries = casc_memory_reallocate (
+			index->memory, index->entries, capacity * sizeof (*entries));
+
+		if (!entries)
+		{
+			return NULL;
+		}
+
+		index->entries = entries;
+		index->capacity = capacity;
+	}
+
+	const size_t length = strlen (name) + 1;
+	struct CASC_Index_Entry *entry = &index->entries [index->count];
+	memset (entry, 0, sizeof (*entry));
+
+	if (!(entry->name = casc_memory_allocate (index->memory, length)))
+	{
+		return NULL;
+	}
+
+	memcpy (entry->name, name, length);
+	*slot = ++index->count;
+
+	return entry;
+}
+
+extern struct CASC_Index_Entry *
+casc_index_find (
+	const struct CASC_Index *index,
+	const char *name)
+{
+	if (!index->slots)
+	{
+		return NULL;
+	}
+
+	const size_t slot = *index_slot (index, name);
+	return slot ? &index->entries [slot - 1] : NULL;
+}
+
+/*
+ * Adds every file of `storage` matching `pattern` to `index`.  The search
+ * handle is stored in `find` so that the owner of the index can close it,
+ * should an error be raised midway.  On failure, the CascLib error state is
+ * set, and `0` is returned.
+ */
+extern int
+casc_index_gather (
+	lua_State *L,
+	struct CASC_Index *index,
+	const struct CASC_Storage *storage,
+	HANDLE *find,
+	const char *pattern,
+	const int plain)
+{
+	CASC_FIND_DATA data;
+	int status;
+
+	SetCascError (ERROR_SUCCESS);
+	*find = CascFindFirstFile (storage->handle, "*", &data, NULL);
+
+	for (status = !!*find; status; status = CascFindNextFile (*find, &data))
+	{
+		if (!casc_finder_match (L, data.szFileName, pattern, plain))
+		{
+			continue;
+		}
+
+		struct CASC_Index_Entry *entry =
+			casc_index_insert (index, data.szFileName);
+
+		if (!entry)
+		{
+			SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+			break;
+		}
+
+		memcpy (entry->ckey, data.CKey, sizeof (entry->ckey));
+		memcpy (entry->ekey, data.EKey, sizeof (entry->ekey));
+		entry->size = data.FileSize;
+	}
+
+	const DWORD error = GetCascError ();
+
+	if (*find)
+	{
+		CascFindClose (*find);
+		*find = NULL;
+	}
+
+	SetCascError (error);
+	return error == ERROR_SUCCESS;
+}
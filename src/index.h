@@ -0,0 +1,67 @@
+#ifndef CASC_INDEX_H
+#define CASC_INDEX_H
+
+#include <CascLib.h>
+#include <CascPort.h>
+#include <lua.h>
+#include <stddef.h>
+
+struct CASC_Memory;
+struct CASC_Storage;
+
+struct CASC_Index_Entry
+{
+	char *name;
+	BYTE ckey [MD5_HASH_SIZE];
+	BYTE ekey [MD5_HASH_SIZE];
+	ULONGLONG size;
+	int mark;
+};
+
+/*
+ * A hash map from file name to the metadata of said file, as provided by
+ * enumeration.  Entries are kept in insertion order, with `slots` holding
+ * one-based positions into `entries` (zero marking an empty slot).  All
+ * of it is allocated from `memory`.
+ */
+struct CASC_Index
+{
+	struct CASC_Index_Entry *entries;
+	size_t count;
+	size_t capacity;
+
+	size_t *slots;
+	size_t mask;
+
+	struct CASC_Memory *memory;
+};
+
+extern void
+casc_index_initialize (
+	struct CASC_Index *index,
+	struct CASC_Memory *memory);
+
+extern void
+casc_index_release (
+	struct CASC_Index *index);
+
+extern struct CASC_Index_Entry *
+casc_index_insert (
+	struct CASC_Index *index,
+	const char *name);
+
+extern struct CASC_Index_Entry *
+casc_index_find (
+	const struct CASC_Index *index,
+	const char *name);
+
+extern int
+casc_index_gather (
+	lua_State *L,
+	struct CASC_Index *index,
+	const struct CASC_Storage *storage,
+	HANDLE *find,
+	const char *pattern,
+	const int plain);
+
+#endif
@@ -1,11 +1,20 @@
+#include "common.h"
+#include "diff.h"
+#include "ffi.h"
+#include "memory.h"
+#include "overlay.h"
+#include "pack.h"
 #include "storage.h"
+#include "trace.h"
+#include <CascLib.h>
+#include <CascPort.h>
 #include <compat-5.3.h>
 #include <lauxlib.h>
 #include <lua.h>
 #include <stddef.h>
 
 /**
- * `casclib.open (path [, type])`
+ * `casclib.open (path [, type] [, options])`
  *
  * This function opens the CASC storage specified by `path` (`string`) as
  * the specified `type` (`string`).
@@ -15,6 +24,32 @@
  * - `"local"`: Opens a local storage.
  * - `"online"`: Opens an online storage.
  *
+ * The `options` (`table`) can contain any of the following fields:
+ *
+ * - `type` (`string`): As above.  Only used if `type` is absent.
+ * - `cache` (`string`): For online storages, the directory in which
+ *   downloaded files are kept, persisting between runs.
+ * - `product` (`string`): For online storages, the product code name.
+ * - `region` (`string`): For online storages, the region.
+ * - `cdn` (`string`): For online storages, the URL of the CDN host to use
+ *   in place of the official ones (e.g. a local HTTP server serving a CDN
+ *   layout).
+ * - `threads` (`number`): The default number of worker threads used by
+ *   operations on the storage, such as `casc:prefetch ()`.  Defaults to
+ *   `4`.
+ * - `lazy` (`boolean`): Whether `casc:open ()` defers opening files by
+ *   default.  Defaults to `false`.
+ * - `record_profile` (`string`): A file in which to record the name of
+ *   every file opened through `casc:open ()`, in order, along with the
+ *   offset at which it was first read.
+ * - `warm_profile` (`string`): A file previously written by way of
+ *   `record_profile`.  The files it names are prefetched in the
+ *   background, in their recorded order, as per `casc:prefetch ()`, until
+ *   done or the storage is closed.  A missing profile is ignored.
+ * - `memory_budget` (`number`): The number of bytes of native memory the
+ *   binding may allocate for the storage (see `casclib.memory ()`).
+ *   Defaults to `0`, meaning no limit.
+ *
  * In case of success, this function returns a new `Casc Storage` object.
  * Otherwise, it returns `nil`, a `string` describing the error, and a
  * `number` indicating the error code.
@@ -30,22 +65,207 @@ casc_open (lua_State *L)
 	};
 
 	const char *path = luaL_checkstring (L, 1);
-	const int type = luaL_checkoption (L, 2, "local", types);
+	const int options = lua_istable (L, 2) ? 2 : 3;
+	const int type = options == 2
+		? casc_option_choice (L, options, "type", "local", types)
+		: luaL_checkoption (L, 2, "local", types);
+
+	return casc_storage_initialize (L, path, type, options);
+}
+
+/**
+ * `casclib.diff (before, after [, pattern [, plain]])`
+ *
+ * Compares the `Casc Storage` objects `before` and `after`, using only the
+ * file names and content keys provided by enumeration (i.e. no file is
+ * opened or read).  The comparison can be restricted to the files matching
+ * `pattern` (`string`), as per `casc:files ()`.
+ *
+ * In case of success, this function returns three `table` (sequences) of
+ * file names: those that were added (only in `after`), those that were
+ * removed (only in `before`), and those that were changed (in both, with
+ * differing content).  Otherwise, it returns `nil`, a `string` describing
+ * the error, and a `number` indicating the error code.
+ */
+static int
+casc_diff (lua_State *L)
+{
+	const struct CASC_Storage *before = casc_storage_access (L, 1);
+	const struct CASC_Storage *after = casc_storage_access (L, 2);
+	const char *pattern = luaL_optstring (L, 3, NULL);
+	const int plain = lua_toboolean (L, 4);
+
+	if (!before->handle || !after->handle)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		return casc_result (L, 0);
+	}
+
+	return casc_diff_compute (L, before, after, pattern, plain);
+}
+
+/**
+ * `casclib.overlay (layers)`
+ *
+ * Layers the given `layers` (`table`), a sequence of local directories
+ * (`string`) and `Casc Storage` objects, over one another, with earlier
+ * layers taking precedence whatever their kind.  A loose file within a
+ * directory thereby overrides the file of the same name within any later
+ * layer, without the storage having to be copied to disk, whereas a
+ * storage preceding the directory overrides the loose file.
+ *
+ * The directories are scanned once, into an in-memory index, such that
+ * resolving a name never touches the file system.  Storages are kept
+ * alive by the overlay, but not closed with it.
+ *
+ * In case of success, this function returns a new `Casc Overlay` object.
+ * Otherwise, it returns `nil`, a `string` describing the error, and a
+ * `number` indicating the error code.
+ */
+static int
+casc_overlay (lua_State *L)
+{
+	return casc_overlay_initialize (L, 1);
+}
+
+/**
+ * `casclib.open_pack (path)`
+ *
+ * Opens the pack file at `path` (`string`), as written by `casc:pack ()`,
+ * by mapping it into memory.  Opening is constant time, regardless of the
+ * number of files within the pack, and lookups bisect its index.
+ *
+ * Returns a new `Casc Pack` object, which provides `pack:files ()` and
+ * `pack:open ()`, as per the `Casc Storage`, along with `pack:readfile ()`
+ * and `pack:view ()`.  The mapping is not counted by `casclib.memory ()`.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+casc_open_pack (lua_State *L)
+{
+	return casc_pack_open (L, luaL_checkstring (L, 1));
+}
+
+/**
+ * `casclib.trace (path)`
+ * `casclib.trace (false)`
+ *
+ * Starts recording a trace of the operations of the binding (e.g. the
+ * opening of storages and files, reads, seeks, steps of enumeration, and
+ * closes), from every thread, to be written to the file `path` (`string`)
+ * in the Chrome Trace Event format, as understood by `chrome://tracing`
+ * and Perfetto.  Passing `false` stops recording, and writes the file.
+ * Starting a new trace first stops (and writes) the current one.
+ *
+ * Each thread keeps its most recent `4096` events, with older ones being
+ * overwritten.  Recording is best stopped when no background work (e.g.
+ * `casc:prefetch ()`) is in progress.
+ *
+ * Returns `true` on success.  In case of error, returns `nil`, a `string`
+ * describing the error, and a `number` indicating the error code.
+ */
+static int
+casc_trace (lua_State *L)
+{
+	if (lua_isboolean (L, 1) && !lua_toboolean (L, 1))
+	{
+		return casc_result (L, casc_trace_stop ());
+	}
+
+	return casc_result (L, casc_trace_start (luaL_checkstring (L, 1)));
+}
+
+/**
+ * `casclib.memory ([options])`
+ *
+ * Reports the native memory allocated by the binding (e.g. read buffers,
+ * indexes, caches, and name lists), which is invisible to
+ * `collectgarbage ('count')`.  Every allocation is counted globally, and
+ * against the storage it is made for.  Note that the memory of CascLib
+ * itself is not included.
+ *
+ * The `options` (`table`) can contain the following fields:
+ *
+ * - `budget` (`number`): The number of bytes the binding may allocate in
+ *   total, with `0` meaning no limit.  Each storage can also be given its
+ *   own budget (see `casclib.open ()`).  An allocation that would exceed a
+ *   budget first evicts the cached blocks of the open files of its storage
+ *   (see `file:cache ()`), and only then fails.
+ * - `allocator` (`string`): Either `"system"` (the default) or `"lua"`, to
+ *   route the allocations made by this thread through the allocator of
+ *   the calling Lua state, such that its memory limits apply.  Worker
+ *   threads always use the system allocator.  Only one Lua state can be
+ *   routed through at a time.
+ *
+ * Returns a `table` with the `used`, `peak`, `budget`, and `allocations`
+ * (`number`) of the binding, the `allocator` (`string`) in use by this
+ * thread, and the `storages` (`table`), a sequence of tables holding the
+ * same fields for each storage, along with its `name` (`string`), and
+ * whether it is `closed` (`boolean`).  A closed storage remains listed
+ * until all of its memory is freed.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+casc_memory (lua_State *L)
+{
+	static const char * const
+	allocators [] = {
+		"system",
+		"lua",
+		NULL
+	};
+
+	if (!lua_isnoneornil (L, 1))
+	{
+		luaL_checktype (L, 1, LUA_TTABLE);
+
+		const lua_Integer budget =
+			casc_option_integer (L, 1, "budget", -1);
+
+		luaL_argcheck (L, budget >= -1, 1, "invalid budget");
 
-	lua_settop (L, 0);
-	return casc_storage_initialize (L, path, type);
+		lua_getfield (L, 1, "allocator");
+		const int has_allocator = !lua_isnil (L, -1);
+		lua_pop (L, 1);
+
+		if (has_allocator && !casc_memory_route (L,
+			casc_option_choice (L, 1, "allocator", "system", allocators)))
+		{
+			return casc_result (L, 0);
+		}
+
+		if (budget >= 0)
+		{
+			casc_memory_budget ((size_t) budget);
+		}
+	}
+
+	return casc_memory_report (L);
 }
 
 static const luaL_Reg
 casc_functions [] =
 {
 	{ "open", casc_open },
+	{ "diff", casc_diff },
+	{ "overlay", casc_overlay },
+	{ "open_pack", casc_open_pack },
+	{ "trace", casc_trace },
+	{ "memory", casc_memory },
 	{ NULL, NULL }
 };
 
 extern int
 luaopen_casclib (lua_State *L)
 {
+	casc_memory_initialize ();
+	casc_trace_initialize ();
+
 	luaL_newlib (L, casc_functions);
+	casc_ffi_register (L);
 	return 1;
 }
@@ -0,0 +1,381 @@
+#include "lines.h"
+#include "common.h"
+#include "file.h"
+#include "memory.h"
+#include "trace.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <compat-5.3.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CASC_LINES_METATABLE "Casc LineIndex"
+
+/*
+ * The count is kept along with the file, such that the length remains
+ * available once the file is closed.
+ */
+struct CASC_Line_Index
+{
+	struct CASC_File *file;
+	size_t count;
+};
+
+static ULONGLONG
+lines_start (
+	const struct CASC_Lines *lines,
+	size_t index)
+{
+	return lines->wide
+		? ((const ULONGLONG *) lines->offsets) [index]
+		: ((const DWORD *) lines->offsets) [index];
+}
+
+static int
+lines_append (
+	struct CASC_Lines *lines,
+	ULONGLONG offset)
+{
+	if (lines->count == lines->capacity)
+	{
+		const size_t width =
+			lines->wide ? sizeof (ULONGLONG) : sizeof (DWORD);
+		const size_t capacity =
+			lines->capacity ? lines->capacity * 2 : 1024;
+		void *offsets = casc_memory_reallocate (
+			lines->memory, lines->offsets, capacity * width);
+
+		if (!offsets)
+		{
+			SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+			return 0;
+		}
+
+		lines->offsets = offsets;
+		lines->capacity = capacity;
+	}
+
+	if (lines->wide)
+	{
+		((ULONGLONG *) lines->offsets) [lines->count++] = offset;
+	}
+	else
+	{
+		((DWORD *) lines->offsets) [lines->count++] = (DWORD) offset;
+	}
+
+	return 1;
+}
+
+static void
+lines_free (struct CASC_Lines *lines)
+{
+	casc_memory_free (lines->offsets);
+	casc_memory_free (lines);
+}
+
+/*
+ * Indexes the lines of `file`, in a single pass over its decoded data,
+ * searching each window for line breaks with `memchr`.  As with
+ * `file:lines ()`, a final line break does not begin another line.  The
+ * file position is left unaltered.
+ */
+static struct CASC_Lines *
+lines_build (struct CASC_File *file)
+{
+	struct CASC_Memory *memory = file->cache.memory;
+	struct CASC_Lines *lines =
+		casc_memory_allocate_zeroed (memory, 1, sizeof (*lines));
+
+	if (!lines)
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		return NULL;
+	}
+
+	lines->memory = memory;
+	lines->wide = file->size > 0xFFFFFFFF;
+
+	const uint64_t start = casc_trace_begin ();
+	const ULONGLONG position = file->position;
+	int status = file->size == 0 || lines_append (lines, 0);
+
+	file->position = 0;
+
+	/* Growing the index may allocate, which must not evict the window. */
+	casc_cache_pin (&file->cache);
+
+	while (status)
+	{
+		const BYTE *data;
+		size_t available;
+
+		if (!(status = casc_file_window (file, &data, &available))
+			|| available == 0)
+		{
+			break;
+		}
+
+		const BYTE *cursor = data;
+		const BYTE *end = data + available;
+
+		while (status && (cursor = memchr (cursor, '\n',
+			(size_t) (end - cursor))))
+		{
+			const ULONGLONG offset =
+				file->position + (ULONGLONG) (++cursor - data);
+
+			status = offset >= file->size || lines_append (lines, offset);
+		}
+
+		file->position += available;
+	}
+
+	casc_cache_unpin (&file->cache);
+	file->position = position;
+	casc_trace_end (start, "index lines", NULL, lines->count);
+
+	if (!status)
+	{
+		lines_free (lines);
+		return NULL;
+	}
+
+	return lines;
+}
+
+static int
+lines_ready (struct CASC_File *file)
+{
+	return file->lines || (file->lines = lines_build (file));
+}
+
+/*
+ * Pushes the line at (zero-based) `index` of `file`, without its line
+ * break, leaving the file position unaltered.  On failure, `0` is
+ * returned, and the CascLib error state is set.
+ */
+static int
+lines_push (
+	lua_State *L,
+	struct CASC_File *file,
+	size_t index)
+{
+	const struct CASC_Lines *lines = file->lines;
+	const ULONGLONG start = lines_start (lines, index);
+	const ULONGLONG end = index + 1 < lines->count
+		? lines_start (lines, index + 1) : file->size;
+	const ULONGLONG position = file->position;
+
+	luaL_Buffer line;
+	luaL_buffinit (L, &line);
+
+	char *buffer = luaL_prepbuffsize (&line, (size_t) (end - start));
+	size_t total;
+
+	file->position = start;
+	const int status =
+		casc_file_fetch (file, buffer, (size_t) (end - start), &total);
+	file->position = position;
+
+	if (total > 0 && buffer [total - 1] == '\n')
+	{
+		total--;
+	}
+
+	luaL_addsize (&line, total);
+	luaL_pushresult (&line);
+
+	return status;
+}
+
+static struct CASC_Line_Index *
+lines_access (
+	lua_State *L,
+	int index)
+{
+	return luaL_checkudata (L, index, CASC_LINES_METATABLE);
+}
+
+/**
+ * `index:__index (key)`
+ *
+ * Returns the line (`string`) at the (one-based) `key` (`number`), as per
+ * `file:line ()`, or `nil` should it be out of range.
+ *
+ * In case of errors this function raises the error, instead of returning an
+ * error code.
+ */
+static int
+lines_index (lua_State *L)
+{
+	const struct CASC_Line_Index *index = lines_access (L, 1);
+	int is_integer;
+	const lua_Integer line = lua_tointegerx (L, 2, &is_integer);
+
+	if (!is_integer)
+	{
+		lua_pushnil (L);
+		return 1;
+	}
+
+	if (!casc_file_ready (index->file)
+		|| casc_lines_line (L, index->file, line) != 1)
+	{
+		return luaL_error (L, "%s", strerror (GetCascError ()));
+	}
+
+	return 1;
+}
+
+/**
+ * `index:__len ()`
+ *
+ * Returns the number (`number`) of lines in the file.
+ */
+static int
+lines_length (lua_State *L)
+{
+	const struct CASC_Line_Index *index = lines_access (L, 1);
+
+	lua_pushinteger (L, (lua_Integer) index->count);
+	return 1;
+}
+
+/**
+ * `index:__tostring ()`
+ *
+ * Returns a `string` representation of the `Casc LineIndex` object.
+ */
+static int
+lines_to_string (lua_State *L)
+{
+	const struct CASC_Line_Index *index = lines_access (L, 1);
+
+	lua_pushfstring (L, "%s (%p)", CASC_LINES_METATABLE, index);
+	return 1;
+}
+
+static const luaL_Reg
+lines_methods [] =
+{
+	{ "__index", lines_index },
+	{ "__len", lines_length },
+	{ "__tostring", lines_to_string },
+	{ NULL, NULL }
+};
+
+static void
+lines_metatable (lua_State *L)
+{
+	if (luaL_newmetatable (L, CASC_LINES_METATABLE))
+	{
+		luaL_setfuncs (L, lines_methods, 0);
+	}
+
+	lua_setmetatable (L, -2);
+}
+
+/*
+ * Pushes a new line index of the file at `index`, indexing its lines if
+ * not already done.  The index keeps the file alive (as its user value).
+ */
+extern int
+casc_lines_index (
+	lua_State *L,
+	struct CASC_File *file,
+	int index)
+{
+	index = lua_absindex (L, index);
+
+	if (!lines_ready (file))
+	{
+		return casc_result (L, 0);
+	}
+
+	struct CASC_Line_Index *lines = lua_newuserdata (L, sizeof (*lines));
+	lines->file = file;
+	lines->count = file->lines->count;
+
+	lua_pushvalue (L, index);
+	lua_setuservalue (L, -2);
+	lines_metatable (L);
+
+	return 1;
+}
+
+/* Pushes the (one-based) `line` of `file`.  See `file:line ()`. */
+extern int
+casc_lines_line (
+	lua_State *L,
+	struct CASC_File *file,
+	lua_Integer line)
+{
+	if (!lines_ready (file))
+	{
+		return casc_result (L, 0);
+	}
+
+	if (line < 1 || (lua_Unsigned) line > file->lines->count)
+	{
+		lua_pushnil (L);
+		return 1;
+	}
+
+	if (!lines_push (L, file, (size_t) line - 1))
+	{
+		return casc_result (L, 0);
+	}
+
+	return 1;
+}
+
+/*
+ * Pushes a `table` of the lines of `file` from `first` to `last`.  See
+ * `file:lines_range ()`.
+ */
+extern int
+casc_lines_range (
+	lua_State *L,
+	struct CASC_File *file,
+	lua_Integer first,
+	lua_Integer last)
+{
+	if (!lines_ready (file))
+	{
+		return casc_result (L, 0);
+	}
+
+	const lua_Integer count = (lua_Integer) file->lines->count;
+
+	first = first < 1 ? 1 : first;
+	last = last > count ? count : last;
+
+	lua_newtable (L);
+
+	for (lua_Integer line = first; line <= last; line++)
+	{
+		if (!lines_push (L, file, (size_t) line - 1))
+		{
+			return casc_result (L, 0);
+		}
+
+		lua_rawseti (L, -2, line - first + 1);
+	}
+
+	return 1;
+}
+
+extern void
+casc_lines_release (
+	struct CASC_File *file)
+{
+	if (file->lines)
+	{
+		lines_free (file->lines);
+		file->lines = NULL;
+	}
+}
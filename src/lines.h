@@ -0,0 +1,49 @@
+#ifndef CASC_LINES_H
+#define CASC_LINES_H
+
+#include <CascPort.h>
+#include <lua.h>
+#include <stddef.h>
+
+struct CASC_File;
+struct CASC_Memory;
+
+/*
+ * The offset at which each line of a file starts.  The `offsets` are held
+ * as `DWORD`, unless the file is too large for that, in which case they are
+ * `wide`, as `ULONGLONG`.
+ */
+struct CASC_Lines
+{
+	void *offsets;
+	int wide;
+	size_t count;
+	size_t capacity;
+
+	struct CASC_Memory *memory;
+};
+
+extern int
+casc_lines_index (
+	lua_State *L,
+	struct CASC_File *file,
+	int index);
+
+extern int
+casc_lines_line (
+	lua_State *L,
+	struct CASC_File *file,
+	lua_Integer line);
+
+extern int
+casc_lines_range (
+	lua_State *L,
+	struct CASC_File *file,
+	lua_Integer first,
+	lua_Integer last);
+
+extern void
+casc_lines_release (
+	struct CASC_File *file);
+
+#endif
@@ -0,0 +1,580 @@
+#include "memory.h"
+#include "cache.h"
+#include "common.h"
+#include "thread.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <compat-5.3.h>
+#include <lauxlib.h>
+#include <limits.h>
+#include <lua.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CASC_MEMORY_ROUTE_METATABLE "Casc Memory Route"
+
+/* Marks the blocks obtained from the allocator of a `lua_State`. */
+#define MEMORY_ROUTED ((size_t) 1 << (sizeof (size_t) * CHAR_BIT - 1))
+
+/*
+ * Precedes every block, recording the account it is charged to, and its
+ * size.  The union keeps the block itself suitably aligned.
+ */
+union CASC_Memory_Header
+{
+	struct
+	{
+		struct CASC_Memory *memory;
+		size_t size;
+	} block;
+
+	long double alignment_float;
+	long long alignment_integer;
+	void *alignment_pointer;
+};
+
+struct CASC_Memory_Snapshot
+{
+	size_t used;
+	size_t peak;
+	size_t budget;
+	size_t allocations;
+	size_t name;
+	int closed;
+};
+
+static struct
+{
+	CASC_Mutex mutex;
+	int initialized;
+
+	struct CASC_Memory global;
+	struct CASC_Memory *accounts;
+
+	/*
+	 * The allocator of the `lua_State` that allocations are routed through,
+	 * should it be enabled.  Only the thread that enabled it (as marked by
+	 * `routed`) uses it, as allocators are not expected to be thread safe.
+	 * The allocator is kept for as long as any of its blocks remains.
+	 */
+	lua_Alloc allocator;
+	void *data;
+	const int *routed;
+	size_t blocks;
+} memory;
+
+/* Its address tells threads apart. */
+static CASC_THREAD_LOCAL int memory_thread;
+
+/* Returns the number of bytes by which `size` would exceed the budget. */
+static size_t
+memory_excess (
+	const struct CASC_Memory *account,
+	size_t size)
+{
+	if (!account->budget || account->used + size <= account->budget)
+	{
+		return 0;
+	}
+
+	return account->used + size - account->budget;
+}
+
+/*
+ * Charges `size` bytes to `account` and the global account, counting a new
+ * allocation should `count` be set.  When over budget, the caches of the
+ * account are evicted, provided this is its owning thread.  Returns `0`
+ * when the budget cannot be met.
+ */
+static int
+memory_charge (
+	struct CASC_Memory *account,
+	size_t size,
+	int count)
+{
+	while (1)
+	{
+		casc_mutex_lock (&memory.mutex);
+
+		size_t excess = memory_excess (&memory.global, size);
+
+		if (account)
+		{
+			const size_t own = memory_excess (account, size);
+			excess = own > excess ? own : excess;
+		}
+
+		if (!excess)
+		{
+			struct CASC_Memory *accounts [2] = { &memory.global, account };
+
+			for (int index = 0; index < 2 && accounts [index]; index++)
+			{
+				struct CASC_Memory *target = accounts [index];
+
+				target->used += size;
+				target->allocations += (size_t) !!count;
+
+				if (target->used > target->peak)
+				{
+					target->peak = target->used;
+				}
+			}
+
+			casc_mutex_unlock (&memory.mutex);
+			return 1;
+		}
+
+		casc_mutex_unlock (&memory.mutex);
+
+		if (!account || account->owner != &memory_thread
+			|| !casc_cache_evict (account->caches, excess))
+		{
+			return 0;
+		}
+	}
+}
+
+/*
+ * Releases `size` bytes from `account` and the global account, along with
+ * an allocation should `count` be set.  A closed account is freed along
+ * with its last allocation.
+ */
+static void
+memory_discharge (
+	struct CASC_Memory *account,
+	size_t size,
+	int count)
+{
+	int release = 0;
+	casc_mutex_lock (&memory.mutex);
+
+	struct CASC_Memory *accounts [2] = { &memory.global, account };
+
+	for (int index = 0; index < 2 && accounts [index]; index++)
+	{
+		accounts [index]->used -= size;
+		accounts [index]->allocations -= (size_t) !!count;
+	}
+
+	if (account && account->closed && !account->allocations)
+	{
+		struct CASC_Memory **link = &memory.accounts;
+
+		while (*link != account)
+		{
+			link = &(*link)->next;
+		}
+
+		*link = account->next;
+		release = 1;
+	}
+
+	casc_mutex_unlock (&memory.mutex);
+
+	if (release)
+	{
+		free (account);
+	}
+}
+
+extern void
+casc_memory_initialize (void)
+{
+	if (!memory.initialized)
+	{
+		casc_mutex_initialize (&memory.mutex);
+		memory.global.name = "global";
+		memory.initialized = 1;
+	}
+}
+
+/*
+ * Opens a new account, named `name`, owned by the calling thread.  Returns
+ * `NULL` if it cannot be allocated.
+ */
+extern struct CASC_Memory *
+casc_memory_open (
+	const char *name,
+	size_t budget)
+{
+	const size_t length = strlen (name) + 1;
+	struct CASC_Memory *account = malloc (sizeof (*account) + length);
+
+	if (!account)
+	{
+		return NULL;
+	}
+
+	memset (account, 0, sizeof (*account));
+	memcpy (account + 1, name, length);
+	account->name = (const char *) (account + 1);
+	account->budget = budget;
+	account->owner = &memory_thread;
+
+	casc_mutex_lock (&memory.mutex);
+
+	struct CASC_Memory **link = &memory.accounts;
+
+	while (*link)
+	{
+		link = &(*link)->next;
+	}
+
+	*link = account;
+	casc_mutex_unlock (&memory.mutex);
+
+	return account;
+}
+
+/*
+ * Closes `account`, which is freed right away should nothing be allocated
+ * from it anymore.  Otherwise, it is freed along with its last allocation.
+ */
+extern void
+casc_memory_close (
+	struct CASC_Memory *account)
+{
+	if (!account)
+	{
+		return;
+	}
+
+	casc_mutex_lock (&memory.mutex);
+	account->closed = 1;
+	casc_mutex_unlock (&memory.mutex);
+
+	memory_discharge (account, 0, 0);
+}
+
+/*
+ * Allocates `size` bytes, charged to `account` (which can be `NULL` to
+ * charge only the global account).  Returns `NULL` should the allocation
+ * fail, or exceed a budget even after eviction.
+ */
+extern void *
+casc_memory_allocate (
+	struct CASC_Memory *account,
+	size_t size)
+{
+	union CASC_Memory_Header *header;
+
+	if (size >= MEMORY_ROUTED - sizeof (*header)
+		|| !memory_charge (account, size, 1))
+	{
+		return NULL;
+	}
+
+	const int routed = memory.routed == &memory_thread;
+
+	if (routed)
+	{
+		header = memory.allocator (
+			memory.data, NULL, 0, sizeof (*header) + size);
+	}
+	else
+	{
+		header = malloc (sizeof (*header) + size);
+	}
+
+	if (!header)
+	{
+		memory_discharge (account, size, 1);
+		return NULL;
+	}
+
+	if (routed)
+	{
+		memory.blocks++;
+	}
+
+	header->block.memory = account;
+	header->block.size = size | (routed ? MEMORY_ROUTED : 0);
+
+	return header + 1;
+}
+
+/* As `casc_memory_allocate ()`, for `count` zeroed elements of `size`. */
+extern void *
+casc_memory_allocate_zeroed (
+	struct CASC_Memory *account,
+	size_t count,
+	size_t size)
+{
+	if (size && count > SIZE_MAX / size)
+	{
+		return NULL;
+	}
+
+	void *pointer = casc_memory_allocate (account, count * size);
+
+	if (pointer)
+	{
+		memset (pointer, 0, count * size);
+	}
+
+	return pointer;
+}
+
+/*
+ * Resizes the block at `pointer` to `size` bytes, which remains charged to
+ * its own account.  Should `pointer` be `NULL`, a new block is allocated
+ * from `account`.  Returns `NULL` on failure, leaving the block untouched.
+ */
+extern void *
+casc_memory_reallocate (
+	struct CASC_Memory *account,
+	void *pointer,
+	size_t size)
+{
+	if (!pointer)
+	{
+		return casc_memory_allocate (account, size);
+	}
+
+	union CASC_Memory_Header *header =
+		(union CASC_Memory_Header *) pointer - 1;
+	const size_t routed = header->block.size & MEMORY_ROUTED;
+	const size_t previous = header->block.size & ~MEMORY_ROUTED;
+
+	account = header->block.memory;
+
+	if (size >= MEMORY_ROUTED - sizeof (*header)
+		|| (size > previous
+			&& !memory_charge (account, size - previous, 0)))
+	{
+		return NULL;
+	}
+
+	union CASC_Memory_Header *resized = routed
+		? memory.allocator (memory.data, header,
+			sizeof (*header) + previous, sizeof (*header) + size)
+		: realloc (header, sizeof (*header) + size);
+
+	if (!resized)
+	{
+		if (size > previous)
+		{
+			memory_discharge (account, size - previous, 0);
+		}
+
+		return NULL;
+	}
+
+	if (size < previous)
+	{
+		memory_discharge (account, previous - size, 0);
+	}
+
+	resized->block.size = size | routed;
+	return resized + 1;
+}
+
+extern void
+casc_memory_free (
+	void *pointer)
+{
+	if (!pointer)
+	{
+		return;
+	}
+
+	union CASC_Memory_Header *header =
+		(union CASC_Memory_Header *) pointer - 1;
+	struct CASC_Memory *account = header->block.memory;
+	const size_t size = header->block.size & ~MEMORY_ROUTED;
+
+	if (header->block.size & MEMORY_ROUTED)
+	{
+		memory.allocator (memory.data, header, sizeof (*header) + size, 0);
+		memory.blocks--;
+	}
+	else
+	{
+		free (header);
+	}
+
+	memory_discharge (account, size, 1);
+}
+
+/* Sets the budget of the global account, where `0` means none. */
+extern void
+casc_memory_budget (
+	size_t budget)
+{
+	casc_mutex_lock (&memory.mutex);
+	memory.global.budget = budget;
+	casc_mutex_unlock (&memory.mutex);
+}
+
+static int
+memory_route_gc (lua_State *L)
+{
+	void *data;
+	const lua_Alloc allocator = lua_getallocf (L, &data);
+
+	if (memory.routed == &memory_thread
+		&& memory.allocator == allocator && memory.data == data)
+	{
+		memory.routed = NULL;
+	}
+
+	return 0;
+}
+
+/*
+ * Routes the allocations made by the calling thread through the allocator
+ * of `L` (or stops doing so).  The state is anchored by a sentinel within
+ * its registry, which stops the routing when the state is closed.  Another
+ * allocator can only take over once the blocks of the previous one are all
+ * freed.
+ */
+extern int
+casc_memory_route (
+	lua_State *L,
+	const int enable)
+{
+	void *data;
+	const lua_Alloc allocator = lua_getallocf (L, &data);
+
+	if (!enable)
+	{
+		memory_route_gc (L);
+		return 1;
+	}
+
+	if (memory.blocks
+		&& (memory.allocator != allocator || memory.data != data))
+	{
+		SetCascError (ERROR_NOT_SUPPORTED);
+		return 0;
+	}
+
+	lua_getfield (L, LUA_REGISTRYINDEX, CASC_MEMORY_ROUTE_METATABLE);
+
+	if (lua_isnil (L, -1))
+	{
+		lua_newuserdata (L, 1);
+
+		if (luaL_newmetatable (L, CASC_MEMORY_ROUTE_METATABLE))
+		{
+			lua_pushcfunction (L, memory_route_gc);
+			lua_setfield (L, -2, "__gc");
+		}
+
+		lua_setmetatable (L, -2);
+		lua_setfield (L, LUA_REGISTRYINDEX, CASC_MEMORY_ROUTE_METATABLE);
+	}
+
+	lua_pop (L, 1);
+
+	memory.allocator = allocator;
+	memory.data = data;
+	memory.routed = &memory_thread;
+
+	return 1;
+}
+
+static void
+memory_push (
+	lua_State *L,
+	const struct CASC_Memory_Snapshot *snapshot)
+{
+	lua_pushinteger (L, (lua_Integer) snapshot->used);
+	lua_setfield (L, -2, "used");
+	lua_pushinteger (L, (lua_Integer) snapshot->peak);
+	lua_setfield (L, -2, "peak");
+	lua_pushinteger (L, (lua_Integer) snapshot->budget);
+	lua_setfield (L, -2, "budget");
+	lua_pushinteger (L, (lua_Integer) snapshot->allocations);
+	lua_setfield (L, -2, "allocations");
+}
+
+static void
+memory_snapshot (
+	const struct CASC_Memory *account,
+	struct CASC_Memory_Snapshot *snapshot)
+{
+	snapshot->used = account->used;
+	snapshot->peak = account->peak;
+	snapshot->budget = account->budget;
+	snapshot->allocations = account->allocations;
+	snapshot->closed = account->closed;
+}
+
+/*
+ * Pushes a `table` describing the global account, with the accounts of the
+ * storages under `storages`.  The accounts are copied while locked, and
+ * only pushed afterwards, as pushing can raise an error.
+ */
+extern int
+casc_memory_report (lua_State *L)
+{
+	struct CASC_Memory_Snapshot global;
+	size_t count = 0;
+	size_t bytes = 0;
+
+	casc_mutex_lock (&memory.mutex);
+
+	for (const struct CASC_Memory *account = memory.accounts;
+		account; account = account->next)
+	{
+		count++;
+		bytes += strlen (account->name) + 1;
+	}
+
+	casc_mutex_unlock (&memory.mutex);
+
+	const size_t size = count * sizeof (struct CASC_Memory_Snapshot);
+	struct CASC_Memory_Snapshot *snapshots =
+		lua_newuserdata (L, size + bytes);
+	char *names = (char *) snapshots + size;
+	size_t copied = 0;
+	size_t offset = 0;
+
+	casc_mutex_lock (&memory.mutex);
+	memory_snapshot (&memory.global, &global);
+
+	for (const struct CASC_Memory *account = memory.accounts;
+		account && copied < count; account = account->next)
+	{
+		const size_t length = strlen (account->name) + 1;
+
+		if (offset + length > bytes)
+		{
+			break;
+		}
+
+		memory_snapshot (account, &snapshots [copied]);
+		memcpy (names + offset, account->name, length);
+		snapshots [copied++].name = offset;
+		offset += length;
+	}
+
+	const int routed = memory.routed == &memory_thread;
+	casc_mutex_unlock (&memory.mutex);
+
+	lua_createtable (L, 0, 6);
+	memory_push (L, &global);
+	lua_pushstring (L, routed ? "lua" : "system");
+	lua_setfield (L, -2, "allocator");
+	lua_createtable (L, (int) copied, 0);
+
+	for (size_t index = 0; index < copied; index++)
+	{
+		lua_createtable (L, 0, 6);
+		memory_push (L, &snapshots [index]);
+		lua_pushstring (L, names + snapshots [index].name);
+		lua_setfield (L, -2, "name");
+		lua_pushboolean (L, snapshots [index].closed);
+		lua_setfield (L, -2, "closed");
+		lua_rawseti (L, -2, (int) index + 1);
+	}
+
+	lua_setfield (L, -2, "storages");
+	lua_remove (L, -2);
+
+	return 1;
+}
@@ -0,0 +1,88 @@
+#ifndef CASC_MEMORY_H
+#define CASC_MEMORY_H
+
+#include <CascPort.h>
+#include <lua.h>
+#include <stddef.h>
+
+struct CASC_Cache;
+
+/*
+ * An account of the native memory allocated on behalf of a storage.  Every
+ * allocation is charged to its account (if any), along with the global
+ * account of the binding, and checked against the budget of both, where a
+ * `budget` of `0` means none.
+ *
+ * Accounts are owned by the thread that opened them, which is the only one
+ * allowed to evict the `caches` of the account to stay within budget.  A
+ * closed account lingers until the last of its allocations is freed.
+ */
+struct CASC_Memory
+{
+	size_t used;
+	size_t peak;
+	size_t budget;
+	size_t allocations;
+
+	/*
+	 * The recency of the cached blocks of the account, shared by all of its
+	 * `caches` so that eviction picks the least recently used block among
+	 * them.
+	 */
+	struct CASC_Cache *caches;
+	ULONGLONG clock;
+
+	const char *name;
+	const int *owner;
+	int closed;
+
+	struct CASC_Memory *next;
+};
+
+extern void
+casc_memory_initialize (void);
+
+extern struct CASC_Memory *
+casc_memory_open (
+	const char *name,
+	size_t budget);
+
+extern void
+casc_memory_close (
+	struct CASC_Memory *memory);
+
+extern void *
+casc_memory_allocate (
+	struct CASC_Memory *memory,
+	size_t size);
+
+extern void *
+casc_memory_allocate_zeroed (
+	struct CASC_Memory *memory,
+	size_t count,
+	size_t size);
+
+extern void *
+casc_memory_reallocate (
+	struct CASC_Memory *memory,
+	void *pointer,
+	size_t size);
+
+extern void
+casc_memory_free (
+	void *pointer);
+
+extern void
+casc_memory_budget (
+	size_t budget);
+
+extern int
+casc_memory_route (
+	lua_State *L,
+	const int enable);
+
+extern int
+casc_memory_report (
+	lua_State *L);
+
+#endif
@@ -0,0 +1,647 @@
+#include "names.h"
+#include "common.h"
+#include "finder.h"
+#include "memory.h"
+#include "storage.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <compat-5.3.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CASC_NAMES_METATABLE "Casc NameList"
+
+/* The largest encoding of a `size_t` as a variable length integer. */
+#define NAMES_VARINT_MAXIMUM 10
+
+static struct CASC_Names *
+names_access (
+	lua_State *L,
+	int index)
+{
+	return luaL_checkudata (L, index, CASC_NAMES_METATABLE);
+}
+
+static void
+names_release (struct CASC_Names *names)
+{
+	if (names->find)
+	{
+		CascFindClose (names->find);
+		names->find = NULL;
+	}
+
+	casc_memory_free (names->arena);
+	casc_memory_free (names->blocks);
+	casc_memory_free (names->scratch);
+
+	names->arena = NULL;
+	names->blocks = NULL;
+	names->scratch = NULL;
+	names->length = 0;
+	names->capacity = 0;
+	names->block_capacity = 0;
+	names->count = 0;
+	names->longest = 0;
+}
+
+static void
+names_put (
+	struct CASC_Names *names,
+	size_t value)
+{
+	while (value >= 0x80)
+	{
+		names->arena [names->length++] = (unsigned char) (value | 0x80);
+		value >>= 7;
+	}
+
+	names->arena [names->length++] = (unsigned char) value;
+}
+
+static size_t
+names_get (const unsigned char **cursor)
+{
+	size_t value = 0;
+	unsigned char byte;
+
+	for (int shift = 0; ; shift += 7)
+	{
+		byte = *(*cursor)++;
+		value |= (size_t) (byte & 0x7F) << shift;
+
+		if (!(byte & 0x80))
+		{
+			return value;
+		}
+	}
+}
+
+/*
+ * Decodes the name at `cursor` into `buffer`, which must hold the name
+ * preceding it.  Returns the length of the name.
+ */
+static size_t
+names_decode (
+	const unsigned char **cursor,
+	char *buffer)
+{
+	const size_t shared = names_get (cursor);
+	const size_t suffix = names_get (cursor);
+
+	memcpy (buffer + shared, *cursor, suffix);
+	buffer [shared + suffix] = '\0';
+	*cursor += suffix;
+
+	return shared + suffix;
+}
+
+static int
+names_reserve (
+	struct CASC_Names *names,
+	size_t size)
+{
+	if (names->length + size <= names->capacity)
+	{
+		return 1;
+	}
+
+	size_t capacity = names->capacity ? names->capacity : 0x10000;
+
+	while (capacity < names->length + size)
+	{
+		capacity *= 2;
+	}
+
+	unsigned char *arena =
+		casc_memory_reallocate (names->memory, names->arena, capacity);
+
+	if (!arena)
+	{
+		return 0;
+	}
+
+	names->arena = arena;
+	names->capacity = capacity;
+	return 1;
+}
+
+static int
+names_append (
+	struct CASC_Names *names,
+	const char *name,
+	size_t length)
+{
+	size_t shared = 0;
+
+	if (!names->scratch || length > names->longest)
+	{
+		char *scratch = casc_memory_reallocate (
+			names->memory, names->scratch, length + 1);
+
+		if (!scratch)
+		{
+			return 0;
+		}
+
+		names->scratch = scratch;
+		names->longest = length;
+	}
+
+	if (names->count % CASC_NAMES_BLOCK == 0)
+	{
+		const size_t block = names->count / CASC_NAMES_BLOCK;
+
+		if (block == names->block_capacity)
+		{
+			const size_t capacity = block ? block * 2 : 1024;
+			size_t *blocks = casc_memory_reallocate (names->memory,
+				names->blocks, capacity * sizeof (*blocks));
+
+			if (!blocks)
+			{
+				return 0;
+			}
+
+			names->blocks = blocks;
+			names->block_capacity = capacity;
+		}
+
+		names->blocks [block] = names->length;
+	}
+	else
+	{
+		/* The scratch buffer still holds the previous name. */
+		while (shared < length && names->scratch [shared] == name [shared])
+		{
+			shared++;
+		}
+	}
+
+	if (!names_reserve (names, 2 * NAMES_VARINT_MAXIMUM + length - shared))
+	{
+		return 0;
+	}
+
+	names_put (names, shared);
+	names_put (names, length - shared);
+	memcpy (names->arena + names->length, name + shared, length - shared);
+	names->length += length - shared;
+
+	memcpy (names->scratch + shared, name + shared, length - shared);
+	names->scratch [length] = '\0';
+	names->count++;
+
+	return 1;
+}
+
+/* Releases any spare capacity, once the list is complete. */
+static void
+names_shrink (struct CASC_Names *names)
+{
+	const size_t blocks =
+		(names->count + CASC_NAMES_BLOCK - 1) / CASC_NAMES_BLOCK;
+
+	if (names->length && names->length < names->capacity)
+	{
+		unsigned char *arena = casc_memory_reallocate (
+			names->memory, names->arena, names->length);
+
+		if (arena)
+		{
+			names->arena = arena;
+			names->capacity = names->length;
+		}
+	}
+
+	if (blocks && blocks < names->block_capacity)
+	{
+		size_t *shrunk = casc_memory_reallocate (
+			names->memory, names->blocks, blocks * sizeof (*shrunk));
+
+		if (shrunk)
+		{
+			names->blocks = shrunk;
+			names->block_capacity = blocks;
+		}
+	}
+}
+
+/*
+ * Decodes the name at (zero-based) `index` into the scratch buffer,
+ * starting from the head of its block.  Returns the length of the name.
+ */
+static size_t
+names_at (
+	struct CASC_Names *names,
+	size_t index)
+{
+	const unsigned char *cursor =
+		names->arena + names->blocks [index / CASC_NAMES_BLOCK];
+	size_t length = 0;
+
+	for (size_t position = index - index % CASC_NAMES_BLOCK;
+		position <= index; position++)
+	{
+		length = names_decode (&cursor, names->scratch);
+	}
+
+	return length;
+}
+
+/*
+ * Compares `name` against `key`, in byte order.  With `prefix`, any name
+ * starting with `key` compares as equal.
+ */
+static int
+names_compare (
+	const char *name,
+	size_t size,
+	const char *key,
+	size_t length,
+	int prefix)
+{
+	const int order = memcmp (name, key, size < length ? size : length);
+
+	if (order != 0 || size == length)
+	{
+		return order;
+	}
+
+	if (size < length)
+	{
+		return -1;
+	}
+
+	return prefix ? 0 : 1;
+}
+
+/*
+ * Returns the (zero-based) index of the first name not ordered before
+ * `key` (or, with `upper`, after it), within a sorted list.
+ */
+static size_t
+names_bound (
+	struct CASC_Names *names,
+	const char *key,
+	size_t length,
+	int prefix,
+	int upper)
+{
+	size_t low = 0;
+	size_t high = names->count;
+
+	while (low < high)
+	{
+		const size_t middle = low + (high - low) / 2;
+		const size_t size = names_at (names, middle);
+		const int order =
+			names_compare (names->scratch, size, key, length, prefix);
+
+		if (upper ? order <= 0 : order < 0)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	return low;
+}
+
+static int
+names_compare_sort (
+	const void *a,
+	const void *b)
+{
+	return strcmp (*(const char * const *) a, *(const char * const *) b);
+}
+
+/*
+ * Sorts the list in byte order, decoding every name into a temporary
+ * buffer and front coding them anew.
+ */
+static int
+names_sort_list (struct CASC_Names *names)
+{
+	struct CASC_Names sorted;
+	const unsigned char *cursor = names->arena;
+	size_t total = 0;
+	int status = 0;
+
+	memset (&sorted, 0, sizeof (sorted));
+	sorted.memory = names->memory;
+
+	for (size_t position = 0; position < names->count; position++)
+	{
+		total += names_decode (&cursor, names->scratch) + 1;
+	}
+
+	char *text = casc_memory_allocate (names->memory, total ? total : 1);
+	const char **order = casc_memory_allocate_zeroed (names->memory,
+		names->count ? names->count : 1, sizeof (*order));
+
+	if (!text || !order)
+	{
+		goto out;
+	}
+
+	cursor = names->arena;
+	total = 0;
+
+	for (size_t position = 0; position < names->count; position++)
+	{
+		const size_t length = names_decode (&cursor, names->scratch);
+
+		memcpy (text + total, names->scratch, length + 1);
+		order [position] = text + total;
+		total += length + 1;
+	}
+
+	qsort ((void *) order, names->count, sizeof (*order),
+		names_compare_sort);
+
+	for (size_t position = 0; position < names->count; position++)
+	{
+		if (!names_append (&sorted, order [position],
+			strlen (order [position])))
+		{
+			names_release (&sorted);
+			goto out;
+		}
+	}
+
+	names_shrink (&sorted);
+	names_release (names);
+	*names = sorted;
+	names->sorted = 1;
+	status = 1;
+
+out:
+	casc_memory_free (text);
+	casc_memory_free ((void *) order);
+
+	return status;
+}
+
+/**
+ * `list:__index (key)`
+ *
+ * Returns the name (`string`) at the (one-based) `key` (`number`), or
+ * `nil` should it be out of range.  The `string` is created upon each
+ * access.  Any other `key` returns the method of that name.
+ */
+static int
+names_index (lua_State *L)
+{
+	struct CASC_Names *names = names_access (L, 1);
+
+	if (lua_type (L, 2) != LUA_TNUMBER)
+	{
+		luaL_getmetatable (L, CASC_NAMES_METATABLE);
+		lua_pushvalue (L, 2);
+		lua_rawget (L, -2);
+
+		return 1;
+	}
+
+	int is_integer;
+	const lua_Integer index = lua_tointegerx (L, 2, &is_integer);
+
+	if (!is_integer || index < 1 || (lua_Unsigned) index > names->count)
+	{
+		lua_pushnil (L);
+		return 1;
+	}
+
+	const size_t length = names_at (names, (size_t) index - 1);
+	lua_pushlstring (L, names->scratch, length);
+
+	return 1;
+}
+
+/**
+ * `list:__len ()`
+ *
+ * Returns the number (`number`) of names in the list.
+ */
+static int
+names_length (lua_State *L)
+{
+	const struct CASC_Names *names = names_access (L, 1);
+
+	lua_pushinteger (L, (lua_Integer) names->count);
+	return 1;
+}
+
+/**
+ * `list:find (name)`
+ *
+ * Returns the (one-based) index (`number`) of `name` (`string`) within
+ * the list, or `nil` should it be absent.  A sorted list is searched by
+ * bisection, while an unsorted one is scanned in full.
+ */
+static int
+names_find (lua_State *L)
+{
+	struct CASC_Names *names = names_access (L, 1);
+	size_t length;
+	const char *name = luaL_checklstring (L, 2, &length);
+
+	if (names->sorted)
+	{
+		const size_t index = names_bound (names, name, length, 0, 0);
+
+		if (index < names->count
+			&& names_at (names, index) == length
+			&& memcmp (names->scratch, name, length) == 0)
+		{
+			lua_pushinteger (L, (lua_Integer) index + 1);
+			return 1;
+		}
+	}
+	else
+	{
+		const unsigned char *cursor = names->arena;
+
+		for (size_t index = 0; index < names->count; index++)
+		{
+			if (names_decode (&cursor, names->scratch) == length
+				&& memcmp (names->scratch, name, length) == 0)
+			{
+				lua_pushinteger (L, (lua_Integer) index + 1);
+				return 1;
+			}
+		}
+	}
+
+	lua_pushnil (L);
+	return 1;
+}
+
+/**
+ * `list:sort ()`
+ *
+ * Sorts the list in byte order, should it not already be sorted.
+ *
+ * Returns the list.  In case of error, returns `nil`, a `string`
+ * describing the error, and a `number` indicating the error code.
+ */
+static int
+names_sort (lua_State *L)
+{
+	struct CASC_Names *names = names_access (L, 1);
+
+	if (!names->sorted && !names_sort_list (names))
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		return casc_result (L, 0);
+	}
+
+	lua_settop (L, 1);
+	return 1;
+}
+
+/**
+ * `list:range (prefix)`
+ *
+ * Returns the (one-based) indices (`number`) of the first and last names
+ * starting with `prefix` (`string`), or `nil` should there be none.  The
+ * list must be sorted (see `list:sort ()`).
+ *
+ * In case of errors this function raises the error, instead of returning an
+ * error code.
+ */
+static int
+names_range (lua_State *L)
+{
+	struct CASC_Names *names = names_access (L, 1);
+	size_t length;
+	const char *prefix = luaL_checklstring (L, 2, &length);
+
+	if (!names->sorted)
+	{
+		return luaL_error (L, "name list is not sorted");
+	}
+
+	const size_t first = names_bound (names, prefix, length, 1, 0);
+	const size_t last = names_bound (names, prefix, length, 1, 1);
+
+	if (first == last)
+	{
+		lua_pushnil (L);
+		return 1;
+	}
+
+	lua_pushinteger (L, (lua_Integer) first + 1);
+	lua_pushinteger (L, (lua_Integer) last);
+	return 2;
+}
+
+/**
+ * `list:__tostring ()`
+ *
+ * Returns a `string` representation of the `Casc NameList` object.
+ */
+static int
+names_to_string (lua_State *L)
+{
+	const struct CASC_Names *names = names_access (L, 1);
+
+	lua_pushfstring (L, "%s (%p)", CASC_NAMES_METATABLE, names);
+	return 1;
+}
+
+static int
+names_gc (lua_State *L)
+{
+	names_release (names_access (L, 1));
+	return 0;
+}
+
+static const luaL_Reg
+names_methods [] =
+{
+	{ "find", names_find },
+	{ "sort", names_sort },
+	{ "range", names_range },
+	{ "__index", names_index },
+	{ "__len", names_length },
+	{ "__tostring", names_to_string },
+	{ "__gc", names_gc },
+	{ NULL, NULL }
+};
+
+static void
+names_metatable (lua_State *L)
+{
+	if (luaL_newmetatable (L, CASC_NAMES_METATABLE))
+	{
+		luaL_setfuncs (L, names_methods, 0);
+	}
+
+	lua_setmetatable (L, -2);
+}
+
+/*
+ * Enumerates the files of `storage` matching `pattern` into a new name
+ * list, in the order provided by CascLib.
+ */
+extern int
+casc_names_initialize (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	const char *pattern,
+	const int plain)
+{
+	struct CASC_Names *names = lua_newuserdata (L, sizeof (*names));
+	memset (names, 0, sizeof (*names));
+	names->memory = storage->memory;
+	names_metatable (L);
+
+	CASC_FIND_DATA data;
+	int status;
+
+	SetCascError (ERROR_SUCCESS);
+	names->find = CascFindFirstFile (storage->handle, "*", &data, NULL);
+
+	for (status = !!names->find; status;
+		status = CascFindNextFile (names->find, &data))
+	{
+		if (!casc_finder_match (L, data.szFileName, pattern, plain))
+		{
+			continue;
+		}
+
+		if (!names_append (names, data.szFileName,
+			strlen (data.szFileName)))
+		{
+			SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+			break;
+		}
+	}
+
+	const DWORD error = GetCascError ();
+
+	if (names->find)
+	{
+		CascFindClose (names->find);
+		names->find = NULL;
+	}
+
+	if (error != ERROR_SUCCESS)
+	{
+		names_release (names);
+		SetCascError (error);
+
+		return casc_result (L, 0);
+	}
+
+	names_shrink (names);
+	return 1;
+}
@@ -0,0 +1,52 @@
+#ifndef CASC_NAMES_H
+#define CASC_NAMES_H
+
+#include <CascLib.h>
+#include <CascPort.h>
+#include <lua.h>
+#include <stddef.h>
+
+struct CASC_Memory;
+struct CASC_Storage;
+
+/*
+ * A list of file names, front coded within a single arena.  Names are
+ * grouped into blocks of `CASC_NAMES_BLOCK`, each starting at the offset
+ * held by `blocks`.  Every name is stored as the length of the prefix it
+ * shares with the previous name, the length of the remaining suffix (both
+ * as variable length integers), and the suffix itself.  The first name of
+ * a block shares nothing, so that any name can be decoded by starting from
+ * its block.
+ */
+struct CASC_Names
+{
+	unsigned char *arena;
+	size_t length;
+	size_t capacity;
+
+	size_t *blocks;
+	size_t block_capacity;
+	size_t count;
+
+	/* The last decoded name, at least as large as the longest name. */
+	char *scratch;
+	size_t longest;
+
+	/* The search handle, while enumerating. */
+	HANDLE find;
+
+	struct CASC_Memory *memory;
+
+	int sorted;
+};
+
+#define CASC_NAMES_BLOCK 16
+
+extern int
+casc_names_initialize (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	const char *pattern,
+	const int plain);
+
+#endif
@@ -0,0 +1,786 @@
+#include "overlay.h"
+#include "common.h"
+#include "finder.h"
+#include "index.h"
+#include "memory.h"
+#include "storage.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <compat-5.3.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined (_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#define CASC_OVERLAY_METATABLE "Casc Overlay"
+
+#define OVERLAY_PATH_MAXIMUM 4096
+
+/*
+ * Normalizes `name` into `buffer`, such that names differing only in case
+ * or in their separators (any of `/`, `\`, or `:`) are the same.  Returns
+ * `0` if the result does not fit.
+ */
+static int
+overlay_normalize (
+	const char *name,
+	char *buffer,
+	size_t size)
+{
+	size_t length = 0;
+
+	for (; *name; name++)
+	{
+		char character = *name;
+
+		if (length + 1 >= size)
+		{
+			return 0;
+		}
+
+		if (character == '\\' || character == ':')
+		{
+			character = '/';
+		}
+		else if (character >= 'A' && character <= 'Z')
+		{
+			character = (char) (character - 'A' + 'a');
+		}
+
+		buffer [length++] = character;
+	}
+
+	buffer [length] = '\0';
+	return 1;
+}
+
+static struct CASC_Index_Entry *
+overlay_find (
+	const struct CASC_Overlay *overlay,
+	const char *name)
+{
+	char key [OVERLAY_PATH_MAXIMUM];
+
+	if (!overlay_normalize (name, key, sizeof (key)))
+	{
+		return NULL;
+	}
+
+	return casc_index_find (&overlay->index, key);
+}
+
+static const char *
+overlay_path (
+	const struct CASC_Overlay *overlay,
+	const struct CASC_Index_Entry *entry)
+{
+	return overlay->paths [entry - overlay->index.entries].path;
+}
+
+/*
+ * Adds the file at `path` (whose name starts at `offset`) to the index,
+ * unless a file of the same name was added by a previous layer.
+ */
+static int
+overlay_add (
+	struct CASC_Overlay *overlay,
+	int layer,
+	const char *path,
+	size_t offset,
+	ULONGLONG size)
+{
+	char key [OVERLAY_PATH_MAXIMUM];
+
+	if (!overlay_normalize (path + offset, key, sizeof (key)))
+	{
+		SetCascError (ERROR_BUFFER_OVERFLOW);
+		return 0;
+	}
+
+	struct CASC_Index_Entry *entry =
+		casc_index_insert (&overlay->index, key);
+
+	if (!entry)
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		return 0;
+	}
+
+	if (entry->mark)
+	{
+		return 1;
+	}
+
+	entry->mark = layer;
+	entry->size = size;
+
+	if (overlay->index.count > overlay->capacity)
+	{
+		const size_t capacity = overlay->capacity
+			? overlay->capacity * 2 : 256;
+		struct CASC_Overlay_Path *paths = casc_memory_reallocate (
+			NULL, overlay->paths, capacity * sizeof (*paths));
+
+		if (!paths)
+		{
+			SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+			return 0;
+		}
+
+		overlay->paths = paths;
+		overlay->capacity = capacity;
+	}
+
+	struct CASC_Overlay_Path *copy =
+		&overlay->paths [overlay->index.count - 1];
+	const size_t length = strlen (path);
+
+	copy->offset = offset;
+	copy->path = casc_memory_allocate (NULL, length + 1);
+
+	if (!copy->path)
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		return 0;
+	}
+
+	memcpy (copy->path, path, length + 1);
+	return 1;
+}
+
+/*
+ * Recursively adds the files of the directory `path`, which is `length`
+ * bytes long, and is modified (but restored) in doing so.
+ */
+static int
+overlay_scan (
+	struct CASC_Overlay *overlay,
+	int layer,
+	char *path,
+	size_t length,
+	size_t offset)
+{
+	int status = 1;
+
+#if defined (_WIN32)
+	WIN32_FIND_DATAA data;
+
+	if (length + 3 > OVERLAY_PATH_MAXIMUM)
+	{
+		SetCascError (ERROR_BUFFER_OVERFLOW);
+		return 0;
+	}
+
+	memcpy (path + length, "\\*", 3);
+	HANDLE find = FindFirstFileA (path, &data);
+	path [length] = '\0';
+
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		SetCascError (ERROR_FILE_NOT_FOUND);
+		return 0;
+	}
+
+	do
+	{
+		const char *name = data.cFileName;
+#else
+	DIR *directory = opendir (path);
+	struct dirent *data;
+
+	if (!directory)
+	{
+		SetCascError (ERROR_FILE_NOT_FOUND);
+		return 0;
+	}
+
+	while (status && (data = readdir (directory)))
+	{
+		const char *name = data->d_name;
+#endif
+		const size_t size = strlen (name);
+
+		if (strcmp (name, ".") == 0 || strcmp (name, "..") == 0)
+		{
+			continue;
+		}
+
+		if (length + size + 2 > OVERLAY_PATH_MAXIMUM)
+		{
+			SetCascError (ERROR_BUFFER_OVERFLOW);
+			status = 0;
+			break;
+		}
+
+		path [length] = '/';
+		memcpy (path + length + 1, name, size + 1);
+
+#if defined (_WIN32)
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			status = overlay_scan (
+				overlay, layer, path, length + size + 1, offset);
+		}
+		else
+		{
+			status = overlay_add (overlay, layer, path, offset,
+				(ULONGLONG) data.nFileSizeHigh << 32 | data.nFileSizeLow);
+		}
+#else
+		struct stat information;
+
+		if (stat (path, &information) != 0)
+		{
+			/* E.g. a dangling link. */
+		}
+		else if (S_ISDIR (information.st_mode))
+		{
+			status = overlay_scan (
+				overlay, layer, path, length + size + 1, offset);
+		}
+		else if (S_ISREG (information.st_mode))
+		{
+			status = overlay_add (overlay, layer, path, offset,
+				(ULONGLONG) information.st_size);
+		}
+#endif
+
+		path [length] = '\0';
+	}
+#if defined (_WIN32)
+	while (status && FindNextFileA (find, &data));
+
+	FindClose (find);
+#else
+
+	closedir (directory);
+#endif
+
+	return status;
+}
+
+static struct CASC_Overlay *
+overlay_access (
+	lua_State *L,
+	int index)
+{
+	return luaL_checkudata (L, index, CASC_OVERLAY_METATABLE);
+}
+
+static void
+overlay_release (struct CASC_Overlay *overlay)
+{
+	for (size_t position = 0; position < overlay->index.count; position++)
+	{
+		if (position < overlay->capacity)
+		{
+			casc_memory_free (overlay->paths [position].path);
+		}
+	}
+
+	casc_memory_free (overlay->paths);
+	overlay->paths = NULL;
+	overlay->capacity = 0;
+
+	casc_index_release (&overlay->index);
+	overlay->open = 0;
+}
+
+/*
+ * Calls `casc:open ()` on each storage layer from `first` to `last` in
+ * turn, with the arguments of the calling function (from `2` to
+ * `arguments`), returning the results of the first success, or of the last
+ * failure (none if no storage was tried).
+ */
+static int
+overlay_open_storages (
+	lua_State *L,
+	int arguments,
+	int first,
+	int last)
+{
+	lua_getuservalue (L, 1);
+	const int layers = lua_gettop (L);
+	int results = 0;
+
+	for (int layer = first; layer <= last; layer++)
+	{
+		lua_rawgeti (L, layers, layer);
+		const int storage = !!casc_storage_test (L, -1);
+		lua_pop (L, 1);
+
+		if (!storage)
+		{
+			continue;
+		}
+
+		/* Only then are the results of the previous storage discarded. */
+		lua_settop (L, layers);
+		lua_rawgeti (L, layers, layer);
+
+		lua_getfield (L, -1, "open");
+		lua_insert (L, -2);
+
+		for (int index = 2; index <= arguments; index++)
+		{
+			lua_pushvalue (L, index);
+		}
+
+		lua_call (L, arguments, LUA_MULTRET);
+		results = lua_gettop (L) - layers;
+
+		if (results > 0 && lua_toboolean (L, layers + 1))
+		{
+			break;
+		}
+	}
+
+	return results;
+}
+
+/**
+ * `overlay:open (name [, ...])`
+ *
+ * Opens the file specified by `name` (`string`) from the first layer that
+ * has it, trying the layers in order.  Files of directory layers are found
+ * through the index, and are opened as per `io.open ()`, in binary mode.
+ * Storage layers are tried as per `casc:open ()`, to which any additional
+ * arguments are passed.
+ *
+ * Names are matched regardless of case, and of their separators (any of
+ * `/`, `\\`, or `:`).
+ *
+ * Returns the opened file, being either a Lua `file` or a `Casc File`
+ * object, both of which support `read`, `seek`, `lines`, and `close`.  In
+ * case of error, returns `nil`, a `string` describing the error, and a
+ * `number` indicating the error code.
+ */
+static int
+overlay_open (lua_State *L)
+{
+	const struct CASC_Overlay *overlay = overlay_access (L, 1);
+	const char *name = luaL_checkstring (L, 2);
+	const int arguments = lua_gettop (L);
+
+	if (!overlay->open)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		return casc_result (L, 0);
+	}
+
+	/* Only the storages preceding the directory providing it, if any. */
+	const struct CASC_Index_Entry *entry = overlay_find (overlay, name);
+	const int last = entry ? entry->mark - 1 : overlay->layers;
+	const int results =
+		overlay_open_storages (L, arguments, 1, last);
+
+	if (results > 0 && lua_toboolean (L, -results))
+	{
+		return results;
+	}
+
+	if (!entry)
+	{
+		if (results == 0)
+		{
+			SetCascError (ERROR_FILE_NOT_FOUND);
+			return casc_result (L, 0);
+		}
+
+		return results;
+	}
+
+	lua_settop (L, arguments);
+	lua_getglobal (L, "io");
+	lua_getfield (L, -1, "open");
+	lua_remove (L, -2);
+
+	lua_pushstring (L, overlay_path (overlay, entry));
+	lua_pushliteral (L, "rb");
+	lua_call (L, 2, LUA_MULTRET);
+
+	return lua_gettop (L) - arguments;
+}
+
+/**
+ * `overlay:readfile (name)`
+ *
+ * Returns the entire contents (`string`) of the file specified by `name`
+ * (`string`), resolved as per `overlay:open ()`.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+overlay_readfile (lua_State *L)
+{
+	lua_settop (L, 2);
+	luaL_checkstring (L, 2);
+
+	const int results = overlay_open (L);
+	const int file = lua_gettop (L) - results + 1;
+
+	if (!lua_toboolean (L, file))
+	{
+		return results;
+	}
+
+	lua_settop (L, file);
+
+	lua_getfield (L, file, "read");
+	lua_pushvalue (L, file);
+	lua_pushliteral (L, "a");
+	lua_call (L, 2, 3);
+
+	lua_getfield (L, file, "close");
+	lua_pushvalue (L, file);
+	lua_call (L, 1, 0);
+
+	if (lua_isnil (L, file + 1))
+	{
+		return 3;
+	}
+
+	lua_settop (L, file + 1);
+	return 1;
+}
+
+/*
+ * Whether the file `key` (a normalized name) was provided by a storage
+ * layer preceding `layer`, as recorded in the table of the iterator.  If
+ * not, and `record` is set, records it as provided by `layer`, so as to
+ * hide it from any layer that follows.
+ */
+static int
+files_hidden (
+	lua_State *L,
+	const struct CASC_Overlay *overlay,
+	const char *key,
+	lua_Integer layer,
+	int record)
+{
+	lua_getfield (L, lua_upvalueindex (8), key);
+	const lua_Integer seen = lua_tointeger (L, -1);
+	lua_pop (L, 1);
+
+	if (seen && seen < layer)
+	{
+		return 1;
+	}
+
+	if (record && layer < overlay->layers)
+	{
+		lua_pushinteger (L, layer);
+		lua_setfield (L, lua_upvalueindex (8), key);
+	}
+
+	return 0;
+}
+
+/*
+ * Pushes the next file name of the directory `layer`, whose files are
+ * contiguous within the index (as the layers are scanned in order),
+ * returning `0` once there is none left.
+ */
+static int
+files_directory (
+	lua_State *L,
+	const struct CASC_Overlay *overlay,
+	lua_Integer layer,
+	const char *pattern,
+	const int plain)
+{
+	size_t position = (size_t) lua_tointeger (L, lua_upvalueindex (4));
+	int found = 0;
+
+	while (!found && position < overlay->index.count
+		&& overlay->index.entries [position].mark == layer)
+	{
+		const struct CASC_Overlay_Path *path = &overlay->paths [position];
+		const char *name = path->path + path->offset;
+
+		found = casc_finder_match (L, name, pattern, plain)
+			&& !files_hidden (L, overlay,
+				overlay->index.entries [position].name, layer, 0);
+		position++;
+
+		if (found)
+		{
+			lua_pushstring (L, name);
+		}
+	}
+
+	lua_pushinteger (L, (lua_Integer) position);
+	lua_replace (L, lua_upvalueindex (4));
+	return found;
+}
+
+static int
+files_iterator (lua_State *L)
+{
+	const struct CASC_Overlay *overlay =
+		overlay_access (L, lua_upvalueindex (1));
+	const char *pattern = luaL_optstring (L, lua_upvalueindex (2), NULL);
+	const int plain = lua_toboolean (L, lua_upvalueindex (3));
+	lua_Integer layer = lua_tointeger (L, lua_upvalueindex (5));
+
+	if (!overlay->open)
+	{
+		return luaL_error (L, "%s", strerror (ERROR_INVALID_HANDLE));
+	}
+
+	while (layer <= overlay->layers)
+	{
+		if (lua_isnil (L, lua_upvalueindex (6)))
+		{
+			lua_rawgeti (L, lua_upvalueindex (7), (int) layer);
+
+			if (!casc_storage_test (L, -1))
+			{
+				lua_pop (L, 1);
+
+				if (files_directory (L, overlay, layer, pattern, plain))
+				{
+					break;
+				}
+
+				layer++;
+				continue;
+			}
+
+			lua_getfield (L, -1, "files");
+			lua_insert (L, -2);
+			lua_pushvalue (L, lua_upvalueindex (2));
+			lua_pushvalue (L, lua_upvalueindex (3));
+			lua_call (L, 3, 2);
+
+			if (lua_isnil (L, -2))
+			{
+				return luaL_error (L, "%s", lua_tostring (L, -1));
+			}
+
+			lua_pop (L, 1);
+			lua_replace (L, lua_upvalueindex (6));
+		}
+
+		lua_pushvalue (L, lua_upvalueindex (6));
+		lua_call (L, 0, 1);
+
+		if (lua_isnil (L, -1))
+		{
+			lua_pop (L, 1);
+			lua_pushnil (L);
+			lua_replace (L, lua_upvalueindex (6));
+			layer++;
+			continue;
+		}
+
+		/* A name provided by an earlier layer hides those that follow. */
+		const char *name = lua_tostring (L, -1);
+		const struct CASC_Index_Entry *entry = overlay_find (overlay, name);
+		char key [OVERLAY_PATH_MAXIMUM];
+
+		if ((entry && entry->mark < layer)
+			|| (overlay_normalize (name, key, sizeof (key))
+				&& files_hidden (L, overlay, key, layer, 1)))
+		{
+			lua_pop (L, 1);
+			continue;
+		}
+
+		break;
+	}
+
+	lua_pushinteger (L, layer);
+	lua_replace (L, lua_upvalueindex (5));
+	return layer <= overlay->layers;
+}
+
+/**
+ * `overlay:files ([pattern [, plain]])`
+ *
+ * Returns an iterator `function` that, each time it is called, returns the
+ * next file name (`string`) of the overlay matching `pattern`, as per
+ * `casc:files ()`.  The layers are enumerated in order, the files of
+ * directory layers being named relative to their directory, skipping any
+ * name hidden by a previous layer.
+ *
+ * In case of errors this function raises the error, instead of returning an
+ * error code.
+ */
+static int
+overlay_files (lua_State *L)
+{
+	const struct CASC_Overlay *overlay = overlay_access (L, 1);
+	luaL_optstring (L, 2, NULL);
+
+	if (!overlay->open)
+	{
+		return luaL_error (L, "%s", strerror (ERROR_INVALID_HANDLE));
+	}
+
+	lua_settop (L, 3);
+	lua_pushinteger (L, 0);
+	lua_pushinteger (L, 1);
+	lua_pushnil (L);
+	lua_getuservalue (L, 1);
+	lua_newtable (L);
+	lua_pushcclosure (L, files_iterator, 8);
+
+	return 1;
+}
+
+/**
+ * `overlay:close ()`
+ *
+ * Closes the `overlay`, releasing its index.  The storages it layers over
+ * are left open.
+ *
+ * Returns `true` on success.  In case of error, returns `nil`, a `string`
+ * describing the error, and a `number` indicating the error code.
+ */
+static int
+overlay_close (lua_State *L)
+{
+	struct CASC_Overlay *overlay = overlay_access (L, 1);
+
+	if (!overlay->open)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		return casc_result (L, 0);
+	}
+
+	overlay_release (overlay);
+	return casc_result (L, 1);
+}
+
+static int
+overlay_gc (lua_State *L)
+{
+	struct CASC_Overlay *overlay = overlay_access (L, 1);
+
+	if (overlay->open)
+	{
+		overlay_release (overlay);
+	}
+
+	return 0;
+}
+
+/**
+ * `overlay:__tostring ()`
+ *
+ * Returns a `string` representation of the `Casc Overlay` object,
+ * indicating whether it is closed.
+ */
+static int
+overlay_to_string (lua_State *L)
+{
+	const struct CASC_Overlay *overlay = overlay_access (L, 1);
+	const char *text = !overlay->open ? "%s (%p) (Closed)" : "%s (%p)";
+
+	lua_pushfstring (L, text, CASC_OVERLAY_METATABLE, overlay);
+	return 1;
+}
+
+static const luaL_Reg
+overlay_methods [] =
+{
+	{ "open", overlay_open },
+	{ "readfile", overlay_readfile },
+	{ "files", overlay_files },
+	{ "close", overlay_close },
+	{ "__tostring", overlay_to_string },
+	{ "__gc", overlay_gc },
+	{ NULL, NULL }
+};
+
+static void
+overlay_metatable (lua_State *L)
+{
+	if (luaL_newmetatable (L, CASC_OVERLAY_METATABLE))
+	{
+		luaL_setfuncs (L, overlay_methods, 0);
+		lua_pushvalue (L, -1);
+		lua_setfield (L, -2, "__index");
+	}
+
+	lua_setmetatable (L, -2);
+}
+
+/*
+ * Creates an overlay of the layers (a sequence of directories and storages)
+ * at `index`, scanning every directory up front.
+ */
+extern int
+casc_overlay_initialize (
+	lua_State *L,
+	int index)
+{
+	index = lua_absindex (L, index);
+	luaL_checktype (L, index, LUA_TTABLE);
+
+	const int layers = (int) lua_rawlen (L, index);
+	char path [OVERLAY_PATH_MAXIMUM];
+
+	struct CASC_Overlay *overlay = lua_newuserdata (L, sizeof (*overlay));
+	casc_index_initialize (&overlay->index, NULL);
+	overlay->paths = NULL;
+	overlay->capacity = 0;
+	overlay->layers = layers;
+	overlay->open = 1;
+	overlay_metatable (L);
+
+	/* Keep the storages alive for as long as the overlay. */
+	lua_createtable (L, layers, 0);
+
+	for (int layer = 1; layer <= layers; layer++)
+	{
+		lua_rawgeti (L, index, layer);
+
+		if (casc_storage_test (L, -1))
+		{
+			/* Opened through the storage itself. */
+		}
+		else if (lua_type (L, -1) == LUA_TSTRING)
+		{
+			size_t length;
+			const char *directory = lua_tolstring (L, -1, &length);
+
+			if (length + 1 >= sizeof (path))
+			{
+				SetCascError (ERROR_BUFFER_OVERFLOW);
+				goto error;
+			}
+
+			memcpy (path, directory, length + 1);
+
+			if (!overlay_scan (overlay, layer, path, length, length + 1))
+			{
+				goto error;
+			}
+		}
+		else
+		{
+			return luaL_error (L,
+				"layer %d is neither a directory nor a storage", layer);
+		}
+
+		lua_rawseti (L, -2, layer);
+	}
+
+	lua_setuservalue (L, -2);
+	return 1;
+
+error:
+	overlay_release (overlay);
+	return casc_result (L, 0);
+}
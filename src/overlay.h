@@ -0,0 +1,38 @@
+#ifndef CASC_OVERLAY_H
+#define CASC_OVERLAY_H
+
+#include "index.h"
+#include <lua.h>
+#include <stddef.h>
+
+struct CASC_Overlay_Path
+{
+	/* The full path of the file on disk. */
+	char *path;
+
+	/* Where, within `path`, the name relative to its directory starts. */
+	size_t offset;
+};
+
+/*
+ * Local directories layered over storages.  The files of all directories
+ * are held by `index`, keyed by their normalized name, with the `mark` of
+ * each entry being the (one-based) layer providing it.  The `paths` are in
+ * the same order as the entries of the index.
+ */
+struct CASC_Overlay
+{
+	struct CASC_Index index;
+	struct CASC_Overlay_Path *paths;
+	size_t capacity;
+
+	int layers;
+	int open;
+};
+
+extern int
+casc_overlay_initialize (
+	lua_State *L,
+	int index);
+
+#endif
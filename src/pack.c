@@ -0,0 +1,1069 @@
+#include "pack.h"
+#include "common.h"
+#include "file.h"
+#include "finder.h"
+#include "index.h"
+#include "memory.h"
+#include "registry.h"
+#include "storage.h"
+#include "trace.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <compat-5.3.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#define CASC_PACK_METATABLE "Casc Pack"
+#define CASC_PACK_WRITER_METATABLE "Casc Pack Writer"
+
+/*
+ * A pack holds, in order, all little endian:
+ *
+ * - A header: the magic, a 32-bit version, and 32 reserved bits.
+ * - The decoded data of every file, each aligned to `PACK_ALIGNMENT`.
+ * - The records, sorted by hash: the 64-bit hash of the name, offset and
+ *   size of the data, then the 32-bit offset and length of the name.
+ * - The names, each terminated by a `NUL`.
+ * - A trailer: the 64-bit number of records, offset of the records,
+ *   offset and size of the names, then the magic.
+ *
+ * Having the trailer at the end allows the pack to be written in a single
+ * pass, without knowing the number of files beforehand.
+ */
+#define PACK_MAGIC "CASCPACK"
+#define PACK_MAGIC_SIZE 8
+#define PACK_VERSION 1
+#define PACK_HEADER_SIZE 16
+#define PACK_RECORD_SIZE 32
+#define PACK_TRAILER_SIZE 40
+#define PACK_ALIGNMENT 8
+
+#define PACK_BUFFER_SIZE 0x10000
+#define PACK_PATH_MAXIMUM 4096
+
+/* The mark of the entries which made it into the pack. */
+#define PACK_WRITTEN 1
+
+struct CASC_Pack_Record
+{
+	ULONGLONG hash;
+	ULONGLONG offset;
+	ULONGLONG size;
+	DWORD name;
+	DWORD length;
+};
+
+struct CASC_Pack_Item
+{
+	struct CASC_Finder_Entry location;
+	struct CASC_Index_Entry *entry;
+};
+
+/*
+ * The state is held within a userdata so that everything is released by
+ * the garbage collector, even when an error is raised midway.
+ */
+struct CASC_Pack_Writer
+{
+	struct CASC_Index index;
+
+	struct CASC_Pack_Item *items;
+	struct CASC_Pack_Record *records;
+	size_t count;
+
+	BYTE *buffer;
+	HANDLE find;
+
+	/* The temporary file being written, moved into place once complete. */
+	FILE *stream;
+	char path [PACK_PATH_MAXIMUM];
+	ULONGLONG offset;
+};
+
+/*
+ * Folds `character` such that names differing only in case or in their
+ * separators (either of `/` and `\`) are the same, as within CascLib.
+ */
+static unsigned char
+pack_fold (unsigned char character)
+{
+	if (character == '/')
+	{
+		return '\\';
+	}
+
+	if (character >= 'A' && character <= 'Z')
+	{
+		return (unsigned char) (character - 'A' + 'a');
+	}
+
+	return character;
+}
+
+/* Hashes the folded `name`, using 64-bit FNV-1a. */
+static ULONGLONG
+pack_hash (const char *name)
+{
+	ULONGLONG hash = 0xCBF29CE484222325ULL;
+
+	for (; *name; name++)
+	{
+		hash ^= pack_fold ((unsigned char) *name);
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+static int
+pack_same (
+	const char *left,
+	const char *right)
+{
+	for (; *left && *right; left++, right++)
+	{
+		if (pack_fold ((unsigned char) *left)
+			!= pack_fold ((unsigned char) *right))
+		{
+			return 0;
+		}
+	}
+
+	return *left == *right;
+}
+
+static void
+pack_encode (
+	BYTE *output,
+	ULONGLONG value,
+	size_t size)
+{
+	for (size_t index = 0; index < size; index++)
+	{
+		output [index] = (BYTE) (value >> (index * 8));
+	}
+}
+
+static ULONGLONG
+pack_decode (
+	const BYTE *input,
+	size_t size)
+{
+	ULONGLONG value = 0;
+
+	for (size_t index = size; index > 0; index--)
+	{
+		value = value << 8 | input [index - 1];
+	}
+
+	return value;
+}
+
+static void
+writer_release (struct CASC_Pack_Writer *writer)
+{
+	if (writer->find)
+	{
+		CascFindClose (writer->find);
+		writer->find = NULL;
+	}
+
+	/* An incomplete pack is never left behind. */
+	if (writer->stream)
+	{
+		fclose (writer->stream);
+		writer->stream = NULL;
+		remove (writer->path);
+	}
+
+	casc_index_release (&writer->index);
+
+	casc_memory_free (writer->items);
+	writer->items = NULL;
+
+	casc_memory_free (writer->records);
+	writer->records = NULL;
+
+	casc_memory_free (writer->buffer);
+	writer->buffer = NULL;
+}
+
+static int
+writer_close (lua_State *L)
+{
+	writer_release (luaL_checkudata (L, 1, CASC_PACK_WRITER_METATABLE));
+	return 0;
+}
+
+static void
+writer_metatable (lua_State *L)
+{
+	if (luaL_newmetatable (L, CASC_PACK_WRITER_METATABLE))
+	{
+		lua_pushcfunction (L, writer_close);
+		lua_setfield (L, -2, "__gc");
+	}
+
+	lua_setmetatable (L, -2);
+}
+
+/*
+ * Appends `size` bytes of `data` to the pack.  A failure is reported by
+ * the error indicator of the stream.
+ */
+static void
+writer_emit (
+	struct CASC_Pack_Writer *writer,
+	const void *data,
+	size_t size)
+{
+	writer->offset += fwrite (data, 1, size, writer->stream);
+}
+
+static void
+writer_align (struct CASC_Pack_Writer *writer)
+{
+	static const BYTE padding [PACK_ALIGNMENT] = { 0 };
+	const size_t remainder = (size_t) (writer->offset % PACK_ALIGNMENT);
+
+	if (remainder)
+	{
+		writer_emit (writer, padding, PACK_ALIGNMENT - remainder);
+	}
+}
+
+/*
+ * Decodes `entry` into the pack, filling in `record` aside from its name.
+ * Should the file fail midway, what was written of it remains unused
+ * within the pack.
+ */
+static DWORD
+writer_copy (
+	struct CASC_Pack_Writer *writer,
+	const struct CASC_Storage *storage,
+	const struct CASC_Index_Entry *entry,
+	struct CASC_Pack_Record *record)
+{
+	HANDLE handle;
+	DWORD bytes_read;
+	DWORD error = ERROR_SUCCESS;
+
+	writer_align (writer);
+	record->hash = pack_hash (entry->name);
+	record->offset = writer->offset;
+
+	if (!CascOpenFile (storage->handle, entry->name, 0, 0, &handle))
+	{
+		return GetCascError ();
+	}
+
+	while (!ferror (writer->stream))
+	{
+		if (!CascReadFile (handle, writer->buffer,
+			PACK_BUFFER_SIZE, &bytes_read))
+		{
+			error = GetCascError ();
+			break;
+		}
+
+		if (bytes_read == 0)
+		{
+			break;
+		}
+
+		writer_emit (writer, writer->buffer, bytes_read);
+	}
+
+	CascCloseFile (handle);
+	record->size = writer->offset - record->offset;
+	return error;
+}
+
+static int
+writer_compare_item (
+	const void *a,
+	const void *b)
+{
+	const struct CASC_Pack_Item *left = a;
+	const struct CASC_Pack_Item *right = b;
+
+	return casc_finder_compare_location (&left->location, &right->location);
+}
+
+static int
+writer_compare_record (
+	const void *a,
+	const void *b)
+{
+	const struct CASC_Pack_Record *left = a;
+	const struct CASC_Pack_Record *right = b;
+
+	if (left->hash != right->hash)
+	{
+		return left->hash < right->hash ? -1 : 1;
+	}
+
+	return (left->offset > right->offset) - (left->offset < right->offset);
+}
+
+/*
+ * Gathers the files to pack into the index of `writer`, either from the
+ * sequence of names at `names`, in the given order, or by enumerating
+ * those matching the pattern at `names`, in the order of the data.
+ */
+static int
+writer_gather (
+	lua_State *L,
+	struct CASC_Pack_Writer *writer,
+	const struct CASC_Storage *storage,
+	int names,
+	const int plain)
+{
+	const int listed = lua_istable (L, names);
+
+	if (listed)
+	{
+		const size_t count = (size_t) lua_rawlen (L, names);
+
+		for (size_t index = 1; index <= count; index++)
+		{
+			lua_rawgeti (L, names, (lua_Integer) index);
+			const char *name = lua_tostring (L, -1);
+
+			if (!name)
+			{
+				luaL_argerror (L, names, "must only contain strings");
+			}
+
+			const int status = !!casc_index_insert (&writer->index, name);
+			lua_pop (L, 1);
+
+			if (!status)
+			{
+				SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+				return 0;
+			}
+		}
+	}
+	else if (!casc_index_gather (L, &writer->index, storage,
+		&writer->find, lua_tostring (L, names), plain))
+	{
+		return 0;
+	}
+
+	const size_t count = writer->index.count ? writer->index.count : 1;
+
+	writer->items = casc_memory_allocate_zeroed (
+		storage->memory, count, sizeof (*writer->items));
+	writer->records = casc_memory_allocate_zeroed (
+		storage->memory, count, sizeof (*writer->records));
+
+	if (!writer->items || !writer->records)
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		return 0;
+	}
+
+	for (size_t index = 0; index < writer->index.count; index++)
+	{
+		struct CASC_Pack_Item *item = &writer->items [index];
+		item->entry = &writer->index.entries [index];
+
+		if (!listed)
+		{
+			casc_finder_locate (storage, item->entry->ekey,
+				&item->location.archive, &item->location.offset);
+		}
+	}
+
+	if (!listed)
+	{
+		qsort (writer->items, writer->index.count,
+			sizeof (*writer->items), writer_compare_item);
+	}
+
+	return 1;
+}
+
+/* Writes the records, names, and trailer that follow the data. */
+static void
+writer_finish (struct CASC_Pack_Writer *writer)
+{
+	BYTE bytes [PACK_TRAILER_SIZE];
+
+	writer_align (writer);
+	const ULONGLONG records = writer->offset;
+
+	qsort (writer->records, writer->count,
+		sizeof (*writer->records), writer_compare_record);
+
+	for (size_t index = 0; index < writer->count; index++)
+	{
+		const struct CASC_Pack_Record *record = &writer->records [index];
+
+		pack_encode (bytes, record->hash, 8);
+		pack_encode (bytes + 8, record->offset, 8);
+		pack_encode (bytes + 16, record->size, 8);
+		pack_encode (bytes + 24, record->name, 4);
+		pack_encode (bytes + 28, record->length, 4);
+		writer_emit (writer, bytes, PACK_RECORD_SIZE);
+	}
+
+	const ULONGLONG names = writer->offset;
+
+	for (size_t index = 0; index < writer->index.count; index++)
+	{
+		const struct CASC_Index_Entry *entry = writer->items [index].entry;
+
+		if (entry->mark == PACK_WRITTEN)
+		{
+			writer_emit (writer, entry->name, strlen (entry->name) + 1);
+		}
+	}
+
+	pack_encode (bytes, writer->count, 8);
+	pack_encode (bytes + 8, records, 8);
+	pack_encode (bytes + 16, names, 8);
+	pack_encode (bytes + 24, writer->offset - names, 8);
+	memcpy (bytes + 32, PACK_MAGIC, PACK_MAGIC_SIZE);
+	writer_emit (writer, bytes, PACK_TRAILER_SIZE);
+}
+
+/*
+ * Writes the decoded data of the files given by `names` (either a
+ * sequence of names, or a pattern) into a pack at `path`.  See
+ * `casc:pack ()`.
+ */
+extern int
+casc_pack_write (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	int names,
+	const char *path,
+	const int plain)
+{
+	struct CASC_Pack_Writer *writer = lua_newuserdata (L, sizeof (*writer));
+	memset (writer, 0, sizeof (*writer));
+	casc_index_initialize (&writer->index, storage->memory);
+	writer_metatable (L);
+
+	const int state = lua_gettop (L);
+	BYTE header [PACK_HEADER_SIZE] = { 0 };
+	ULONGLONG name = 0;
+
+	writer->buffer =
+		casc_memory_allocate (storage->memory, PACK_BUFFER_SIZE);
+
+	if (!writer->buffer)
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		goto error;
+	}
+
+	if (!writer_gather (L, writer, storage, names, plain))
+	{
+		goto error;
+	}
+
+	const int length = snprintf (writer->path, sizeof (writer->path),
+		"%s.tmp", path);
+
+	if (length < 0 || (size_t) length >= sizeof (writer->path))
+	{
+		SetCascError (ERROR_BUFFER_OVERFLOW);
+		goto error;
+	}
+
+	if (!(writer->stream = fopen (writer->path, "wb")))
+	{
+		SetCascError (ERROR_ACCESS_DENIED);
+		goto error;
+	}
+
+	memcpy (header, PACK_MAGIC, PACK_MAGIC_SIZE);
+	pack_encode (header + PACK_MAGIC_SIZE, PACK_VERSION, 4);
+	writer_emit (writer, header, sizeof (header));
+
+	lua_newtable (L);
+	const int failures = state + 1;
+
+	for (size_t index = 0; index < writer->index.count; index++)
+	{
+		struct CASC_Index_Entry *entry = writer->items [index].entry;
+		struct CASC_Pack_Record *record = &writer->records [writer->count];
+		const size_t size = strlen (entry->name);
+		const uint64_t start = casc_trace_begin ();
+		const DWORD error = writer_copy (writer, storage, entry, record);
+
+		casc_trace_end (start, "pack", entry->name, record->size);
+
+		if (ferror (writer->stream))
+		{
+			SetCascError (ERROR_DISK_FULL);
+			goto error;
+		}
+
+		if (error != ERROR_SUCCESS)
+		{
+			lua_pushstring (L, strerror (error));
+			lua_setfield (L, failures, entry->name);
+			continue;
+		}
+
+		if (name + size + 1 > 0xFFFFFFFF)
+		{
+			SetCascError (ERROR_BUFFER_OVERFLOW);
+			goto error;
+		}
+
+		record->name = (DWORD) name;
+		record->length = (DWORD) size;
+		name += size + 1;
+
+		entry->mark = PACK_WRITTEN;
+		writer->count++;
+	}
+
+	writer_finish (writer);
+
+	const int status = !ferror (writer->stream);
+	FILE *stream = writer->stream;
+	writer->stream = NULL;
+
+	if (fclose (stream) != 0 || !status)
+	{
+		remove (writer->path);
+		SetCascError (ERROR_DISK_FULL);
+		goto error;
+	}
+
+#if defined (_WIN32)
+	remove (path);
+#endif
+
+	if (rename (writer->path, path) != 0)
+	{
+		remove (writer->path);
+		SetCascError (ERROR_ACCESS_DENIED);
+		goto error;
+	}
+
+	lua_pushinteger (L, (lua_Integer) writer->count);
+	lua_insert (L, failures);
+
+	writer_release (writer);
+	return 2;
+
+error:
+	{
+		const DWORD error = GetCascError ();
+		writer_release (writer);
+		SetCascError (error);
+	}
+
+	return casc_result (L, 0);
+}
+
+static struct CASC_Pack *
+pack_access (
+	lua_State *L,
+	int index)
+{
+	return luaL_checkudata (L, index, CASC_PACK_METATABLE);
+}
+
+static int
+pack_map (
+	struct CASC_Pack *pack,
+	const char *path)
+{
+#if defined (_WIN32)
+	LARGE_INTEGER size;
+	HANDLE file = CreateFileA (path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		SetCascError (ERROR_FILE_NOT_FOUND);
+		return 0;
+	}
+
+	if (!GetFileSizeEx (file, &size) || size.QuadPart < PACK_HEADER_SIZE
+		|| (ULONGLONG) size.QuadPart > (SIZE_MAX >> 1))
+	{
+		CloseHandle (file);
+		SetCascError (ERROR_BAD_FORMAT);
+		return 0;
+	}
+
+	HANDLE mapping =
+		CreateFileMappingA (file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle (file);
+
+	if (!mapping)
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		return 0;
+	}
+
+	/* The view keeps the mapping alive. */
+	pack->data = MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle (mapping);
+
+	if (!pack->data)
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		return 0;
+	}
+
+	pack->size = (size_t) size.QuadPart;
+#else
+	struct stat information;
+	const int file = open (path, O_RDONLY);
+
+	if (file < 0)
+	{
+		SetCascError (ERROR_FILE_NOT_FOUND);
+		return 0;
+	}
+
+	if (fstat (file, &information) != 0
+		|| information.st_size < PACK_HEADER_SIZE
+		|| (ULONGLONG) information.st_size > (SIZE_MAX >> 1))
+	{
+		close (file);
+		SetCascError (ERROR_BAD_FORMAT);
+		return 0;
+	}
+
+	void *data = mmap (NULL, (size_t) information.st_size,
+		PROT_READ, MAP_PRIVATE, file, 0);
+	close (file);
+
+	if (data == MAP_FAILED)
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		return 0;
+	}
+
+	pack->data = data;
+	pack->size = (size_t) information.st_size;
+#endif
+
+	return 1;
+}
+
+static void
+pack_unmap (struct CASC_Pack *pack)
+{
+#if defined (_WIN32)
+	UnmapViewOfFile (pack->data);
+#else
+	munmap ((void *) pack->data, pack->size);
+#endif
+
+	pack->data = NULL;
+	pack->size = 0;
+}
+
+/*
+ * Checks the header and trailer of the mapped pack, and that the records
+ * and names lie within it.  The records themselves are checked upon use.
+ */
+static int
+pack_validate (struct CASC_Pack *pack)
+{
+	const BYTE *data = pack->data;
+	const size_t size = pack->size;
+
+	if (size < PACK_HEADER_SIZE + PACK_TRAILER_SIZE
+		|| memcmp (data, PACK_MAGIC, PACK_MAGIC_SIZE) != 0
+		|| pack_decode (data + PACK_MAGIC_SIZE, 4) != PACK_VERSION
+		|| memcmp (data + size - PACK_MAGIC_SIZE,
+			PACK_MAGIC, PACK_MAGIC_SIZE) != 0)
+	{
+		return 0;
+	}
+
+	const BYTE *trailer = data + size - PACK_TRAILER_SIZE;
+	const ULONGLONG end = size - PACK_TRAILER_SIZE;
+	const ULONGLONG count = pack_decode (trailer, 8);
+	const ULONGLONG records = pack_decode (trailer + 8, 8);
+	const ULONGLONG names = pack_decode (trailer + 16, 8);
+	const ULONGLONG names_size = pack_decode (trailer + 24, 8);
+
+	if (records < PACK_HEADER_SIZE || records > end
+		|| count > (end - records) / PACK_RECORD_SIZE
+		|| names < records + count * PACK_RECORD_SIZE || names > end
+		|| names_size > end - names
+		|| (names_size && data [names + names_size - 1] != '\0'))
+	{
+		return 0;
+	}
+
+	pack->records = data + records;
+	pack->count = (size_t) count;
+	pack->names = (const char *) data + names;
+	pack->names_size = (size_t) names_size;
+	pack->limit = records;
+
+	return 1;
+}
+
+/* Returns the name of the record at `index`, or `NULL` if corrupt. */
+static const char *
+pack_name (
+	const struct CASC_Pack *pack,
+	size_t index)
+{
+	const BYTE *record = pack->records + index * PACK_RECORD_SIZE;
+	const ULONGLONG offset = pack_decode (record + 24, 4);
+	const ULONGLONG length = pack_decode (record + 28, 4);
+
+	if (offset + length >= pack->names_size
+		|| pack->names [offset + length] != '\0')
+	{
+		return NULL;
+	}
+
+	return pack->names + offset;
+}
+
+/*
+ * Locates the data of the file `name` within the pack.  On failure, `0`
+ * is returned, and the CascLib error state is set.
+ */
+static int
+pack_locate (
+	const struct CASC_Pack *pack,
+	const char *name,
+	const BYTE **data,
+	ULONGLONG *size)
+{
+	const ULONGLONG hash = pack_hash (name);
+	size_t low = 0;
+	size_t high = pack->count;
+
+	if (!pack->data)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		return 0;
+	}
+
+	while (low < high)
+	{
+		const size_t middle = low + (high - low) / 2;
+
+		if (pack_decode (pack->records + middle * PACK_RECORD_SIZE, 8)
+			< hash)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	for (; low < pack->count; low++)
+	{
+		const BYTE *record = pack->records + low * PACK_RECORD_SIZE;
+		const char *other = pack_name (pack, low);
+
+		if (pack_decode (record, 8) != hash)
+		{
+			break;
+		}
+
+		if (!other || !pack_same (name, other))
+		{
+			continue;
+		}
+
+		const ULONGLONG offset = pack_decode (record + 8, 8);
+		*size = pack_decode (record + 16, 8);
+
+		if (offset > pack->limit || *size > pack->limit - offset)
+		{
+			SetCascError (ERROR_FILE_CORRUPT);
+			return 0;
+		}
+
+		*data = pack->data + offset;
+		return 1;
+	}
+
+	SetCascError (ERROR_FILE_NOT_FOUND);
+	return 0;
+}
+
+static int
+pack_iterator (lua_State *L)
+{
+	const struct CASC_Pack *pack = pack_access (L, lua_upvalueindex (1));
+	const char *pattern = lua_tostring (L, lua_upvalueindex (2));
+	const int plain = lua_toboolean (L, lua_upvalueindex (3));
+	size_t index = (size_t) lua_tointeger (L, lua_upvalueindex (4));
+
+	if (!pack->data)
+	{
+		return luaL_error (L, "%s", strerror (ERROR_INVALID_HANDLE));
+	}
+
+	for (; index < pack->count; index++)
+	{
+		const char *name = pack_name (pack, index);
+
+		if (!name)
+		{
+			return luaL_error (L, "%s", strerror (ERROR_FILE_CORRUPT));
+		}
+
+		if (casc_finder_match (L, name, pattern, plain))
+		{
+			lua_pushinteger (L, (lua_Integer) index + 1);
+			lua_replace (L, lua_upvalueindex (4));
+			lua_pushstring (L, name);
+			return 1;
+		}
+	}
+
+	lua_pushinteger (L, (lua_Integer) index);
+	lua_replace (L, lua_upvalueindex (4));
+	return 0;
+}
+
+/**
+ * `pack:files ([pattern [, plain]])`
+ *
+ * Returns an iterator `function` that, each time it is called, returns the
+ * next file name (`string`) within the `pack` that matches `pattern`
+ * (`string`), as per `casc:files ()`.  The names are returned in the order
+ * of their hashes, rather than that of the storage.
+ *
+ * In case of errors this function raises the error, instead of returning an
+ * error code.
+ */
+static int
+pack_files (lua_State *L)
+{
+	pack_access (L, 1);
+	luaL_optstring (L, 2, NULL);
+
+	lua_settop (L, 3);
+	lua_pushboolean (L, lua_toboolean (L, 3));
+	lua_replace (L, 3);
+	lua_pushinteger (L, 0);
+	lua_pushcclosure (L, pack_iterator, 4);
+	return 1;
+}
+
+/**
+ * `pack:open (name [, mode])`
+ *
+ * Opens the file specified by `name` (`string`) within the `pack`, and
+ * returns a new CASC File object, as per `casc:open ()`.  Its reads are
+ * served straight from the mapping of the pack, without any decoding, and
+ * without its cache.  The `pack` is kept alive by any of its open files.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+pack_open (lua_State *L)
+{
+	static const char * const
+	modes [] = {
+		"r",
+		"rb",
+		NULL
+	};
+
+	const struct CASC_Pack *pack = pack_access (L, 1);
+	const char *name = luaL_checkstring (L, 2);
+	const BYTE *data;
+	ULONGLONG size;
+
+	luaL_checkoption (L, 3, "r", modes);
+
+	if (!pack_locate (pack, name, &data, &size))
+	{
+		return casc_result (L, 0);
+	}
+
+	return casc_file_map (L, 1, data, size);
+}
+
+/**
+ * `pack:readfile (name)`
+ *
+ * Returns the contents (`string`) of the file specified by `name`
+ * (`string`) within the `pack`.  This copies the data out of the mapping
+ * once, into the `string`.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+pack_readfile (lua_State *L)
+{
+	const struct CASC_Pack *pack = pack_access (L, 1);
+	const char *name = luaL_checkstring (L, 2);
+	const BYTE *data;
+	ULONGLONG size;
+
+	if (!pack_locate (pack, name, &data, &size))
+	{
+		return casc_result (L, 0);
+	}
+
+	lua_pushlstring (L, (const char *) data, (size_t) size);
+	return 1;
+}
+
+/**
+ * `pack:view (name)`
+ *
+ * Returns a `lightuserdata` pointing at the contents of the file specified
+ * by `name` (`string`) within the `pack`, along with its size (`number`),
+ * without copying anything.  The memory is read only, and remains valid
+ * until the `pack` is closed, which makes it suited to the FFI (e.g.
+ * `ffi.cast ('const uint8_t *', pointer)`).
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+pack_view (lua_State *L)
+{
+	const struct CASC_Pack *pack = pack_access (L, 1);
+	const char *name = luaL_checkstring (L, 2);
+	const BYTE *data;
+	ULONGLONG size;
+
+	if (!pack_locate (pack, name, &data, &size))
+	{
+		return casc_result (L, 0);
+	}
+
+	lua_pushlightuserdata (L, (void *) data);
+	lua_pushinteger (L, (lua_Integer) size);
+	return 2;
+}
+
+/**
+ * `pack:close ()`
+ *
+ * Returns a `boolean` indicating that the `pack`, along with any of its
+ * open files, was successfully closed.  Any view of the `pack` is then
+ * invalid.  Note that packs are automatically closed when their handles
+ * are garbage collected.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+pack_close (lua_State *L)
+{
+	struct CASC_Pack *pack = pack_access (L, 1);
+
+	if (!pack->data)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		return casc_result (L, 0);
+	}
+
+	casc_registry_close_pack (L, pack);
+	pack_unmap (pack);
+
+	return casc_result (L, 1);
+}
+
+/**
+ * `pack:__tostring ()`
+ *
+ * Returns a `string` representation of the `pack`, indicating whether it
+ * is closed.
+ */
+static int
+pack_to_string (lua_State *L)
+{
+	const struct CASC_Pack *pack = pack_access (L, 1);
+	const char *text = !pack->data ? "%s (%p) (Closed)" : "%s (%p)";
+
+	lua_pushfstring (L, text, CASC_PACK_METATABLE, pack);
+	return 1;
+}
+
+static const luaL_Reg
+pack_methods [] =
+{
+	{ "files", pack_files },
+	{ "open", pack_open },
+	{ "readfile", pack_readfile },
+	{ "view", pack_view },
+	{ "close", pack_close },
+	{ "__tostring", pack_to_string },
+	{ "__gc", pack_close },
+	{ NULL, NULL }
+};
+
+static void
+pack_metatable (lua_State *L)
+{
+	if (luaL_newmetatable (L, CASC_PACK_METATABLE))
+	{
+		luaL_setfuncs (L, pack_methods, 0);
+		lua_pushvalue (L, -1);
+		lua_setfield (L, -2, "__index");
+	}
+
+	lua_setmetatable (L, -2);
+}
+
+/* Maps the pack at `path` into memory.  See `casclib.open_pack ()`. */
+extern int
+casc_pack_open (
+	lua_State *L,
+	const char *path)
+{
+	struct CASC_Pack *pack = lua_newuserdata (L, sizeof (*pack));
+	memset (pack, 0, sizeof (*pack));
+
+	const uint64_t start = casc_trace_begin ();
+	const int status = pack_map (pack, path);
+
+	casc_trace_end (start, "open pack", path, 0);
+
+	if (!status)
+	{
+		return casc_result (L, 0);
+	}
+
+	if (!pack_validate (pack))
+	{
+		pack_unmap (pack);
+		SetCascError (ERROR_BAD_FORMAT);
+		return casc_result (L, 0);
+	}
+
+	pack_metatable (L);
+	casc_registry_open_pack (L, pack);
+
+	return 1;
+}
@@ -0,0 +1,43 @@
+#ifndef CASC_PACK_H
+#define CASC_PACK_H
+
+#include <CascPort.h>
+#include <lua.h>
+#include <stddef.h>
+
+struct CASC_Storage;
+
+/*
+ * A pack file, as written by `casc:pack ()`, mapped into memory in its
+ * entirety.  The `records` are sorted by the hash of their name, and
+ * point into the data preceding them (up to `limit`), and into `names`.
+ */
+struct CASC_Pack
+{
+	/* The mapping, or `NULL` once the pack is closed. */
+	const BYTE *data;
+	size_t size;
+
+	const BYTE *records;
+	size_t count;
+
+	const char *names;
+	size_t names_size;
+
+	ULONGLONG limit;
+};
+
+extern int
+casc_pack_write (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	int names,
+	const char *path,
+	const int plain);
+
+extern int
+casc_pack_open (
+	lua_State *L,
+	const char *path);
+
+#endif
@@ -0,0 +1,335 @@
+#include "prefetch.h"
+#include "common.h"
+#include "memory.h"
+#include "registry.h"
+#include "storage.h"
+#include "thread.h"
+#include "trace.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <compat-5.3.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CASC_PREFETCH_METATABLE "Casc Prefetch"
+
+#define PREFETCH_BUFFER_SIZE 0x10000
+
+/*
+ * Opens and reads `name` in its entirety, discarding the data.  For online
+ * storages, this has CascLib download the file into its local cache.
+ */
+static DWORD
+prefetch_fetch (
+	HANDLE storage,
+	const char *name,
+	BYTE *buffer)
+{
+	HANDLE handle;
+	DWORD bytes_read;
+	int status;
+
+	if (!buffer)
+	{
+		return ERROR_NOT_ENOUGH_MEMORY;
+	}
+
+	if (!CascOpenFile (storage, name, 0, 0, &handle))
+	{
+		return casc_failure ();
+	}
+
+	do
+	{
+		status = CascReadFile (
+			handle, buffer, PREFETCH_BUFFER_SIZE, &bytes_read);
+	}
+	while (status && bytes_read > 0);
+
+	const DWORD error = status ? ERROR_SUCCESS : casc_failure ();
+	CascCloseFile (handle);
+
+	return error;
+}
+
+static CASC_THREAD_FUNCTION (prefetch_worker)
+{
+	struct CASC_Prefetch *prefetch = argument;
+	BYTE *buffer =
+		casc_memory_allocate (prefetch->memory, PREFETCH_BUFFER_SIZE);
+
+	while (true)
+	{
+		casc_mutex_lock (&prefetch->mutex);
+
+		if (prefetch->cancelled || prefetch->next >= prefetch->count)
+		{
+			casc_mutex_unlock (&prefetch->mutex);
+			break;
+		}
+
+		const size_t index = prefetch->next++;
+		casc_mutex_unlock (&prefetch->mutex);
+
+		const uint64_t start = casc_trace_begin ();
+		const DWORD error = prefetch_fetch (
+			prefetch->handle, prefetch->names [index], buffer);
+
+		casc_trace_end (start, "prefetch", prefetch->names [index], error);
+
+		casc_mutex_lock (&prefetch->mutex);
+		prefetch->errors [index] = error;
+		prefetch->done++;
+		casc_mutex_unlock (&prefetch->mutex);
+	}
+
+	casc_memory_free (buffer);
+	CASC_THREAD_RETURN;
+}
+
+static void
+prefetch_stop (struct CASC_Prefetch *prefetch)
+{
+	casc_mutex_lock (&prefetch->mutex);
+	prefetch->cancelled = 1;
+	casc_mutex_unlock (&prefetch->mutex);
+}
+
+static void
+prefetch_join (struct CASC_Prefetch *prefetch)
+{
+	if (prefetch->joined)
+	{
+		return;
+	}
+
+	for (size_t index = 0; index < prefetch->thread_count; index++)
+	{
+		casc_thread_join (prefetch->threads [index]);
+	}
+
+	prefetch->joined = 1;
+}
+
+/**
+ * `prefetch:wait ()`
+ *
+ * Waits for the prefetch to complete (or, if cancelled, for the files in
+ * progress to complete).  Returns the number of files fetched (`number`),
+ * and a `table` mapping the name of each file that could not be fetched to
+ * a `string` describing the error.
+ */
+static int
+prefetch_wait (lua_State *L)
+{
+	struct CASC_Prefetch *prefetch = casc_prefetch_access (L, 1);
+	lua_Integer fetched = 0;
+
+	prefetch_join (prefetch);
+	lua_newtable (L);
+
+	/* Once joined, every file that was started has been processed. */
+	for (size_t index = 0; index < prefetch->next; index++)
+	{
+		if (prefetch->errors [index] == ERROR_SUCCESS)
+		{
+			fetched++;
+			continue;
+		}
+
+		lua_pushstring (L, strerror (prefetch->errors [index]));
+		lua_setfield (L, -2, prefetch->names [index]);
+	}
+
+	lua_pushinteger (L, fetched);
+	lua_insert (L, -2);
+	return 2;
+}
+
+/**
+ * `prefetch:progress ()`
+ *
+ * Returns the number of files processed so far (`number`), and the total
+ * number of files (`number`).
+ */
+static int
+prefetch_progress (lua_State *L)
+{
+	struct CASC_Prefetch *prefetch = casc_prefetch_access (L, 1);
+
+	if (prefetch->names)
+	{
+		casc_mutex_lock (&prefetch->mutex);
+		lua_pushinteger (L, (lua_Integer) prefetch->done);
+		casc_mutex_unlock (&prefetch->mutex);
+	}
+	else
+	{
+		lua_pushinteger (L, 0);
+	}
+
+	lua_pushinteger (L, (lua_Integer) prefetch->count);
+	return 2;
+}
+
+/**
+ * `prefetch:cancel ()`
+ *
+ * Stops the prefetch from starting on any further files.  Returns `true`.
+ */
+static int
+prefetch_cancel (lua_State *L)
+{
+	struct CASC_Prefetch *prefetch = casc_prefetch_access (L, 1);
+
+	if (prefetch->names)
+	{
+		prefetch_stop (prefetch);
+	}
+
+	lua_pushboolean (L, 1);
+	return 1;
+}
+
+/**
+ * `prefetch:__gc ()`
+ *
+ * Cancels the prefetch, waiting for any files in progress to complete, and
+ * releases its resources.  This also happens when the storage is closed.
+ */
+static void
+prefetch_release (
+	lua_State *L,
+	struct CASC_Prefetch *prefetch)
+{
+	if (!prefetch->names)
+	{
+		return;
+	}
+
+	prefetch_stop (prefetch);
+	prefetch_join (prefetch);
+
+	casc_registry_remove_prefetch (L, prefetch);
+	casc_mutex_destroy (&prefetch->mutex);
+	casc_names_free (prefetch->names, prefetch->count);
+	casc_memory_free (prefetch->errors);
+	casc_memory_free (prefetch->threads);
+
+	prefetch->names = NULL;
+	prefetch->errors = NULL;
+	prefetch->threads = NULL;
+	prefetch->count = 0;
+	prefetch->next = 0;
+	prefetch->done = 0;
+}
+
+static int
+prefetch_close (lua_State *L)
+{
+	prefetch_release (L, casc_prefetch_access (L, 1));
+	return 0;
+}
+
+/**
+ * `prefetch:__tostring ()`
+ *
+ * Returns a `string` representation of the `Casc Prefetch` object.
+ */
+static int
+prefetch_to_string (lua_State *L)
+{
+	const struct CASC_Prefetch *prefetch = casc_prefetch_access (L, 1);
+
+	lua_pushfstring (L, "%s (%p)", CASC_PREFETCH_METATABLE, prefetch);
+	return 1;
+}
+
+static const luaL_Reg
+prefetch_methods [] =
+{
+	{ "wait", prefetch_wait },
+	{ "progress", prefetch_progress },
+	{ "cancel", prefetch_cancel },
+	{ "__tostring", prefetch_to_string },
+	{ "__gc", prefetch_close },
+	{ NULL, NULL }
+};
+
+static void
+prefetch_metatable (lua_State *L)
+{
+	if (luaL_newmetatable (L, CASC_PREFETCH_METATABLE))
+	{
+		luaL_setfuncs (L, prefetch_methods, 0);
+		lua_pushvalue (L, -1);
+		lua_setfield (L, -2, "__index");
+	}
+
+	lua_setmetatable (L, -2);
+}
+
+extern int
+casc_prefetch_initialize (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	int names,
+	int threads)
+{
+	struct CASC_Prefetch *prefetch =
+		lua_newuserdata (L, sizeof (*prefetch));
+	memset (prefetch, 0, sizeof (*prefetch));
+
+	prefetch->storage = storage;
+	prefetch->handle = storage->handle;
+	prefetch->memory = storage->memory;
+	prefetch->names =
+		casc_names_copy (L, names, &prefetch->count, prefetch->memory);
+	prefetch->errors = casc_memory_allocate_zeroed (prefetch->memory,
+		prefetch->count ? prefetch->count : 1, sizeof (DWORD));
+	prefetch->threads = casc_memory_allocate_zeroed (
+		prefetch->memory, (size_t) threads, sizeof (CASC_Thread));
+
+	if (!prefetch->names || !prefetch->errors || !prefetch->threads)
+	{
+		casc_names_free (prefetch->names, prefetch->count);
+		casc_memory_free (prefetch->errors);
+		casc_memory_free (prefetch->threads);
+		prefetch->names = NULL;
+
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		return casc_result (L, 0);
+	}
+
+	casc_mutex_initialize (&prefetch->mutex);
+	prefetch_metatable (L);
+	casc_registry_insert_prefetch (L, -1);
+
+	while (prefetch->thread_count < (size_t) threads
+		&& casc_thread_create (
+			&prefetch->threads [prefetch->thread_count],
+			prefetch_worker, prefetch))
+	{
+		prefetch->thread_count++;
+	}
+
+	if (prefetch->thread_count == 0)
+	{
+		prefetch_release (L, prefetch);
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		return casc_result (L, 0);
+	}
+
+	return 1;
+}
+
+extern struct CASC_Prefetch *
+casc_prefetch_access (
+	lua_State *L,
+	int index)
+{
+	return luaL_checkudata (L, index, CASC_PREFETCH_METATABLE);
+}
@@ -0,0 +1,44 @@
+#ifndef CASC_PREFETCH_H
+#define CASC_PREFETCH_H
+
+#include "thread.h"
+#include <CascPort.h>
+#include <lua.h>
+#include <stddef.h>
+
+struct CASC_Storage;
+
+struct CASC_Prefetch
+{
+	const struct CASC_Storage *storage;
+	HANDLE handle;
+	struct CASC_Memory *memory;
+
+	char **names;
+	DWORD *errors;
+	size_t count;
+
+	/* Guarded by `mutex`. */
+	size_t next;
+	size_t done;
+	int cancelled;
+
+	CASC_Mutex mutex;
+	CASC_Thread *threads;
+	size_t thread_count;
+	int joined;
+};
+
+extern int
+casc_prefetch_initialize (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	int names,
+	int threads);
+
+extern struct CASC_Prefetch *
+casc_prefetch_access (
+	lua_State *L,
+	int index);
+
+#endif
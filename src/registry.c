@@ -1,6 +1,7 @@
 #include "registry.h"
 #include "file.h"
 #include "finder.h"
+#include "prefetch.h"
 #include "storage.h"
 #include <CascPort.h>
 #include <compat-5.3.h>
@@ -9,10 +10,14 @@
 
 #define CASC_REGISTRY_METATABLE "Casc Registry"
 
-extern void
-casc_registry_open (
+/*
+ * The objects of each storage (or pack) are held within a table keyed by
+ * its handle, such that they can all be closed along with it.
+ */
+static void
+registry_open (
 	lua_State *L,
-	const struct CASC_Storage *storage)
+	const void *owner)
 {
 	lua_newtable (L);
 
@@ -23,15 +28,15 @@ casc_registry_open (
 	}
 
 	lua_setmetatable (L, -2);
-	lua_rawsetp (L, LUA_REGISTRYINDEX, storage->handle);
+	lua_rawsetp (L, LUA_REGISTRYINDEX, owner);
 }
 
-extern void
-casc_registry_close (
+static void
+registry_close (
 	lua_State *L,
-	const struct CASC_Storage *storage)
+	const void *owner)
 {
-	lua_rawgetp (L, LUA_REGISTRYINDEX, storage->handle);
+	lua_rawgetp (L, LUA_REGISTRYINDEX, owner);
 	lua_pushnil (L);
 
 	while (lua_next (L, -2))
@@ -45,7 +50,46 @@ casc_registry_close (
 
 	lua_pop (L, 1);
 	lua_pushnil (L);
-	lua_rawsetp (L, LUA_REGISTRYINDEX, storage->handle);
+	lua_rawsetp (L, LUA_REGISTRYINDEX, owner);
+}
+
+extern void
+casc_registry_open (
+	lua_State *L,
+	const struct CASC_Storage *storage)
+{
+	registry_open (L, storage->handle);
+}
+
+extern void
+casc_registry_close (
+	lua_State *L,
+	const struct CASC_Storage *storage)
+{
+	registry_close (L, storage->handle);
+}
+
+extern void
+casc_registry_open_pack (
+	lua_State *L,
+	const struct CASC_Pack *pack)
+{
+	registry_open (L, pack);
+}
+
+extern void
+casc_registry_close_pack (
+	lua_State *L,
+	const struct CASC_Pack *pack)
+{
+	registry_close (L, pack);
+}
+
+/* Files belong to either a storage, or a pack. */
+static void *
+registry_owner (const struct CASC_File *file)
+{
+	return file->pack ? (void *) file->pack : file->storage->handle;
 }
 
 static void
@@ -68,7 +112,7 @@ casc_registry_insert_file (
 	int index)
 {
 	const struct CASC_File *file = casc_file_access (L, index);
-	registry_insert (L, file->storage->handle, file->handle, index);
+	registry_insert (L, registry_owner (file), (void *) file, index);
 }
 
 extern void
@@ -80,6 +124,16 @@ casc_registry_insert_finder (
 	registry_insert (L, finder->storage->handle, finder->handle, index);
 }
 
+extern void
+casc_registry_insert_prefetch (
+	lua_State *L,
+	int index)
+{
+	struct CASC_Prefetch *prefetch = casc_prefetch_access (L, index);
+	registry_insert (
+		L, prefetch->storage->handle, (void *) prefetch, index);
+}
+
 static void
 registry_remove (
 	lua_State *L,
@@ -97,7 +151,7 @@ casc_registry_remove_file (
 	lua_State *L,
 	const struct CASC_File *file)
 {
-	registry_remove (L, file->storage->handle, file->handle);
+	registry_remove (L, registry_owner (file), (void *) file);
 }
 
 extern void
@@ -107,3 +161,11 @@ casc_registry_remove_finder (
 {
 	registry_remove (L, finder->storage->handle, finder->handle);
 }
+
+extern void
+casc_registry_remove_prefetch (
+	lua_State *L,
+	const struct CASC_Prefetch *prefetch)
+{
+	registry_remove (L, prefetch->storage->handle, (void *) prefetch);
+}
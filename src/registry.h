@@ -5,6 +5,8 @@
 
 struct CASC_File;
 struct CASC_Finder;
+struct CASC_Pack;
+struct CASC_Prefetch;
 struct CASC_Storage;
 
 extern void
@@ -17,6 +19,16 @@ casc_registry_close (
 	lua_State *L,
 	const struct CASC_Storage *storage);
 
+extern void
+casc_registry_open_pack (
+	lua_State *L,
+	const struct CASC_Pack *pack);
+
+extern void
+casc_registry_close_pack (
+	lua_State *L,
+	const struct CASC_Pack *pack);
+
 extern void
 casc_registry_insert_file (
 	lua_State *L,
@@ -27,6 +39,11 @@ casc_registry_insert_finder (
 	lua_State *L,
 	int index);
 
+extern void
+casc_registry_insert_prefetch (
+	lua_State *L,
+	int index);
+
 extern void
 casc_registry_remove_file (
 	lua_State *L,
@@ -37,4 +54,9 @@ casc_registry_remove_finder (
 	lua_State *L,
 	const struct CASC_Finder *finder);
 
+extern void
+casc_registry_remove_prefetch (
+	lua_State *L,
+	const struct CASC_Prefetch *prefetch);
+
 #endif
@@ -1,19 +1,34 @@
 #include "storage.h"
+#include "batch.h"
+#include "classify.h"
 #include "common.h"
+#include "encoded.h"
 #include "file.h"
 #include "finder.h"
+#include "grep.h"
+#include "memory.h"
+#include "names.h"
+#include "pack.h"
+#include "prefetch.h"
 #include "registry.h"
+#include "sync.h"
+#include "thread.h"
+#include "trace.h"
+#include "tree.h"
 #include <CascLib.h>
 #include <CascPort.h>
 #include <compat-5.3.h>
 #include <lauxlib.h>
 #include <lua.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define CASC_STORAGE_METATABLE "Casc Storage"
 
 /**
  * `casc:files ([pattern [, plain]])`
+ * `casc:files ([pattern ,] options)`
  *
  * Returns an iterator `function` that, each time it is called, returns the
  * next file name (`string`) that matches `pattern` (`string`) (which is a
@@ -21,6 +36,40 @@
  * is disabled and a plain text search is performed.  The default behavior,
  * should `pattern` be absent, is to return all files.
  *
+ * Alternatively, an `options` (`table`) can be provided, containing any of
+ * the following fields:
+ *
+ * - `pattern` (`string`): As above.  Only used if `pattern` is absent.
+ * - `plain` (`boolean`): As above.
+ * - `order` (`string`): The order in which files are returned, which can
+ *   be any of the following, and must match exactly:
+ *     - `"storage"`: The order provided by CascLib (the default).
+ *     - `"physical"`: The order in which the file data is located within
+ *       the storage's data archives.  Reading files in this order results
+ *       in mostly sequential disk access.  Note that all matching files are
+ *       gathered (and located) on the first call to the iterator.
+ * - `fields` (`table`): A sequence of the names of additional values the
+ *   iterator should return after each file name, in the given order.  These
+ *   come straight from enumeration, without opening any file:
+ *     - `"size"`: The file size (`number`).
+ *     - `"ckey"`: The content key, as a hexadecimal `string`.
+ *     - `"ekey"`: The encoded key, as a hexadecimal `string`.
+ *     - `"locale"`: The locale flags (`number`).
+ *     - `"available"`: Whether the file data is present (`boolean`).
+ *     - `"id"`: The file data ID (`number`).
+ * - `locale` (`string` or `number`): Only return files of this locale, as
+ *   per `casc:open ()`, along with those that have no locale at all.
+ * - `available_only` (`boolean`): Only return files whose data is present
+ *   within the storage.  Defaults to `false`.
+ * - `background` (`boolean`): Run the enumeration on a separate thread,
+ *   ahead of the iterator (by up to `256` files), such that its cost is
+ *   hidden behind the body of the loop.  The filters above, along with a
+ *   `plain` pattern, are applied on that thread, whereas Lua patterns are
+ *   still matched by the iterator.  A failure of the enumeration itself
+ *   then ends it, rather than raising.  Defaults to `false`.
+ *
+ * Both filters are applied within enumeration, before any pattern.
+ *
  * In case of errors this function raises the error, instead of returning an
  * error code.
  */
@@ -35,18 +84,87 @@ storage_files (lua_State *L)
 		goto error;
 	}
 
-	const char *pattern = luaL_optstring (L, 2, NULL);
-	const int plain = lua_toboolean (L, 3);
+	struct CASC_Finder_Options options;
+	casc_finder_options (L, 2, &options);
 
-	lua_settop (L, 0);
-	return casc_finder_initialize (L, storage, pattern, plain);
+	return casc_finder_initialize (L, storage, &options);
 
 error:
 	return casc_result (L, 0);
 }
 
 /**
- * `casc:open (name [, mode [, size]])`
+ * `casc:names ([pattern [, plain]])`
+ *
+ * Returns a new `Casc NameList` object holding the names of all files
+ * that match `pattern` (`string`), as per `casc:files ()`, in the order
+ * provided by CascLib.  The names are front coded within a single native
+ * buffer, rather than being held as one Lua `string` each, which takes a
+ * fraction of the memory for large listings.
+ *
+ * The list supports `#list` and `list [index]` (which creates the `string`
+ * upon each access), along with `list:find (name)`, `list:sort ()`, and
+ * `list:range (prefix)`.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+storage_names (lua_State *L)
+{
+	const struct CASC_Storage *storage = casc_storage_access (L, 1);
+	const char *pattern = luaL_optstring (L, 2, NULL);
+	const int plain = lua_toboolean (L, 3);
+
+	if (!storage->handle)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		return casc_result (L, 0);
+	}
+
+	return casc_names_initialize (L, storage, pattern, plain);
+}
+
+/**
+ * `casc:classify (buckets)`
+ *
+ * Sorts the file names of the storage into named buckets, enumerating the
+ * storage only once, regardless of the number of buckets.  Each value of
+ * the `buckets` (`table`) can be either of the following:
+ *
+ * - `string`: A Lua pattern, matched as per `casc:files ()`.
+ * - `table`: A sequence of plain strings, any of which places a name in
+ *   the bucket.  The optional `anchor` (`string`) field restricts where
+ *   these strings must occur, and can be any of `"any"` (the default),
+ *   `"start"`, or `"end"`.
+ *
+ * The plain strings of all buckets are matched together, in a single pass
+ * over each name, so large sets of extensions or prefixes are best given
+ * as such rather than as patterns.  A name can be placed in any number of
+ * buckets.
+ *
+ * Returns a `table` with the same keys as `buckets`, each holding a
+ * `table` (sequence) of the matching file names.  In case of error,
+ * returns `nil`, a `string` describing the error, and a `number`
+ * indicating the error code.
+ */
+static int
+storage_classify (lua_State *L)
+{
+	const struct CASC_Storage *storage = casc_storage_access (L, 1);
+	luaL_checktype (L, 2, LUA_TTABLE);
+
+	if (!storage->handle)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		return casc_result (L, 0);
+	}
+
+	return casc_classify_compute (L, storage, 2);
+}
+
+/**
+ * `casc:open (name [, mode] [, options])`
  *
  * This function opens the file specified by `name` (`string`) within the
  * `casc` storage, with the specified `mode` (`string`), and returns a new
@@ -59,6 +177,17 @@ error:
  * Additionally, `"b"` is accepted at the end of the mode, representing
  * binary mode.  However, it serves no actual purpose.
  *
+ * The `options` (`table`) can contain the following field:
+ *
+ * - `lazy` (`boolean`): Defer opening the file within CascLib until it is
+ *   first read from or seeked.  Any error opening the file is then
+ *   reported by that operation.  Defaults to that of the storage (see
+ *   `casclib.open ()`).
+ * - `locale` (`string` or `number`): The locale of the file to open,
+ *   should the storage hold several variants of it.  Either the name of a
+ *   locale (e.g. `"enUS"`), `"all"`, or any combination of the CascLib
+ *   locale flags.  Defaults to that chosen by CascLib.
+ *
  * In case of error, returns `nil`, a `string` describing the error, and
  * a `number` indicating the error code.
  */
@@ -69,6 +198,7 @@ storage_open (lua_State *L)
 	modes [] = {
 		"r",
 		"rb",
+		NULL
 	};
 
 	const struct CASC_Storage *storage = casc_storage_access (L, 1);
@@ -80,10 +210,599 @@ storage_open (lua_State *L)
 	}
 
 	const char *name = luaL_checkstring (L, 2);
-	luaL_checkoption (L, 3, "r", modes);
+	const int options = lua_istable (L, 3) ? 3 : 4;
 
-	lua_settop (L, 0);
-	return casc_file_initialize (L, storage, name);
+	if (options == 4)
+	{
+		luaL_checkoption (L, 3, "r", modes);
+	}
+
+	const int lazy =
+		casc_option_boolean (L, options, "lazy", storage->lazy);
+	const DWORD locale =
+		(DWORD) casc_option_locale (L, options, "locale", 0);
+
+	return casc_file_initialize (L, storage, name, lazy, locale);
+
+error:
+	return casc_result (L, 0);
+}
+
+/**
+ * `casc:open_many (names [, options])`
+ *
+ * Opens each of the files specified by `names` (`table`), a sequence of
+ * file names, within the `casc` storage, in a single call.  The `options`
+ * (`table`) can contain the `locale` field, as per `casc:open ()`.
+ *
+ * Returns a `table` mapping the name of each file that was opened to its
+ * new CASC File object, and a `table` mapping the name of each file that
+ * could not be opened to a `string` describing the error.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+storage_open_many (lua_State *L)
+{
+	const struct CASC_Storage *storage = casc_storage_access (L, 1);
+
+	if (!storage->handle)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		goto error;
+	}
+
+	luaL_checktype (L, 2, LUA_TTABLE);
+	const DWORD locale = (DWORD) casc_option_locale (L, 3, "locale", 0);
+	lua_settop (L, 2);
+
+	const lua_Integer count = (lua_Integer) lua_rawlen (L, 2);
+	lua_createtable (L, 0, (int) count);
+	lua_newtable (L);
+
+	for (lua_Integer index = 1; index <= count; index++)
+	{
+		lua_rawgeti (L, 2, index);
+		const char *name = lua_tostring (L, -1);
+
+		if (!name)
+		{
+			return luaL_error (L,
+				"name at position %d is not a string", (int) index);
+		}
+
+		if (casc_file_initialize (L, storage, name, 0, locale) == 1)
+		{
+			lua_setfield (L, 3, name);
+		}
+		else
+		{
+			lua_pop (L, 1);
+			lua_setfield (L, 4, name);
+		}
+
+		lua_settop (L, 4);
+	}
+
+	return 2;
+
+error:
+	return casc_result (L, 0);
+}
+
+/**
+ * `casc:read_many (names [, options])`
+ *
+ * Reads the entirety of each of the files specified by `names` (`table`),
+ * a sequence of file names, decoding them concurrently on a pool of worker
+ * threads, each with its own file handles.  Only the resulting strings are
+ * created on the calling thread, which waits for all files to be read.
+ *
+ * The `options` (`table`) can contain the following field:
+ *
+ * - `threads` (`number`): The number of concurrent reads.  Defaults to
+ *   that of the storage (see `casclib.open ()`).
+ *
+ * Returns a `table` mapping the name of each file that was read to its
+ * contents (`string`), and a `table` mapping the name of each file that
+ * could not be read to a `string` describing the error.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+storage_read_many (lua_State *L)
+{
+	const struct CASC_Storage *storage = casc_storage_access (L, 1);
+
+	if (!storage->handle)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		return casc_result (L, 0);
+	}
+
+	luaL_checktype (L, 2, LUA_TTABLE);
+	const lua_Integer threads =
+		casc_option_integer (L, 3, "threads", storage->threads);
+
+	luaL_argcheck (L, threads > 0 && threads <= CASC_THREADS_MAXIMUM, 3,
+		"invalid number of threads");
+
+	return casc_batch_read (L, storage, 2, (int) threads);
+}
+
+/**
+ * `casc:grep (needle [, pattern] [, options])`
+ *
+ * Searches the content of every file whose name matches `pattern`
+ * (`string`), as per `casc:files ()`, for `needle` (`string`), which is a
+ * Lua pattern unless the `plain` option is set.  The files are decoded by
+ * a pool of worker threads, in the order of their data.  Plain searches
+ * are done by the workers as well, whereas patterns are matched by the
+ * calling thread, as the files are decoded.
+ *
+ * The `options` (`table`) can contain the following fields:
+ *
+ * - `plain` (`boolean`): Search for `needle` as a plain `string`.
+ *   Defaults to `false`.
+ * - `lines` (`boolean`): Report line numbers, each line at most once,
+ *   rather than offsets.  Defaults to `false`.
+ * - `max` (`number`): The maximum number of matches to report per file.
+ *   Defaults to `0`, meaning no limit.
+ * - `threads` (`number`): The number of worker threads.  Defaults to that
+ *   of the storage (see `casclib.open ()`).
+ *
+ * Returns a `table` mapping the name of each file with any match to a
+ * `table` (sequence) of the (one-based) offsets, or line numbers, of its
+ * matches, and a `table` mapping the name of any file that could not be
+ * read to a `string` describing the error.  In case of error, returns
+ * `nil`, a `string` describing the error, and a `number` indicating the
+ * error code.
+ */
+static int
+storage_grep (lua_State *L)
+{
+	const struct CASC_Storage *storage = casc_storage_access (L, 1);
+	size_t length;
+	luaL_checklstring (L, 2, &length);
+	luaL_argcheck (L, length > 0, 2, "must not be empty");
+
+	const int index = lua_istable (L, 3) ? 3 : 4;
+	struct CASC_Grep_Options options;
+
+	options.names = index == 4 ? luaL_optstring (L, 3, NULL) : NULL;
+	options.plain = casc_option_boolean (L, index, "plain", 0);
+	options.lines = casc_option_boolean (L, index, "lines", 0);
+	options.maximum = casc_option_integer (L, index, "max", 0);
+
+	const lua_Integer threads =
+		casc_option_integer (L, index, "threads", storage->threads);
+
+	luaL_argcheck (L, options.maximum >= 0, index, "invalid maximum");
+	luaL_argcheck (L, threads > 0 && threads <= CASC_THREADS_MAXIMUM,
+		index, "invalid number of threads");
+
+	options.threads = (int) threads;
+
+	if (!storage->handle)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		return casc_result (L, 0);
+	}
+
+	return casc_grep_run (L, storage, 2, &options);
+}
+
+/**
+ * `casc:read_encoded (name [, kind])`
+ *
+ * Reads the file specified by `name` (`string`) exactly as it is stored,
+ * i.e. still encoded as BLTE, without decoding (or decompressing) any of
+ * it.  The `kind` (`string`) of `name` can be either of the following, and
+ * must match exactly:
+ *
+ * - `"name"`: A file name, as per `casc:open ()`.  The default.
+ * - `"ekey"`: The EKey of the file, as a hexadecimal `string`.
+ *
+ * This is only supported by local storages, and for files stored as a
+ * single span.
+ *
+ * Returns the encoded data (`string`), the EKey (`string`) of the file as
+ * a hexadecimal `string`, and the size (`number`) of the encoded data.  In
+ * case of error, returns `nil`, a `string` describing the error, and a
+ * `number` indicating the error code.
+ */
+static int
+storage_read_encoded (lua_State *L)
+{
+	static const char * const
+	kinds [] = {
+		"name",
+		"ekey",
+		NULL
+	};
+
+	const struct CASC_Storage *storage = casc_storage_access (L, 1);
+	size_t length;
+	const char *name = luaL_checklstring (L, 2, &length);
+	const int by_ekey = luaL_checkoption (L, 3, "name", kinds);
+	BYTE ekey [MD5_HASH_SIZE];
+
+	if (!storage->handle)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		return casc_result (L, 0);
+	}
+
+	if (by_ekey && !casc_parse_key (name, length, ekey))
+	{
+		SetCascError (ERROR_INVALID_PARAMETER);
+		return casc_result (L, 0);
+	}
+
+	return casc_encoded_read (
+		L, storage, by_ekey ? (const void *) ekey : name, by_ekey);
+}
+
+/* Builds the directory tree of `storage`, should it not already exist. */
+static int
+storage_tree (struct CASC_Storage *storage)
+{
+	if (!storage->tree)
+	{
+		storage->tree = casc_tree_build (storage);
+	}
+
+	return !!storage->tree;
+}
+
+/* Whether `node` is a file, while also being a directory of other files. */
+static int
+storage_is_both (
+	const struct CASC_Tree *tree,
+	uint32_t node)
+{
+	return tree->nodes [node].file && tree->nodes [node].count > 0;
+}
+
+static void
+storage_push_kind (
+	lua_State *L,
+	const struct CASC_Tree *tree,
+	uint32_t node)
+{
+	if (tree->nodes [node].count > 0)
+	{
+		lua_pushliteral (L, "directory");
+	}
+	else
+	{
+		lua_pushliteral (L, "file");
+	}
+}
+
+/**
+ * `casc:dir ([path])`
+ *
+ * Lists the immediate children of the directory `path` (`string`), whose
+ * components can be separated by any of `/`, `\`, or `:`.  The default,
+ * should `path` be absent, is the root.
+ *
+ * The first call builds a tree of the file names of the storage from a
+ * single enumeration, which is kept until the storage is closed.  Listings
+ * then only cost as much as the number of children.
+ *
+ * Returns a `table` (sequence) of the names of the children, sorted, and a
+ * `table` (sequence) of their kinds, in the same order, each being either
+ * `"file"` or `"directory"`.  A name that is that of a file as well as
+ * the directory of other files is listed twice, as a file first.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+storage_dir (lua_State *L)
+{
+	struct CASC_Storage *storage = casc_storage_access (L, 1);
+	const char *path = luaL_optstring (L, 2, "");
+
+	if (!storage->handle)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		goto error;
+	}
+
+	if (!storage_tree (storage))
+	{
+		goto error;
+	}
+
+	const struct CASC_Tree *tree = storage->tree;
+	const uint32_t node = casc_tree_resolve (tree, path);
+
+	if (node == CASC_TREE_NONE)
+	{
+		SetCascError (ERROR_FILE_NOT_FOUND);
+		goto error;
+	}
+
+	const struct CASC_Tree_Node *parent = &tree->nodes [node];
+
+	lua_Integer position = 0;
+
+	lua_createtable (L, (int) parent->count, 0);
+	lua_createtable (L, (int) parent->count, 0);
+
+	for (uint32_t index = 0; index < parent->count; index++)
+	{
+		const uint32_t child = tree->children [parent->first + index];
+
+		/* A file that is also a directory is listed as both. */
+		if (storage_is_both (tree, child))
+		{
+			lua_pushstring (L, casc_tree_component (tree, child));
+			lua_rawseti (L, -3, ++position);
+
+			lua_pushliteral (L, "file");
+			lua_rawseti (L, -2, position);
+		}
+
+		lua_pushstring (L, casc_tree_component (tree, child));
+		lua_rawseti (L, -3, ++position);
+
+		storage_push_kind (L, tree, child);
+		lua_rawseti (L, -2, position);
+	}
+
+	return 2;
+
+error:
+	return casc_result (L, 0);
+}
+
+static int
+walk_iterator (lua_State *L)
+{
+	const struct CASC_Storage *storage =
+		casc_storage_access (L, lua_upvalueindex (1));
+
+	if (!storage->handle || !storage->tree)
+	{
+		return luaL_error (L, "%s", strerror (ERROR_INVALID_HANDLE));
+	}
+
+	const struct CASC_Tree *tree = storage->tree;
+	const uint32_t start =
+		(uint32_t) lua_tointeger (L, lua_upvalueindex (2));
+	const uint32_t current =
+		(uint32_t) lua_tointeger (L, lua_upvalueindex (3));
+
+	/* The directory of a node that was just returned as a file. */
+	if (lua_toboolean (L, lua_upvalueindex (4)))
+	{
+		lua_pushboolean (L, 0);
+		lua_replace (L, lua_upvalueindex (4));
+
+		casc_tree_push_path (L, tree, current);
+		lua_pushliteral (L, "directory");
+		return 2;
+	}
+
+	const uint32_t next = casc_tree_next (tree, start, current);
+
+	if (next == CASC_TREE_NONE)
+	{
+		return 0;
+	}
+
+	lua_pushinteger (L, (lua_Integer) next);
+	lua_replace (L, lua_upvalueindex (3));
+
+	casc_tree_push_path (L, tree, next);
+
+	if (storage_is_both (tree, next))
+	{
+		lua_pushboolean (L, 1);
+		lua_replace (L, lua_upvalueindex (4));
+		lua_pushliteral (L, "file");
+		return 2;
+	}
+
+	storage_push_kind (L, tree, next);
+	return 2;
+}
+
+/**
+ * `casc:walk ([path])`
+ *
+ * Returns an iterator `function` that, each time it is called, returns the
+ * full name (`string`) and kind (`string`, either `"file"` or
+ * `"directory"`) of the next entry beneath the directory `path`
+ * (`string`), depth first, and in sorted order.  The name uses the
+ * separators of the original file name, and as such a file can be opened
+ * by it.  A name that is that of a file as well as the directory of other
+ * files is returned twice, as a file first.  See `casc:dir ()` regarding
+ * `path`, and the directory tree.
+ *
+ * In case of errors this function raises the error, instead of returning an
+ * error code.
+ */
+static int
+storage_walk (lua_State *L)
+{
+	struct CASC_Storage *storage = casc_storage_access (L, 1);
+	const char *path = luaL_optstring (L, 2, "");
+
+	if (!storage->handle)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		goto error;
+	}
+
+	if (!storage_tree (storage))
+	{
+		goto error;
+	}
+
+	const uint32_t node = casc_tree_resolve (storage->tree, path);
+
+	if (node == CASC_TREE_NONE)
+	{
+		SetCascError (ERROR_FILE_NOT_FOUND);
+		goto error;
+	}
+
+	lua_settop (L, 1);
+	lua_pushinteger (L, (lua_Integer) node);
+	lua_pushinteger (L, (lua_Integer) node);
+	lua_pushboolean (L, 0);
+	lua_pushcclosure (L, walk_iterator, 4);
+	return 1;
+
+error:
+	return luaL_error (L, "%s", strerror (GetCascError ()));
+}
+
+/**
+ * `casc:sync (destination [, options])`
+ *
+ * Brings the `destination` (`string`) directory up to date with the files
+ * of the `casc` storage, doing only the work needed since the previous
+ * run.  A manifest records the CKey and size of every extracted file, so
+ * that unchanged files are skipped, files whose content merely moved to
+ * another name are renamed, files no longer in the storage are deleted,
+ * and only new or changed files are extracted, in the order of the data.
+ *
+ * The `options` (`table`) can contain the following fields:
+ *
+ * - `manifest` (`string`): The path of the manifest.  Defaults to
+ *   `.casc-manifest` within `destination`.
+ * - `pattern` (`string`): Only sync the files matching this Lua pattern,
+ *   as per `casc:files ()`.
+ * - `plain` (`boolean`): Match `pattern` as a plain `string`.
+ *
+ * Within `destination`, any of `\` and `:` in file names become directory
+ * separators.  Files which fail to extract are left out of the manifest,
+ * so that they are retried by the next run.
+ *
+ * Returns a `table` counting the files `extracted`, `renamed`, `deleted`,
+ * and `unchanged` (`number`), and a `table` mapping the name of any file
+ * which failed to extract to a `string` describing the error.  In case of
+ * error, returns `nil`, a `string` describing the error, and a `number`
+ * indicating the error code.
+ */
+static int
+storage_sync (lua_State *L)
+{
+	const struct CASC_Storage *storage = casc_storage_access (L, 1);
+	const char *destination = luaL_checkstring (L, 2);
+	const char *pattern = casc_option_string (L, 3, "pattern", NULL);
+	const int plain = casc_option_boolean (L, 3, "plain", 0);
+	const char *manifest = casc_option_string (L, 3, "manifest", NULL);
+
+	if (!storage->handle)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		return casc_result (L, 0);
+	}
+
+	if (!manifest)
+	{
+		manifest = lua_pushfstring (L, "%s/.casc-manifest", destination);
+	}
+
+	return casc_sync_run (
+		L, storage, destination, manifest, pattern, plain);
+}
+
+/**
+ * `casc:pack (names, path [, options])`
+ *
+ * Writes the decoded data of a set of files of the `casc` storage into a
+ * single pack file at `path` (`string`), along with an index of their
+ * names sorted by hash, such that `casclib.open_pack ()` can later serve
+ * them straight from memory, without CascLib.  The files are given by
+ * `names`, either a `table` (a sequence of file names, packed in the given
+ * order), or a `string` (a Lua pattern, as per `casc:files ()`, whose
+ * matches are packed in the order of the data).
+ *
+ * The `options` (`table`) can contain the following field:
+ *
+ * - `plain` (`boolean`): Match the pattern given by `names` as a plain
+ *   `string`.
+ *
+ * The pack is written to a temporary file first, and only replaces `path`
+ * once complete.  Files which fail to decode are left out of it.
+ *
+ * Returns the number of packed files (`number`), and a `table` mapping the
+ * name of any file which failed to a `string` describing the error.  In
+ * case of error, returns `nil`, a `string` describing the error, and a
+ * `number` indicating the error code.
+ */
+static int
+storage_pack (lua_State *L)
+{
+	const struct CASC_Storage *storage = casc_storage_access (L, 1);
+
+	if (!lua_istable (L, 2))
+	{
+		luaL_checkstring (L, 2);
+	}
+
+	const char *path = luaL_checkstring (L, 3);
+	const int plain = casc_option_boolean (L, 4, "plain", 0);
+
+	if (!storage->handle)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		return casc_result (L, 0);
+	}
+
+	return casc_pack_write (L, storage, 2, path, plain);
+}
+
+/**
+ * `casc:prefetch (names [, options])`
+ *
+ * Starts fetching the files specified by `names` (`table`), a sequence of
+ * file names, in the background.  Each file is opened and read in its
+ * entirety by a pool of worker threads, in the given order.  For online
+ * storages, this downloads the files ahead of their use (into the local
+ * cache, should one be configured).  For local storages, this warms the
+ * operating system's file cache.
+ *
+ * The `options` (`table`) can contain the following field:
+ *
+ * - `threads` (`number`): The number of concurrent fetches.  Defaults to
+ *   that of the storage (see `casclib.open ()`).
+ *
+ * Returns a new `Casc Prefetch` object, which provides `prefetch:wait ()`,
+ * `prefetch:progress ()`, and `prefetch:cancel ()`.  A prefetch is
+ * cancelled if it is garbage collected, or if the storage is closed.
+ *
+ * In case of error, returns `nil`, a `string` describing the error, and
+ * a `number` indicating the error code.
+ */
+static int
+storage_prefetch (lua_State *L)
+{
+	const struct CASC_Storage *storage = casc_storage_access (L, 1);
+
+	if (!storage->handle)
+	{
+		SetCascError (ERROR_INVALID_HANDLE);
+		goto error;
+	}
+
+	luaL_checktype (L, 2, LUA_TTABLE);
+	const lua_Integer threads =
+		casc_option_integer (L, 3, "threads", storage->threads);
+
+	luaL_argcheck (L, threads > 0 && threads <= CASC_THREADS_MAXIMUM, 3,
+		"invalid number of threads");
+
+	return casc_prefetch_initialize (L, storage, 2, (int) threads);
 
 error:
 	return casc_result (L, 0);
@@ -111,14 +830,100 @@ storage_close (lua_State *L)
 	}
 	else
 	{
+		const uint64_t start = casc_trace_begin ();
+
 		casc_registry_close (L, storage);
 		status = CascCloseStorage (storage->handle);
 		storage->handle = NULL;
+		casc_trace_end (start, "close storage", NULL, 0);
+
+		casc_tree_free (storage->tree);
+		storage->tree = NULL;
+
+		casc_memory_free (storage->path);
+		storage->path = NULL;
+
+		if (storage->profile)
+		{
+			fclose (storage->profile);
+			storage->profile = NULL;
+		}
+
+		casc_memory_close (storage->memory);
+		storage->memory = NULL;
 	}
 
 	return casc_result (L, status);
 }
 
+/*
+ * Prefetches, in the background, the files named by the access profile at
+ * `path`, in their recorded order.  The storage is expected at the top of
+ * the stack, and keeps the prefetch alive (as its user value), such that
+ * it is only cancelled by closing the storage.  A missing or unreadable
+ * profile is ignored, as it is only a hint.
+ */
+static void
+storage_warm (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	const char *path)
+{
+	FILE *stream = fopen (path, "r");
+	char line [4096];
+	lua_Integer count = 0;
+
+	if (!stream)
+	{
+		return;
+	}
+
+	const int top = lua_gettop (L);
+	lua_newtable (L);
+	lua_newtable (L);
+
+	/* Each line holds the offset of the first access, and the name. */
+	while (fgets (line, sizeof (line), stream))
+	{
+		char *name = strchr (line, '\t');
+		const size_t length = name ? strcspn (++name, "\r\n") : 0;
+
+		if (length == 0)
+		{
+			continue;
+		}
+
+		lua_pushlstring (L, name, length);
+		lua_pushvalue (L, -1);
+		lua_rawget (L, top + 2);
+
+		if (lua_toboolean (L, -1))
+		{
+			lua_pop (L, 2);
+			continue;
+		}
+
+		lua_pop (L, 1);
+		lua_pushvalue (L, -1);
+		lua_rawseti (L, top + 1, ++count);
+		lua_pushboolean (L, 1);
+		lua_rawset (L, top + 2);
+	}
+
+	fclose (stream);
+
+	if (count > 0 && casc_prefetch_initialize (
+		L, storage, top + 1, storage->threads) == 1)
+	{
+		lua_createtable (L, 0, 1);
+		lua_insert (L, -2);
+		lua_setfield (L, -2, "warm");
+		lua_setuservalue (L, top);
+	}
+
+	lua_settop (L, top);
+}
+
 /**
  * `casc:__tostring ()`
  *
@@ -139,7 +944,18 @@ static const luaL_Reg
 storage_methods [] =
 {
 	{ "files", storage_files },
+	{ "names", storage_names },
+	{ "classify", storage_classify },
 	{ "open", storage_open },
+	{ "open_many", storage_open_many },
+	{ "read_many", storage_read_many },
+	{ "grep", storage_grep },
+	{ "read_encoded", storage_read_encoded },
+	{ "dir", storage_dir },
+	{ "walk", storage_walk },
+	{ "sync", storage_sync },
+	{ "pack", storage_pack },
+	{ "prefetch", storage_prefetch },
 	{ "close", storage_close },
 	{ "__tostring", storage_to_string },
 	{ "__gc", storage_close },
@@ -163,22 +979,103 @@ extern int
 casc_storage_initialize (
 	lua_State *L,
 	const char *path,
-	const int type)
+	const int type,
+	int options)
 {
+	CASC_OPEN_STORAGE_ARGS args;
 	HANDLE handle;
 
-	if (!CascOpenStorageEx (path, NULL, type, &handle))
+	memset (&args, 0, sizeof (args));
+	args.Size = sizeof (args);
+	args.szLocalPath = casc_option_string (L, options, "cache", NULL);
+	args.szCodeName = casc_option_string (L, options, "product", NULL);
+	args.szRegion = casc_option_string (L, options, "region", NULL);
+	args.szCdnHostUrl = casc_option_string (L, options, "cdn", NULL);
+
+	const lua_Integer threads = casc_option_integer (
+		L, options, "threads", CASC_THREADS_DEFAULT);
+
+	if (threads < 1 || threads > CASC_THREADS_MAXIMUM)
+	{
+		return luaL_error (L, "invalid number of threads");
+	}
+
+	const int lazy = casc_option_boolean (L, options, "lazy", 0);
+	const lua_Integer budget =
+		casc_option_integer (L, options, "memory_budget", 0);
+
+	if (budget < 0)
 	{
+		return luaL_error (L, "invalid memory budget");
+	}
+
+	const char *record =
+		casc_option_string (L, options, "record_profile", NULL);
+	const char *warm =
+		casc_option_string (L, options, "warm_profile", NULL);
+	FILE *profile = NULL;
+
+	if (record && !(profile = fopen (record, "w")))
+	{
+		SetCascError (ERROR_ACCESS_DENIED);
 		goto error;
 	}
 
+	struct CASC_Memory *memory = casc_memory_open (path, (size_t) budget);
+	const size_t length = strlen (path);
+	char *copy = casc_memory_allocate (memory, length + 1);
+
+	if (!copy)
+	{
+		casc_memory_close (memory);
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		goto close;
+	}
+
+	memcpy (copy, path, length + 1);
+
+	const uint64_t start = casc_trace_begin ();
+	const int status = CascOpenStorageEx (path, &args, type, &handle);
+
+	casc_trace_end (start, "open storage", path, 0);
+
+	if (!status)
+	{
+		const DWORD error = GetCascError ();
+		casc_memory_free (copy);
+		casc_memory_close (memory);
+		SetCascError (error);
+		goto close;
+	}
+
 	struct CASC_Storage *storage = lua_newuserdata (L, sizeof (*storage));
 	storage->handle = handle;
+	storage->tree = NULL;
+	storage->path = copy;
+	storage->online = type;
+	storage->threads = (int) threads;
+	storage->lazy = lazy;
+	storage->profile = profile;
+	storage->memory = memory;
 
 	storage_metatable (L);
 	casc_registry_open (L, storage);
+
+	if (warm)
+	{
+		storage_warm (L, storage, warm);
+	}
+
 	return 1;
 
+close:
+	if (profile)
+	{
+		const DWORD error = GetCascError ();
+		fclose (profile);
+		SetCascError (error);
+	}
+
 error:
 	return casc_result (L, 0);
 }
@@ -190,3 +1087,12 @@ casc_storage_access (
 {
 	return luaL_checkudata (L, index, CASC_STORAGE_METATABLE);
 }
+
+/* As `casc_storage_access ()`, but returns `NULL` rather than raising. */
+extern struct CASC_Storage *
+casc_storage_test (
+	lua_State *L,
+	int index)
+{
+	return luaL_testudata (L, index, CASC_STORAGE_METATABLE);
+}
@@ -3,21 +3,45 @@
 
 #include <CascPort.h>
 #include <lua.h>
+#include <stdio.h>
+
+struct CASC_Memory;
+struct CASC_Tree;
 
 struct CASC_Storage
 {
 	HANDLE handle;
+	struct CASC_Tree *tree;
+
+	/* As given to `casclib.open ()`, for locating local data files. */
+	char *path;
+	int online;
+
+	/* Where the names of opened files are recorded, or `NULL`. */
+	FILE *profile;
+
+	int threads;
+	int lazy;
+
+	/* The account of the native memory allocated for the storage. */
+	struct CASC_Memory *memory;
 };
 
 extern int
 casc_storage_initialize (
 	lua_State* L,
 	const char *path,
-	const int type);
+	const int type,
+	int options);
 
 extern struct CASC_Storage *
 casc_storage_access (
 	lua_State *L,
 	int index);
 
+extern struct CASC_Storage *
+casc_storage_test (
+	lua_State *L,
+	int index);
+
 #endif
@@ -0,0 +1,627 @@
+#include "sync.h"
+#include "common.h"
+#include "finder.h"
+#include "index.h"
+#include "memory.h"
+#include "storage.h"
+#include "trace.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <compat-5.3.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (_WIN32)
+#include <direct.h>
+#define sync_mkdir(path) _mkdir (path)
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#define sync_mkdir(path) mkdir (path, 0777)
+#endif
+
+#define CASC_SYNC_METATABLE "Casc Sync"
+
+#define SYNC_BUFFER_SIZE 0x10000
+#define SYNC_PATH_MAXIMUM 4096
+
+/* The marks of the entries of the storage. */
+#define SYNC_PENDING 0
+#define SYNC_DONE 1
+#define SYNC_FAILED 2
+
+/* The marks of the entries of the manifest. */
+#define SYNC_STALE 0
+#define SYNC_LIVE 1
+#define SYNC_MOVED 2
+
+struct CASC_Sync_Item
+{
+	struct CASC_Finder_Entry location;
+	struct CASC_Index_Entry *entry;
+};
+
+/*
+ * The state is held within a userdata so that everything is released by
+ * the garbage collector, even when an error is raised midway.
+ */
+struct CASC_Sync
+{
+	struct CASC_Index live;
+	struct CASC_Index manifest;
+
+	/*
+	 * The stale entries of the manifest, keyed by their content key (as
+	 * hexadecimal), with `size` holding their position within the manifest.
+	 * Used to turn a removal and an addition of the same content into a
+	 * rename.
+	 */
+	struct CASC_Index moves;
+
+	struct CASC_Sync_Item *items;
+	size_t item_count;
+
+	BYTE *buffer;
+	HANDLE find;
+
+	const char *destination;
+	char path [SYNC_PATH_MAXIMUM];
+	char other [SYNC_PATH_MAXIMUM];
+};
+
+static void
+sync_release (struct CASC_Sync *sync)
+{
+	if (sync->find)
+	{
+		CascFindClose (sync->find);
+		sync->find = NULL;
+	}
+
+	casc_index_release (&sync->live);
+	casc_index_release (&sync->manifest);
+	casc_index_release (&sync->moves);
+
+	casc_memory_free (sync->items);
+	sync->items = NULL;
+
+	casc_memory_free (sync->buffer);
+	sync->buffer = NULL;
+}
+
+static int
+sync_close (lua_State *L)
+{
+	sync_release (luaL_checkudata (L, 1, CASC_SYNC_METATABLE));
+	return 0;
+}
+
+static void
+sync_metatable (lua_State *L)
+{
+	if (luaL_newmetatable (L, CASC_SYNC_METATABLE))
+	{
+		lua_pushcfunction (L, sync_close);
+		lua_setfield (L, -2, "__gc");
+	}
+
+	lua_setmetatable (L, -2);
+}
+
+static void
+sync_hex (
+	const BYTE *key,
+	char *text)
+{
+	static const char digits [] = "0123456789abcdef";
+
+	for (int index = 0; index < MD5_HASH_SIZE; index++)
+	{
+		text [index * 2] = digits [key [index] >> 4];
+		text [index * 2 + 1] = digits [key [index] & 0x0F];
+	}
+
+	text [MD5_HASH_SIZE * 2] = '\0';
+}
+
+/*
+ * Builds the path of `name` within the destination into `path`, with any of
+ * `\` and `:` becoming directory separators.
+ */
+static int
+sync_path (
+	const struct CASC_Sync *sync,
+	const char *name,
+	char *path)
+{
+	const int length = snprintf (path, SYNC_PATH_MAXIMUM, "%s/%s",
+		sync->destination, name);
+
+	if (length < 0 || length >= SYNC_PATH_MAXIMUM)
+	{
+		SetCascError (ERROR_BUFFER_OVERFLOW);
+		return 0;
+	}
+
+	for (char *character = path + strlen (sync->destination) + 1;
+		*character; character++)
+	{
+		if (*character == '\\' || *character == ':')
+		{
+			*character = '/';
+		}
+	}
+
+	return 1;
+}
+
+/* Creates every missing directory leading up to `path`. */
+static void
+sync_directories (
+	const struct CASC_Sync *sync,
+	char *path)
+{
+	for (char *character = path + strlen (sync->destination) + 1;
+		*character; character++)
+	{
+		if (*character == '/')
+		{
+			*character = '\0';
+			sync_mkdir (path);
+			*character = '/';
+		}
+	}
+}
+
+/*
+ * Loads the manifest at `path`, each line of which holds the content key,
+ * size, and name of a file, separated by tabs.  A missing manifest is
+ * simply empty, as is the case for a first run.
+ */
+static int
+sync_load (
+	struct CASC_Sync *sync,
+	const char *path)
+{
+	FILE *stream = fopen (path, "r");
+	char line [SYNC_PATH_MAXIMUM + 64];
+	int status = 1;
+
+	if (!stream)
+	{
+		return 1;
+	}
+
+	while (fgets (line, sizeof (line), stream))
+	{
+		BYTE ckey [MD5_HASH_SIZE];
+		char *end;
+
+		line [strcspn (line, "\r\n")] = '\0';
+
+		if (!casc_parse_key (line, MD5_HASH_SIZE * 2, ckey)
+			|| line [MD5_HASH_SIZE * 2] != '\t')
+		{
+			continue;
+		}
+
+		const ULONGLONG size =
+			strtoull (line + MD5_HASH_SIZE * 2 + 1, &end, 10);
+
+		if (*end != '\t' || !end [1])
+		{
+			continue;
+		}
+
+		struct CASC_Index_Entry *entry =
+			casc_index_insert (&sync->manifest, end + 1);
+
+		if (!entry)
+		{
+			SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+			status = 0;
+			break;
+		}
+
+		memcpy (entry->ckey, ckey, sizeof (entry->ckey));
+		entry->size = size;
+	}
+
+	fclose (stream);
+	return status;
+}
+
+/* Writes the manifest to a temporary file, then moves it into place. */
+static int
+sync_save (
+	struct CASC_Sync *sync,
+	const char *path)
+{
+	char text [MD5_HASH_SIZE * 2 + 1];
+	const int length =
+		snprintf (sync->other, sizeof (sync->other), "%s.tmp", path);
+
+	if (length < 0 || (size_t) length >= sizeof (sync->other))
+	{
+		SetCascError (ERROR_BUFFER_OVERFLOW);
+		return 0;
+	}
+
+	FILE *stream = fopen (sync->other, "w");
+
+	if (!stream)
+	{
+		SetCascError (ERROR_ACCESS_DENIED);
+		return 0;
+	}
+
+	for (size_t position = 0; position < sync->live.count; position++)
+	{
+		const struct CASC_Index_Entry *entry =
+			&sync->live.entries [position];
+
+		if (entry->mark == SYNC_DONE)
+		{
+			sync_hex (entry->ckey, text);
+			fprintf (stream, "%s\t%llu\t%s\n", text,
+				(unsigned long long) entry->size, entry->name);
+		}
+	}
+
+	const int status = !ferror (stream);
+
+	if (fclose (stream) != 0 || !status)
+	{
+		remove (sync->other);
+		SetCascError (ERROR_DISK_FULL);
+		return 0;
+	}
+
+#if defined (_WIN32)
+	remove (path);
+#endif
+
+	if (rename (sync->other, path) != 0)
+	{
+		SetCascError (ERROR_ACCESS_DENIED);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Decodes the file `name` into its path within the destination. */
+static DWORD
+sync_extract (
+	struct CASC_Sync *sync,
+	const struct CASC_Storage *storage,
+	const char *name)
+{
+	HANDLE handle;
+	DWORD bytes_read;
+	DWORD error = ERROR_SUCCESS;
+
+	if (!sync_path (sync, name, sync->path))
+	{
+		return GetCascError ();
+	}
+
+	if (!CascOpenFile (storage->handle, name, 0, 0, &handle))
+	{
+		return GetCascError ();
+	}
+
+	sync_directories (sync, sync->path);
+	FILE *stream = fopen (sync->path, "wb");
+
+	if (!stream)
+	{
+		CascCloseFile (handle);
+		return ERROR_ACCESS_DENIED;
+	}
+
+	while (1)
+	{
+		if (!CascReadFile (handle, sync->buffer,
+			SYNC_BUFFER_SIZE, &bytes_read))
+		{
+			error = GetCascError ();
+			break;
+		}
+
+		if (bytes_read == 0)
+		{
+			break;
+		}
+
+		if (fwrite (sync->buffer, 1, bytes_read, stream) != bytes_read)
+		{
+			error = ERROR_DISK_FULL;
+			break;
+		}
+	}
+
+	CascCloseFile (handle);
+
+	if (fclose (stream) != 0 && error == ERROR_SUCCESS)
+	{
+		error = ERROR_DISK_FULL;
+	}
+
+	/* Leave no partial file behind, so that it is retried next time. */
+	if (error != ERROR_SUCCESS)
+	{
+		remove (sync->path);
+	}
+
+	return error;
+}
+
+static int
+sync_compare_item (
+	const void *a,
+	const void *b)
+{
+	const struct CASC_Sync_Item *left = a;
+	const struct CASC_Sync_Item *right = b;
+
+	return casc_finder_compare_location (&left->location, &right->location);
+}
+
+/*
+ * Compares the enumeration of the storage against the manifest, and marks
+ * every entry of either accordingly.  Returns the number of unchanged
+ * files.
+ */
+static lua_Integer
+sync_compare (struct CASC_Sync *sync)
+{
+	lua_Integer unchanged = 0;
+
+	for (size_t position = 0; position < sync->live.count; position++)
+	{
+		struct CASC_Index_Entry *entry = &sync->live.entries [position];
+		struct CASC_Index_Entry *match =
+			casc_index_find (&sync->manifest, entry->name);
+
+		if (!match)
+		{
+			continue;
+		}
+
+		match->mark = SYNC_LIVE;
+
+		if (match->size == entry->size
+			&& memcmp (match->ckey, entry->ckey, sizeof (entry->ckey)) == 0)
+		{
+			entry->mark = SYNC_DONE;
+			unchanged++;
+		}
+	}
+
+	return unchanged;
+}
+
+/*
+ * Renames the file of a stale entry of the manifest having the same content
+ * as `entry`, should there be one.
+ */
+static int
+sync_move (
+	struct CASC_Sync *sync,
+	struct CASC_Index_Entry *entry)
+{
+	char text [MD5_HASH_SIZE * 2 + 1];
+
+	sync_hex (entry->ckey, text);
+	struct CASC_Index_Entry *move = casc_index_find (&sync->moves, text);
+
+	if (!move || !move->mark)
+	{
+		return 0;
+	}
+
+	struct CASC_Index_Entry *source =
+		&sync->manifest.entries [(size_t) move->size];
+
+	if (!sync_path (sync, source->name, sync->other)
+		|| !sync_path (sync, entry->name, sync->path))
+	{
+		return 0;
+	}
+
+	sync_directories (sync, sync->path);
+
+	if (rename (sync->other, sync->path) != 0)
+	{
+		return 0;
+	}
+
+	move->mark = 0;
+	source->mark = SYNC_MOVED;
+	entry->mark = SYNC_DONE;
+	return 1;
+}
+
+static void
+sync_count (
+	lua_State *L,
+	int table,
+	const char *name,
+	lua_Integer count)
+{
+	lua_pushinteger (L, count);
+	lua_setfield (L, table, name);
+}
+
+/*
+ * Brings the `destination` directory up to date with the files of the
+ * storage (matching `pattern`), as recorded by the `manifest` of the
+ * previous run.  See `casc:sync ()`.
+ */
+extern int
+casc_sync_run (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	const char *destination,
+	const char *manifest,
+	const char *pattern,
+	const int plain)
+{
+	struct CASC_Sync *sync = lua_newuserdata (L, sizeof (*sync));
+	memset (sync, 0, sizeof (*sync));
+	casc_index_initialize (&sync->live, storage->memory);
+	casc_index_initialize (&sync->manifest, storage->memory);
+	casc_index_initialize (&sync->moves, storage->memory);
+	sync_metatable (L);
+
+	const int state = lua_gettop (L);
+	lua_Integer renamed = 0;
+	lua_Integer deleted = 0;
+	lua_Integer extracted = 0;
+
+	sync->destination = destination;
+	sync->buffer = casc_memory_allocate (storage->memory, SYNC_BUFFER_SIZE);
+
+	if (!sync->buffer)
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		goto error;
+	}
+
+	if (!casc_index_gather (
+			L, &sync->live, storage, &sync->find, pattern, plain)
+		|| !sync_load (sync, manifest))
+	{
+		goto error;
+	}
+
+	const lua_Integer unchanged = sync_compare (sync);
+
+	for (size_t position = 0; position < sync->manifest.count; position++)
+	{
+		const struct CASC_Index_Entry *entry =
+			&sync->manifest.entries [position];
+		char text [MD5_HASH_SIZE * 2 + 1];
+
+		if (entry->mark != SYNC_STALE)
+		{
+			continue;
+		}
+
+		sync_hex (entry->ckey, text);
+		struct CASC_Index_Entry *move =
+			casc_index_insert (&sync->moves, text);
+
+		if (!move)
+		{
+			SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+			goto error;
+		}
+
+		if (!move->mark)
+		{
+			move->mark = 1;
+			move->size = position;
+		}
+	}
+
+	sync->items = casc_memory_allocate_zeroed (storage->memory,
+		sync->live.count ? sync->live.count : 1, sizeof (*sync->items));
+
+	if (!sync->items)
+	{
+		SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+		goto error;
+	}
+
+	for (size_t position = 0; position < sync->live.count; position++)
+	{
+		struct CASC_Index_Entry *entry = &sync->live.entries [position];
+
+		if (entry->mark != SYNC_PENDING)
+		{
+			continue;
+		}
+
+		if (sync_move (sync, entry))
+		{
+			renamed++;
+			continue;
+		}
+
+		struct CASC_Sync_Item *item = &sync->items [sync->item_count++];
+		item->entry = entry;
+		casc_finder_locate (storage, entry->ekey,
+			&item->location.archive, &item->location.offset);
+	}
+
+	for (size_t position = 0; position < sync->manifest.count; position++)
+	{
+		const struct CASC_Index_Entry *entry =
+			&sync->manifest.entries [position];
+
+		if (entry->mark == SYNC_STALE
+			&& sync_path (sync, entry->name, sync->path)
+			&& remove (sync->path) == 0)
+		{
+			deleted++;
+		}
+	}
+
+	/* Extract in the order of the data, for mostly sequential reads. */
+	qsort (sync->items, sync->item_count, sizeof (*sync->items),
+		sync_compare_item);
+
+	lua_newtable (L);
+	const int failures = state + 1;
+
+	for (size_t position = 0; position < sync->item_count; position++)
+	{
+		struct CASC_Index_Entry *entry = sync->items [position].entry;
+		const uint64_t start = casc_trace_begin ();
+		const DWORD error = sync_extract (sync, storage, entry->name);
+
+		casc_trace_end (start, "sync", entry->name, entry->size);
+
+		if (error == ERROR_SUCCESS)
+		{
+			entry->mark = SYNC_DONE;
+			extracted++;
+			continue;
+		}
+
+		entry->mark = SYNC_FAILED;
+		lua_pushstring (L, strerror (error));
+		lua_setfield (L, failures, entry->name);
+	}
+
+	if (!sync_save (sync, manifest))
+	{
+		goto error;
+	}
+
+	lua_createtable (L, 0, 4);
+	sync_count (L, state + 2, "extracted", extracted);
+	sync_count (L, state + 2, "renamed", renamed);
+	sync_count (L, state + 2, "deleted", deleted);
+	sync_count (L, state + 2, "unchanged", unchanged);
+	lua_insert (L, failures);
+
+	sync_release (sync);
+	return 2;
+
+error:
+	{
+		const DWORD error = GetCascError ();
+		sync_release (sync);
+		SetCascError (error);
+	}
+
+	return casc_result (L, 0);
+}
@@ -0,0 +1,17 @@
+#ifndef CASC_SYNC_H
+#define CASC_SYNC_H
+
+#include <lua.h>
+
+struct CASC_Storage;
+
+extern int
+casc_sync_run (
+	lua_State *L,
+	const struct CASC_Storage *storage,
+	const char *destination,
+	const char *manifest,
+	const char *pattern,
+	const int plain);
+
+#endif
@@ -0,0 +1,181 @@
+#include "thread.h"
+
+#if defined (_WIN32)
+
+extern int
+casc_thread_create (
+	CASC_Thread *thread,
+	CASC_Thread_Function function,
+	void *argument)
+{
+	*thread = CreateThread (NULL, 0, function, argument, 0, NULL);
+	return *thread != NULL;
+}
+
+extern void
+casc_thread_join (
+	CASC_Thread thread)
+{
+	WaitForSingleObject (thread, INFINITE);
+	CloseHandle (thread);
+}
+
+extern void
+casc_mutex_initialize (
+	CASC_Mutex *mutex)
+{
+	InitializeCriticalSection (mutex);
+}
+
+extern void
+casc_mutex_destroy (
+	CASC_Mutex *mutex)
+{
+	DeleteCriticalSection (mutex);
+}
+
+extern void
+casc_mutex_lock (
+	CASC_Mutex *mutex)
+{
+	EnterCriticalSection (mutex);
+}
+
+extern void
+casc_mutex_unlock (
+	CASC_Mutex *mutex)
+{
+	LeaveCriticalSection (mutex);
+}
+
+extern void
+casc_condition_initialize (
+	CASC_Condition *condition)
+{
+	InitializeConditionVariable (condition);
+}
+
+extern void
+casc_condition_destroy (
+	CASC_Condition *condition)
+{
+	(void) condition;
+}
+
+extern void
+casc_condition_wait (
+	CASC_Condition *condition,
+	CASC_Mutex *mutex)
+{
+	SleepConditionVariableCS (condition, mutex, INFINITE);
+}
+
+extern void
+casc_condition_signal (
+	CASC_Condition *condition)
+{
+	WakeConditionVariable (condition);
+}
+
+extern void
+casc_condition_broadcast (
+	CASC_Condition *condition)
+{
+	WakeAllConditionVariable (condition);
+}
+
+extern void
+casc_memory_barrier (void)
+{
+	MemoryBarrier ();
+}
+
+#else
+
+extern int
+casc_thread_create (
+	CASC_Thread *thread,
+	CASC_Thread_Function function,
+	void *argument)
+{
+	return pthread_create (thread, NULL, function, argument) == 0;
+}
+
+extern void
+casc_thread_join (
+	CASC_Thread thread)
+{
+	pthread_join (thread, NULL);
+}
+
+extern void
+casc_mutex_initialize (
+	CASC_Mutex *mutex)
+{
+	pthread_mutex_init (mutex, NULL);
+}
+
+extern void
+casc_mutex_destroy (
+	CASC_Mutex *mutex)
+{
+	pthread_mutex_destroy (mutex);
+}
+
+extern void
+casc_mutex_lock (
+	CASC_Mutex *mutex)
+{
+	pthread_mutex_lock (mutex);
+}
+
+extern void
+casc_mutex_unlock (
+	CASC_Mutex *mutex)
+{
+	pthread_mutex_unlock (mutex);
+}
+
+extern void
+casc_condition_initialize (
+	CASC_Condition *condition)
+{
+	pthread_cond_init (condition, NULL);
+}
+
+extern void
+casc_condition_destroy (
+	CASC_Condition *condition)
+{
+	pthread_cond_destroy (condition);
+}
+
+extern void
+casc_condition_wait (
+	CASC_Condition *condition,
+	CASC_Mutex *mutex)
+{
+	pthread_cond_wait (condition, mutex);
+}
+
+extern void
+casc_condition_signal (
+	CASC_Condition *condition)
+{
+	pthread_cond_signal (condition);
+}
+
+extern void
+casc_condition_broadcast (
+	CASC_Condition *condition)
+{
+	pthread_cond_broadcast (condition);
+}
+
+extern void
+casc_memory_barrier (void)
+{
+	__sync_synchronize ();
+}
+
+#endif
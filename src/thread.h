@@ -0,0 +1,95 @@
+#ifndef CASC_THREAD_H
+#define CASC_THREAD_H
+
+/*
+ * A minimal portable layer over the native threading primitives, which is
+ * all the binding needs for its worker pools.
+ */
+
+#if defined (_WIN32)
+
+#include <windows.h>
+
+typedef HANDLE CASC_Thread;
+typedef CRITICAL_SECTION CASC_Mutex;
+typedef CONDITION_VARIABLE CASC_Condition;
+
+#define CASC_THREAD_FUNCTION(name) DWORD WINAPI name (LPVOID argument)
+#define CASC_THREAD_RETURN return 0
+#define CASC_THREAD_LOCAL __declspec (thread)
+
+typedef DWORD (WINAPI *CASC_Thread_Function) (LPVOID);
+
+#else
+
+#include <pthread.h>
+
+typedef pthread_t CASC_Thread;
+typedef pthread_mutex_t CASC_Mutex;
+typedef pthread_cond_t CASC_Condition;
+
+#define CASC_THREAD_FUNCTION(name) void *name (void *argument)
+#define CASC_THREAD_RETURN return NULL
+#define CASC_THREAD_LOCAL __thread
+
+typedef void *(*CASC_Thread_Function) (void *);
+
+#endif
+
+/* The number of worker threads used when none is specified. */
+#define CASC_THREADS_DEFAULT 4
+
+/* The upper limit on the number of worker threads of any pool. */
+#define CASC_THREADS_MAXIMUM 64
+
+extern int
+casc_thread_create (
+	CASC_Thread *thread,
+	CASC_Thread_Function function,
+	void *argument);
+
+extern void
+casc_thread_join (
+	CASC_Thread thread);
+
+extern void
+casc_mutex_initialize (
+	CASC_Mutex *mutex);
+
+extern void
+casc_mutex_destroy (
+	CASC_Mutex *mutex);
+
+extern void
+casc_mutex_lock (
+	CASC_Mutex *mutex);
+
+extern void
+casc_mutex_unlock (
+	CASC_Mutex *mutex);
+
+extern void
+casc_condition_initialize (
+	CASC_Condition *condition);
+
+extern void
+casc_condition_destroy (
+	CASC_Condition *condition);
+
+extern void
+casc_condition_wait (
+	CASC_Condition *condition,
+	CASC_Mutex *mutex);
+
+extern void
+casc_condition_signal (
+	CASC_Condition *condition);
+
+extern void
+casc_condition_broadcast (
+	CASC_Condition *condition);
+
+extern void
+casc_memory_barrier (void);
+
+#endif
@@ -0,0 +1,341 @@
+#include "trace.h"
+#include "thread.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined (_WIN32)
+#include <time.h>
+#endif
+
+struct CASC_Trace_Event
+{
+	/* Always a string literal, and so never copied. */
+	const char *name;
+	uint64_t start;
+	uint64_t duration;
+	uint64_t value;
+	char detail [CASC_TRACE_DETAIL];
+};
+
+/*
+ * Events of a single thread.  Only the owning thread writes to a ring, so
+ * recording requires no locking.  The `busy` flag is only there to let a
+ * flush wait for an event that is being written.
+ */
+struct CASC_Trace_Ring
+{
+	volatile int busy;
+	volatile uint64_t head;
+	int assigned;
+	struct CASC_Trace_Event events [CASC_TRACE_EVENTS];
+};
+
+/*
+ * Rings are never released, but returned to the pool when tracing stops.
+ * A thread holding on to a ring from a previous generation only ever
+ * takes a new one, so that the memory it points to remains valid.
+ */
+static struct
+{
+	CASC_Mutex mutex;
+	int initialized;
+
+	volatile int enabled;
+	volatile unsigned long generation;
+	uint64_t base;
+	FILE *stream;
+
+	struct CASC_Trace_Ring *rings [CASC_TRACE_THREADS];
+	int count;
+} trace;
+
+static CASC_THREAD_LOCAL struct CASC_Trace_Ring *trace_local;
+static CASC_THREAD_LOCAL unsigned long trace_local_generation;
+
+/* A monotonic clock, in microseconds. */
+static uint64_t
+trace_now (void)
+{
+#if defined (_WIN32)
+	LARGE_INTEGER counter;
+	LARGE_INTEGER frequency;
+
+	QueryPerformanceCounter (&counter);
+	QueryPerformanceFrequency (&frequency);
+
+	return (uint64_t) (counter.QuadPart / frequency.QuadPart * 1000000
+		+ counter.QuadPart % frequency.QuadPart * 1000000
+			/ frequency.QuadPart);
+#else
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000
+		+ (uint64_t) now.tv_nsec / 1000;
+#endif
+}
+
+/* Returns the ring of the calling thread, or `NULL` if none is left. */
+static struct CASC_Trace_Ring *
+trace_ring (void)
+{
+	const unsigned long generation = trace.generation;
+
+	if (trace_local && trace_local_generation == generation)
+	{
+		return trace_local;
+	}
+
+	struct CASC_Trace_Ring *ring = NULL;
+	casc_mutex_lock (&trace.mutex);
+
+	for (int index = 0; index < trace.count; index++)
+	{
+		if (!trace.rings [index]->assigned)
+		{
+			ring = trace.rings [index];
+			break;
+		}
+	}
+
+	if (!ring && trace.count < CASC_TRACE_THREADS)
+	{
+		/* Rings live as long as the process, outside of any account. */
+		ring = malloc (sizeof (*ring));
+
+		if (ring)
+		{
+			ring->busy = 0;
+			ring->head = 0;
+			trace.rings [trace.count++] = ring;
+		}
+	}
+
+	if (ring)
+	{
+		ring->assigned = 1;
+	}
+
+	casc_mutex_unlock (&trace.mutex);
+
+	trace_local = ring;
+	trace_local_generation = generation;
+	return ring;
+}
+
+extern uint64_t
+casc_trace_begin (void)
+{
+	return trace.enabled ? trace_now () : 0;
+}
+
+/*
+ * Records an event, named `name`, lasting from `start` until now.  Both the
+ * `detail` (which can be `NULL`) and `value` are shown as arguments.
+ */
+extern void
+casc_trace_end (
+	uint64_t start,
+	const char *name,
+	const char *detail,
+	uint64_t value)
+{
+	if (!start || !trace.enabled)
+	{
+		return;
+	}
+
+	const uint64_t end = trace_now ();
+	struct CASC_Trace_Ring *ring = trace_ring ();
+
+	if (!ring)
+	{
+		return;
+	}
+
+	ring->busy = 1;
+	casc_memory_barrier ();
+
+	if (trace.enabled && trace_local_generation == trace.generation)
+	{
+		struct CASC_Trace_Event *event =
+			&ring->events [ring->head % CASC_TRACE_EVENTS];
+
+		event->name = name;
+		event->start = start;
+		event->duration = end - start;
+		event->value = value;
+		event->detail [0] = '\0';
+
+		if (detail)
+		{
+			strncat (event->detail, detail, sizeof (event->detail) - 1);
+		}
+
+		casc_memory_barrier ();
+		ring->head++;
+	}
+
+	casc_memory_barrier ();
+	ring->busy = 0;
+}
+
+static void
+trace_write_string (
+	FILE *stream,
+	const char *text)
+{
+	fputc ('"', stream);
+
+	for (; *text; text++)
+	{
+		const unsigned char character = (unsigned char) *text;
+
+		if (character == '"' || character == '\\')
+		{
+			fprintf (stream, "\\%c", character);
+		}
+		else if (character < 0x20)
+		{
+			fprintf (stream, "\\u%04x", character);
+		}
+		else
+		{
+			fputc (character, stream);
+		}
+	}
+
+	fputc ('"', stream);
+}
+
+/* Writes the events of every ring, and returns the rings to the pool. */
+static int
+trace_flush (void)
+{
+	FILE *stream = trace.stream;
+	int first = 1;
+
+	trace.enabled = 0;
+	trace.generation++;
+	casc_memory_barrier ();
+
+	fputs ("{\"traceEvents\":[", stream);
+
+	for (int index = 0; index < trace.count; index++)
+	{
+		struct CASC_Trace_Ring *ring = trace.rings [index];
+
+		while (ring->busy)
+		{
+			casc_memory_barrier ();
+		}
+
+		const uint64_t head = ring->head;
+		uint64_t position = head > CASC_TRACE_EVENTS
+			? head - CASC_TRACE_EVENTS : 0;
+
+		for (; position < head; position++)
+		{
+			const struct CASC_Trace_Event *event =
+				&ring->events [position % CASC_TRACE_EVENTS];
+			const uint64_t start = event->start > trace.base
+				? event->start - trace.base : 0;
+
+			fprintf (stream, "%s\n{\"name\":", first ? "" : ",");
+			trace_write_string (stream, event->name);
+			fprintf (stream, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+				"\"ts\":%llu,\"dur\":%llu,\"args\":{\"detail\":",
+				index + 1,
+				(unsigned long long) start,
+				(unsigned long long) event->duration);
+			trace_write_string (stream, event->detail);
+			fprintf (stream, ",\"value\":%llu}}",
+				(unsigned long long) event->value);
+
+			first = 0;
+		}
+
+		ring->head = 0;
+		ring->assigned = 0;
+	}
+
+	fputs ("\n],\"displayTimeUnit\":\"ms\"}\n", stream);
+
+	const int status = !ferror (stream);
+
+	if (fclose (stream) != 0 || !status)
+	{
+		trace.stream = NULL;
+		SetCascError (ERROR_CAN_NOT_COMPLETE);
+		return 0;
+	}
+
+	trace.stream = NULL;
+	return 1;
+}
+
+/* Must be called (once) before any other function. */
+extern void
+casc_trace_initialize (void)
+{
+	if (!trace.initialized)
+	{
+		casc_mutex_initialize (&trace.mutex);
+		trace.initialized = 1;
+	}
+}
+
+/*
+ * Starts recording events, to be written to `path` once tracing stops.  A
+ * trace that is already being recorded is stopped (and written) first.
+ */
+extern int
+casc_trace_start (
+	const char *path)
+{
+	int status = 1;
+	casc_mutex_lock (&trace.mutex);
+
+	if (trace.stream)
+	{
+		status = trace_flush ();
+	}
+
+	FILE *stream = fopen (path, "w");
+
+	if (!stream)
+	{
+		SetCascError (ERROR_FILE_NOT_FOUND);
+		status = 0;
+	}
+	else
+	{
+		trace.stream = stream;
+		trace.base = trace_now ();
+		casc_memory_barrier ();
+		trace.enabled = 1;
+	}
+
+	casc_mutex_unlock (&trace.mutex);
+	return status;
+}
+
+/* Stops recording events, and writes them out.  Does nothing otherwise. */
+extern int
+casc_trace_stop (void)
+{
+	int status = 1;
+	casc_mutex_lock (&trace.mutex);
+
+	if (trace.stream)
+	{
+		status = trace_flush ();
+	}
+
+	casc_mutex_unlock (&trace.mutex);
+	return status;
+}
@@ -0,0 +1,41 @@
+#ifndef CASC_TRACE_H
+#define CASC_TRACE_H
+
+#include <stdint.h>
+
+/* The number of events kept by each thread, with older ones overwritten. */
+#define CASC_TRACE_EVENTS 4096
+
+/* The upper limit on the number of threads that can record events. */
+#define CASC_TRACE_THREADS 128
+
+/* The number of bytes of the detail of an event that are kept. */
+#define CASC_TRACE_DETAIL 72
+
+/*
+ * Operations are traced by taking a timestamp with `casc_trace_begin ()`
+ * before them, and passing it to `casc_trace_end ()` after them.  When
+ * tracing is disabled, the former returns `0`, and the latter does nothing
+ * with it, so that the cost is a single test.
+ */
+extern uint64_t
+casc_trace_begin (void);
+
+extern void
+casc_trace_end (
+	uint64_t start,
+	const char *name,
+	const char *detail,
+	uint64_t value);
+
+extern void
+casc_trace_initialize (void);
+
+extern int
+casc_trace_start (
+	const char *path);
+
+extern int
+casc_trace_stop (void);
+
+#endif
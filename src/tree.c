@@ -0,0 +1,559 @@
+#include "tree.h"
+#include "index.h"
+#include "memory.h"
+#include "storage.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <compat-5.3.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Maps a `(parent, component)` pair to its node while building, with
+ * `slots` holding one-based node indices (zero marking an empty slot).
+ */
+struct Tree_Map
+{
+	uint32_t *slots;
+	size_t mask;
+};
+
+struct Tree_Rank
+{
+	const char *name;
+	uint32_t component;
+};
+
+struct Tree_Order
+{
+	uint32_t parent;
+	uint32_t rank;
+	uint32_t node;
+};
+
+static int
+tree_separator (char character)
+{
+	return character == '\\' || character == '/' || character == ':';
+}
+
+static size_t
+tree_hash (
+	uint32_t parent,
+	uint32_t component)
+{
+	uint64_t hash = ((uint64_t) parent << 32) | component;
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccd;
+	hash ^= hash >> 33;
+
+	return (size_t) hash;
+}
+
+static uint32_t *
+tree_slot (
+	const struct CASC_Tree *tree,
+	const struct Tree_Map *map,
+	uint32_t parent,
+	uint32_t component)
+{
+	size_t slot = tree_hash (parent, component) & map->mask;
+
+	while (map->slots [slot])
+	{
+		const struct CASC_Tree_Node *node =
+			&tree->nodes [map->slots [slot] - 1];
+
+		if (node->parent == parent && node->component == component)
+		{
+			break;
+		}
+
+		slot = (slot + 1) & map->mask;
+	}
+
+	return &map->slots [slot];
+}
+
+static int
+tree_rehash (
+	const struct CASC_Tree *tree,
+	struct Tree_Map *map)
+{
+	const size_t length = map->slots ? (map->mask + 1) * 2 : 4096;
+	uint32_t *slots = casc_memory_allocate_zeroed (
+		tree->memory, length, sizeof (*slots));
+
+	if (!slots)
+	{
+		return 0;
+	}
+
+	casc_memory_free (map->slots);
+	map->slots = slots;
+	map->mask = length - 1;
+
+	for (size_t index = 1; index < tree->count; index++)
+	{
+		const struct CASC_Tree_Node *node = &tree->nodes [index];
+		*tree_slot (tree, map, node->parent, node->component) =
+			(uint32_t) index + 1;
+	}
+
+	return 1;
+}
+
+/* Returns the child of `parent` named `component`, creating it if new. */
+static uint32_t
+tree_child (
+	struct CASC_Tree *tree,
+	struct Tree_Map *map,
+	uint32_t parent,
+	const char *component,
+	char separator)
+{
+	struct CASC_Index_Entry *entry =
+		casc_index_insert (&tree->components, component);
+
+	if (!entry || tree->count >= CASC_TREE_NONE - 1)
+	{
+		return CASC_TREE_NONE;
+	}
+
+	const uint32_t id = (uint32_t) (entry - tree->components.entries);
+
+	if (!map->slots || tree->count >= (map->mask + 1) / 2)
+	{
+		if (!tree_rehash (tree, map))
+		{
+			return CASC_TREE_NONE;
+		}
+	}
+
+	uint32_t *slot = tree_slot (tree, map, parent, id);
+
+	if (*slot)
+	{
+		return *slot - 1;
+	}
+
+	if (tree->count == tree->capacity)
+	{
+		const size_t capacity = tree->capacity * 2;
+		struct CASC_Tree_Node *nodes =
+			casc_memory_reallocate (
+				tree->memory, tree->nodes, capacity * sizeof (*nodes));
+
+		if (!nodes)
+		{
+			return CASC_TREE_NONE;
+		}
+
+		tree->nodes = nodes;
+		tree->capacity = capacity;
+	}
+
+	struct CASC_Tree_Node *node = &tree->nodes [tree->count];
+	memset (node, 0, sizeof (*node));
+	node->component = id;
+	node->parent = parent;
+	node->separator = separator;
+
+	*slot = (uint32_t) ++tree->count;
+	return *slot - 1;
+}
+
+/* Splits `name` into its components, adding each to the tree. */
+static int
+tree_insert (
+	struct CASC_Tree *tree,
+	struct Tree_Map *map,
+	const char *name)
+{
+	char component [MAX_PATH];
+	uint32_t node = CASC_TREE_ROOT;
+	char separator = '\0';
+
+	while (*name)
+	{
+		size_t length = 0;
+
+		while (name [length] && !tree_separator (name [length]))
+		{
+			length++;
+		}
+
+		if (length > 0 && length < sizeof (component))
+		{
+			memcpy (component, name, length);
+			component [length] = '\0';
+
+			node = tree_child (tree, map, node, component, separator);
+
+			if (node == CASC_TREE_NONE)
+			{
+				return 0;
+			}
+		}
+
+		name += length;
+
+		if (*name)
+		{
+			separator = *name++;
+		}
+	}
+
+	if (node != CASC_TREE_ROOT)
+	{
+		tree->nodes [node].file = 1;
+	}
+
+	return 1;
+}
+
+static int
+tree_compare_rank (
+	const void *a,
+	const void *b)
+{
+	const struct Tree_Rank *left = a;
+	const struct Tree_Rank *right = b;
+
+	return strcmp (left->name, right->name);
+}
+
+static int
+tree_compare_order (
+	const void *a,
+	const void *b)
+{
+	const struct Tree_Order *left = a;
+	const struct Tree_Order *right = b;
+
+	if (left->parent != right->parent)
+	{
+		return left->parent < right->parent ? -1 : 1;
+	}
+
+	return left->rank < right->rank ? -1 : left->rank > right->rank;
+}
+
+/* Lays out the children of every node, sorted by name. */
+static int
+tree_link (struct CASC_Tree *tree)
+{
+	const size_t components = tree->components.count;
+	const size_t count = tree->count;
+
+	const size_t length = components ? components : 1;
+	struct Tree_Rank *ranks = casc_memory_allocate_zeroed (
+		tree->memory, length, sizeof (*ranks));
+	uint32_t *rank = casc_memory_allocate_zeroed (
+		tree->memory, length, sizeof (*rank));
+	struct Tree_Order *order = casc_memory_allocate_zeroed (
+		tree->memory, count, sizeof (*order));
+	tree->children = casc_memory_allocate_zeroed (
+		tree->memory, count, sizeof (*tree->children));
+
+	if (!ranks || !rank || !order || !tree->children)
+	{
+		casc_memory_free (ranks);
+		casc_memory_free (rank);
+		casc_memory_free (order);
+		return 0;
+	}
+
+	for (size_t index = 0; index < components; index++)
+	{
+		ranks [index].name = tree->components.entries [index].name;
+		ranks [index].component = (uint32_t) index;
+	}
+
+	qsort (ranks, components, sizeof (*ranks), tree_compare_rank);
+
+	for (size_t index = 0; index < components; index++)
+	{
+		rank [ranks [index].component] = (uint32_t) index;
+	}
+
+	/* The root is no one's child, and is excluded. */
+	for (size_t index = 1; index < count; index++)
+	{
+		order [index - 1].parent = tree->nodes [index].parent;
+		order [index - 1].rank = rank [tree->nodes [index].component];
+		order [index - 1].node = (uint32_t) index;
+	}
+
+	qsort (order, count - 1, sizeof (*order), tree_compare_order);
+
+	for (size_t index = 0; index + 1 < count; index++)
+	{
+		struct CASC_Tree_Node *parent = &tree->nodes [order [index].parent];
+		struct CASC_Tree_Node *node = &tree->nodes [order [index].node];
+
+		if (parent->count == 0)
+		{
+			parent->first = (uint32_t) index;
+		}
+
+		node->sibling = parent->count++;
+		tree->children [index] = order [index].node;
+	}
+
+	casc_memory_free (ranks);
+	casc_memory_free (rank);
+	casc_memory_free (order);
+	return 1;
+}
+
+/*
+ * Builds the tree from a single enumeration of `storage`.  Returns `NULL`
+ * on failure, with the CascLib error state set.
+ */
+extern struct CASC_Tree *
+casc_tree_build (
+	const struct CASC_Storage *storage)
+{
+	struct CASC_Tree *tree =
+		casc_memory_allocate_zeroed (storage->memory, 1, sizeof (*tree));
+	struct Tree_Map map = { NULL, 0 };
+	CASC_FIND_DATA data;
+	DWORD error = ERROR_NOT_ENOUGH_MEMORY;
+
+	if (!tree)
+	{
+		goto error;
+	}
+
+	casc_index_initialize (&tree->components, storage->memory);
+	tree->memory = storage->memory;
+	tree->capacity = 4096;
+
+	if (!(tree->nodes = casc_memory_allocate_zeroed (
+		tree->memory, tree->capacity, sizeof (*tree->nodes))))
+	{
+		goto error;
+	}
+
+	tree->nodes [CASC_TREE_ROOT].parent = CASC_TREE_NONE;
+	tree->count = 1;
+
+	SetCascError (ERROR_SUCCESS);
+	HANDLE find = CascFindFirstFile (storage->handle, "*", &data, NULL);
+	int status = !!find;
+
+	for (; status; status = CascFindNextFile (find, &data))
+	{
+		if (!tree_insert (tree, &map, data.szFileName))
+		{
+			SetCascError (ERROR_NOT_ENOUGH_MEMORY);
+			break;
+		}
+	}
+
+	error = GetCascError ();
+
+	if (find)
+	{
+		CascFindClose (find);
+	}
+
+	if (error != ERROR_SUCCESS)
+	{
+		goto error;
+	}
+
+	casc_memory_free (map.slots);
+	map.slots = NULL;
+
+	if (!tree_link (tree))
+	{
+		error = ERROR_NOT_ENOUGH_MEMORY;
+		goto error;
+	}
+
+	return tree;
+
+error:
+	casc_memory_free (map.slots);
+	casc_tree_free (tree);
+	SetCascError (error);
+	return NULL;
+}
+
+extern void
+casc_tree_free (
+	struct CASC_Tree *tree)
+{
+	if (!tree)
+	{
+		return;
+	}
+
+	casc_index_release (&tree->components);
+	casc_memory_free (tree->nodes);
+	casc_memory_free (tree->children);
+	casc_memory_free (tree);
+}
+
+/*
+ * Returns the node of `path`, whose components can be separated by any of
+ * `/`, `\`, or `:`.  An empty `path` is the root.  Returns `CASC_TREE_NONE`
+ * if there is no such node.
+ */
+extern uint32_t
+casc_tree_resolve (
+	const struct CASC_Tree *tree,
+	const char *path)
+{
+	char component [MAX_PATH];
+	uint32_t node = CASC_TREE_ROOT;
+
+	while (*path)
+	{
+		size_t length = 0;
+
+		while (path [length] && !tree_separator (path [length]))
+		{
+			length++;
+		}
+
+		if (length >= sizeof (component))
+		{
+			return CASC_TREE_NONE;
+		}
+
+		if (length > 0)
+		{
+			memcpy (component, path, length);
+			component [length] = '\0';
+
+			const struct CASC_Tree_Node *parent = &tree->nodes [node];
+			uint32_t low = parent->first;
+			uint32_t high = parent->first + parent->count;
+
+			node = CASC_TREE_NONE;
+
+			while (low < high)
+			{
+				const uint32_t middle = low + (high - low) / 2;
+				const uint32_t child = tree->children [middle];
+				const int order = strcmp (
+					casc_tree_component (tree, child), component);
+
+				if (order == 0)
+				{
+					node = child;
+					break;
+				}
+
+				if (order < 0)
+				{
+					low = middle + 1;
+				}
+				else
+				{
+					high = middle;
+				}
+			}
+
+			if (node == CASC_TREE_NONE)
+			{
+				return node;
+			}
+		}
+
+		path += length;
+
+		if (*path)
+		{
+			path++;
+		}
+	}
+
+	return node;
+}
+
+/*
+ * Returns the node following `node` in a depth first walk of the subtree
+ * of `start` (excluding `start` itself), or `CASC_TREE_NONE` at the end.
+ */
+extern uint32_t
+casc_tree_next (
+	const struct CASC_Tree *tree,
+	uint32_t start,
+	uint32_t node)
+{
+	if (tree->nodes [node].count > 0)
+	{
+		return tree->children [tree->nodes [node].first];
+	}
+
+	while (node != start)
+	{
+		const struct CASC_Tree_Node *current = &tree->nodes [node];
+		const struct CASC_Tree_Node *parent =
+			&tree->nodes [current->parent];
+
+		if (current->sibling + 1 < parent->count)
+		{
+			return tree->children [parent->first + current->sibling + 1];
+		}
+
+		node = current->parent;
+	}
+
+	return CASC_TREE_NONE;
+}
+
+extern const char *
+casc_tree_component (
+	const struct CASC_Tree *tree,
+	uint32_t node)
+{
+	return tree->components.entries [tree->nodes [node].component].name;
+}
+
+static void
+tree_add_path (
+	luaL_Buffer *buffer,
+	const struct CASC_Tree *tree,
+	uint32_t node)
+{
+	const struct CASC_Tree_Node *current = &tree->nodes [node];
+
+	if (current->parent != CASC_TREE_ROOT)
+	{
+		tree_add_path (buffer, tree, current->parent);
+		luaL_addchar (buffer, current->separator);
+	}
+
+	luaL_addstring (buffer, casc_tree_component (tree, node));
+}
+
+/*
+ * Pushes the full name of `node`, using the separators of the original
+ * name, such that it can be used to open the file.
+ */
+extern void
+casc_tree_push_path (
+	lua_State *L,
+	const struct CASC_Tree *tree,
+	uint32_t node)
+{
+	luaL_Buffer buffer;
+	luaL_buffinit (L, &buffer);
+
+	if (node != CASC_TREE_ROOT)
+	{
+		tree_add_path (&buffer, tree, node);
+	}
+
+	luaL_pushresult (&buffer);
+}
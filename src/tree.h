@@ -0,0 +1,82 @@
+#ifndef CASC_TREE_H
+#define CASC_TREE_H
+
+#include "index.h"
+#include <lua.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CASC_TREE_ROOT 0
+#define CASC_TREE_NONE ((uint32_t) -1)
+
+struct CASC_Memory;
+struct CASC_Storage;
+
+struct CASC_Tree_Node
+{
+	uint32_t component;
+	uint32_t parent;
+
+	/* The children are `children [first]` to `children [first + count)`. */
+	uint32_t first;
+	uint32_t count;
+
+	/* The position of this node amongst the children of its parent. */
+	uint32_t sibling;
+
+	/* The separator preceding the component in the original name. */
+	char separator;
+
+	/* Whether the node is a file, even when it has children. */
+	char file;
+};
+
+/*
+ * The file names of a storage, as a tree of path components.  Each
+ * distinct component is interned once, and the children of each node are
+ * sorted by name.
+ */
+struct CASC_Tree
+{
+	struct CASC_Index components;
+
+	struct CASC_Tree_Node *nodes;
+	size_t count;
+	size_t capacity;
+
+	uint32_t *children;
+
+	struct CASC_Memory *memory;
+};
+
+extern struct CASC_Tree *
+casc_tree_build (
+	const struct CASC_Storage *storage);
+
+extern void
+casc_tree_free (
+	struct CASC_Tree *tree);
+
+extern uint32_t
+casc_tree_resolve (
+	const struct CASC_Tree *tree,
+	const char *path);
+
+extern uint32_t
+casc_tree_next (
+	const struct CASC_Tree *tree,
+	uint32_t start,
+	uint32_t node);
+
+extern const char *
+casc_tree_component (
+	const struct CASC_Tree *tree,
+	uint32_t node);
+
+extern void
+casc_tree_push_path (
+	lua_State *L,
+	const struct CASC_Tree *tree,
+	uint32_t node);
+
+#endif
@@ -0,0 +1,542 @@
+#include "unpack.h"
+#include "common.h"
+#include "file.h"
+#include <CascLib.h>
+#include <CascPort.h>
+#include <compat-5.3.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * This follows the format of `string.unpack` from Lua 5.3, excluding the
+ * `X` option.  Integers are limited to at most eight bytes.
+ */
+
+#define UNPACK_INTEGER_MAXIMUM 8
+
+#define UNPACK_INTEGER 0
+#define UNPACK_UNSIGNED 1
+#define UNPACK_FLOAT 2
+#define UNPACK_DOUBLE 3
+#define UNPACK_NUMBER 4
+#define UNPACK_FIXED 5
+#define UNPACK_STRING 6
+#define UNPACK_ZERO 7
+#define UNPACK_PADDING 8
+#define UNPACK_NONE 9
+
+static const union
+{
+	int dummy;
+	char little;
+}
+native = { 1 };
+
+struct Unpack_State
+{
+	lua_State *L;
+	struct CASC_File *file;
+	const char *format;
+	int little;
+	size_t alignment;
+};
+
+static int
+unpack_digit (int character)
+{
+	return character >= '0' && character <= '9';
+}
+
+static size_t
+unpack_number (
+	struct Unpack_State *state,
+	size_t fallback)
+{
+	if (!unpack_digit (*state->format))
+	{
+		return fallback;
+	}
+
+	size_t number = 0;
+
+	while (unpack_digit (*state->format) && number < 0x10000000)
+	{
+		number = number * 10 + (size_t) (*state->format++ - '0');
+	}
+
+	return number;
+}
+
+static size_t
+unpack_limit (
+	struct Unpack_State *state,
+	size_t fallback)
+{
+	const size_t size = unpack_number (state, fallback);
+
+	if (size < 1 || size > UNPACK_INTEGER_MAXIMUM)
+	{
+		luaL_error (state->L, "integral size (%d) out of limits [1,%d]",
+			(int) size, UNPACK_INTEGER_MAXIMUM);
+	}
+
+	return size;
+}
+
+/* Reads the next option, storing its size, and returns its kind. */
+static int
+unpack_option (
+	struct Unpack_State *state,
+	size_t *size)
+{
+	const int option = *state->format++;
+	*size = 0;
+
+	switch (option)
+	{
+		case 'b': *size = 1; return UNPACK_INTEGER;
+		case 'B': *size = 1; return UNPACK_UNSIGNED;
+		case 'h': *size = sizeof (short); return UNPACK_INTEGER;
+		case 'H': *size = sizeof (short); return UNPACK_UNSIGNED;
+		case 'l': *size = sizeof (long); return UNPACK_INTEGER;
+		case 'L': *size = sizeof (long); return UNPACK_UNSIGNED;
+		case 'j': *size = sizeof (lua_Integer); return UNPACK_INTEGER;
+		case 'J': *size = sizeof (lua_Integer); return UNPACK_UNSIGNED;
+		case 'T': *size = sizeof (size_t); return UNPACK_UNSIGNED;
+		case 'f': *size = sizeof (float); return UNPACK_FLOAT;
+		case 'd': *size = sizeof (double); return UNPACK_DOUBLE;
+		case 'n': *size = sizeof (lua_Number); return UNPACK_NUMBER;
+		case 'z': return UNPACK_ZERO;
+		case 'x': *size = 1; return UNPACK_PADDING;
+
+		case 'i':
+		{
+			*size = unpack_limit (state, sizeof (int));
+			return UNPACK_INTEGER;
+		}
+
+		case 'I':
+		{
+			*size = unpack_limit (state, sizeof (int));
+			return UNPACK_UNSIGNED;
+		}
+
+		case 's':
+		{
+			*size = unpack_limit (state, sizeof (size_t));
+			return UNPACK_STRING;
+		}
+
+		case 'c':
+		{
+			*size = unpack_number (state, (size_t) -1);
+
+			if (*size == (size_t) -1)
+			{
+				luaL_error (state->L, "missing size for format option 'c'");
+			}
+
+			return UNPACK_FIXED;
+		}
+
+		case ' ': break;
+		case '<': state->little = 1; break;
+		case '>': state->little = 0; break;
+		case '=': state->little = native.little; break;
+
+		case '!':
+		{
+			state->alignment = unpack_number (state, sizeof (double));
+			break;
+		}
+
+		default:
+		{
+			luaL_error (state->L, "invalid format option '%c'", option);
+		}
+	}
+
+	return UNPACK_NONE;
+}
+
+/*
+ * Reads exactly `count` bytes.  Returns `1` on success, `0` on error (with
+ * the CascLib error state set), or `-1` at the end of the file.
+ */
+static int
+unpack_read (
+	struct Unpack_State *state,
+	void *buffer,
+	size_t count)
+{
+	size_t total;
+
+	if (!casc_file_fetch (state->file, buffer, count, &total))
+	{
+		return 0;
+	}
+
+	return total == count ? 1 : -1;
+}
+
+static int
+unpack_integer (
+	struct Unpack_State *state,
+	size_t size,
+	int is_signed)
+{
+	BYTE bytes [UNPACK_INTEGER_MAXIMUM];
+	const int status = unpack_read (state, bytes, size);
+
+	if (status != 1)
+	{
+		return status;
+	}
+
+	lua_Unsigned value = 0;
+
+	for (size_t index = 0; index < size; index++)
+	{
+		const size_t byte = state->little ? size - 1 - index : index;
+		value = (value << 8) | bytes [byte];
+	}
+
+	if (is_signed && size < sizeof (lua_Unsigned))
+	{
+		const lua_Unsigned mask = (lua_Unsigned) 1 << (size * 8 - 1);
+		value = (value ^ mask) - mask;
+	}
+
+	lua_pushinteger (state->L, (lua_Integer) value);
+	return 1;
+}
+
+static int
+unpack_float (
+	struct Unpack_State *state,
+	int kind,
+	size_t size)
+{
+	BYTE bytes [sizeof (double)];
+	const int status = unpack_read (state, bytes, size);
+
+	if (status != 1)
+	{
+		return status;
+	}
+
+	if (state->little != native.little)
+	{
+		for (size_t index = 0; index < size / 2; index++)
+		{
+			const BYTE byte = bytes [index];
+			bytes [index] = bytes [size - 1 - index];
+			bytes [size - 1 - index] = byte;
+		}
+	}
+
+	if (kind == UNPACK_FLOAT)
+	{
+		float value;
+		memcpy (&value, bytes, sizeof (value));
+		lua_pushnumber (state->L, (lua_Number) value);
+	}
+	else if (kind == UNPACK_DOUBLE)
+	{
+		double value;
+		memcpy (&value, bytes, sizeof (value));
+		lua_pushnumber (state->L, (lua_Number) value);
+	}
+	else
+	{
+		lua_Number value;
+		memcpy (&value, bytes, sizeof (value));
+		lua_pushnumber (state->L, value);
+	}
+
+	return 1;
+}
+
+/* Decodes a fixed size string directly into the resulting `string`. */
+static int
+unpack_fixed (
+	struct Unpack_State *state,
+	size_t size)
+{
+	const ULONGLONG remaining = state->file->size > state->file->position
+		? state->file->size - state->file->position : 0;
+
+	if (size > remaining)
+	{
+		return -1;
+	}
+
+	luaL_Buffer buffer;
+	luaL_buffinit (state->L, &buffer);
+
+	char *data = luaL_prepbuffsize (&buffer, size);
+	const int status = unpack_read (state, data, size);
+
+	luaL_addsize (&buffer, size);
+	luaL_pushresult (&buffer);
+
+	if (status != 1)
+	{
+		lua_pop (state->L, 1);
+	}
+
+	return status;
+}
+
+static int
+unpack_zero (struct Unpack_State *state)
+{
+	luaL_Buffer buffer;
+	luaL_buffinit (state->L, &buffer);
+
+	const BYTE *data;
+	size_t available;
+	int status = -1;
+
+	/* The buffer may allocate, which must not evict the window. */
+	casc_cache_pin (&state->file->cache);
+
+	while (casc_file_window (state->file, &data, &available))
+	{
+		if (available == 0)
+		{
+			break;
+		}
+
+		const BYTE *end = memchr (data, '\0', available);
+		const size_t length = end ? (size_t) (end - data) : available;
+
+		luaL_addlstring (&buffer, (const char *) data, length);
+		state->file->position += length;
+
+		if (end)
+		{
+			state->file->position++;
+			status = 1;
+			break;
+		}
+	}
+
+	casc_cache_unpin (&state->file->cache);
+
+	if (status == -1 && GetCascError () != ERROR_SUCCESS)
+	{
+		status = 0;
+	}
+
+	luaL_pushresult (&buffer);
+
+	if (status != 1)
+	{
+		lua_pop (state->L, 1);
+	}
+
+	return status;
+}
+
+/* Returns the alignment of an option of `size`, raising if invalid. */
+static size_t
+unpack_alignment (
+	struct Unpack_State *state,
+	size_t size)
+{
+	const size_t alignment =
+		size < state->alignment ? size : state->alignment;
+
+	if (alignment > 1 && (alignment & (alignment - 1)) != 0)
+	{
+		luaL_error (state->L, "format asks for alignment not power of 2");
+	}
+
+	return alignment;
+}
+
+/* Skips padding so that an option of `size` is suitably aligned. */
+static int
+unpack_align (
+	struct Unpack_State *state,
+	size_t size)
+{
+	const size_t alignment = unpack_alignment (state, size);
+
+	if (alignment <= 1)
+	{
+		return 1;
+	}
+
+	const size_t padding = (size_t) (alignment
+		- (state->file->position & (alignment - 1))) & (alignment - 1);
+
+	if (state->file->position + padding > state->file->size)
+	{
+		return -1;
+	}
+
+	state->file->position += padding;
+	return 1;
+}
+
+/*
+ * Walks the format of `state` without reading anything, such that any
+ * error it holds is raised before the position of the file is altered.
+ * Also ensures there is stack space for every value.
+ */
+static void
+unpack_validate (const struct Unpack_State *state)
+{
+	struct Unpack_State copy = *state;
+	int results = 0;
+
+	while (*copy.format)
+	{
+		size_t size;
+		const int kind = unpack_option (&copy, &size);
+
+		if (kind == UNPACK_NONE || kind == UNPACK_PADDING)
+		{
+			continue;
+		}
+
+		if (kind != UNPACK_FIXED && kind != UNPACK_ZERO)
+		{
+			unpack_alignment (&copy, size);
+		}
+
+		results++;
+	}
+
+	/* One more, for the length of a string being read. */
+	luaL_checkstack (state->L, results + 1, "too many results");
+}
+
+/*
+ * Pushes each value described by `format`, read from the current position
+ * of `file`.  At the end of the file, returns `nil`, leaving the position
+ * unaltered.
+ */
+extern int
+casc_unpack (
+	lua_State *L,
+	struct CASC_File *file,
+	const char *format)
+{
+	struct Unpack_State state;
+	state.L = L;
+	state.file = file;
+	state.format = format;
+	state.little = native.little;
+	state.alignment = 1;
+
+	const ULONGLONG start = file->position;
+	const int base = lua_gettop (L);
+	int status = 1;
+
+	unpack_validate (&state);
+	SetCascError (ERROR_SUCCESS);
+
+	while (*state.format && status == 1)
+	{
+		size_t size;
+		const int kind = unpack_option (&state, &size);
+
+		if (kind == UNPACK_NONE)
+		{
+			continue;
+		}
+
+		luaL_checkstack (L, 2, "too many results");
+
+		if (kind != UNPACK_FIXED && kind != UNPACK_ZERO
+			&& kind != UNPACK_PADDING)
+		{
+			status = unpack_align (&state, size);
+
+			if (status != 1)
+			{
+				break;
+			}
+		}
+
+		switch (kind)
+		{
+			case UNPACK_INTEGER:
+			case UNPACK_UNSIGNED:
+			{
+				status = unpack_integer (
+					&state, size, kind == UNPACK_INTEGER);
+				break;
+			}
+
+			case UNPACK_FLOAT:
+			case UNPACK_DOUBLE:
+			case UNPACK_NUMBER:
+			{
+				status = unpack_float (&state, kind, size);
+				break;
+			}
+
+			case UNPACK_FIXED:
+			{
+				status = unpack_fixed (&state, size);
+				break;
+			}
+
+			case UNPACK_STRING:
+			{
+				status = unpack_integer (&state, size, 0);
+
+				if (status == 1)
+				{
+					const lua_Integer length = lua_tointeger (L, -1);
+					lua_pop (L, 1);
+					status = unpack_fixed (&state, (size_t) length);
+				}
+
+				break;
+			}
+
+			case UNPACK_ZERO:
+			{
+				status = unpack_zero (&state);
+				break;
+			}
+
+			case UNPACK_PADDING:
+			{
+				if (file->position + 1 > file->size)
+				{
+					status = -1;
+				}
+				else
+				{
+					file->position++;
+				}
+
+				break;
+			}
+		}
+	}
+
+	if (status == 1)
+	{
+		return lua_gettop (L) - base;
+	}
+
+	file->position = start;
+	lua_settop (L, base);
+
+	if (status == 0)
+	{
+		return casc_result (L, 0);
+	}
+
+	lua_pushnil (L);
+	return 1;
+}
@@ -0,0 +1,14 @@
+#ifndef CASC_UNPACK_H
+#define CASC_UNPACK_H
+
+#include <lua.h>
+
+struct CASC_File;
+
+extern int
+casc_unpack (
+	lua_State *L,
+	struct CASC_File *file,
+	const char *format);
+
+#endif